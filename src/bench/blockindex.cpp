@@ -0,0 +1,103 @@
+// Copyright (c) 2025 L2L
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench.h"
+#include "arith_uint256.h"
+#include "chain.h"
+#include "main.h"
+#include "memusage.h"
+#include "random.h"
+#include "uint256.h"
+
+#include <assert.h>
+#include <cstdlib>
+#include <iostream>
+
+static const int DEFAULT_CHAIN_LENGTH = 100000;
+static const int WALK_LENGTH = 1000;
+
+// Number of headers in the synthetic chain. Set BENCH_BLOCKINDEX_ENTRIES to
+// measure the memory of a larger index, e.g. 5000000 for a long-lived chain
+// (several GB).
+static int GetChainLength()
+{
+    const char* pszEntries = std::getenv("BENCH_BLOCKINDEX_ENTRIES");
+    int nEntries = pszEntries ? std::atoi(pszEntries) : 0;
+    return nEntries > WALK_LENGTH ? nEntries : DEFAULT_CHAIN_LENGTH;
+}
+
+// A synthetic chain of headers, indexed the way mapBlockIndex indexes the
+// headers of the node
+struct SyntheticBlockIndex
+{
+    BlockMap mapIndex;
+    CBlockIndexPool pool;
+    CChain chain;
+
+    SyntheticBlockIndex()
+    {
+        const int nChainLength = GetChainLength();
+        mapIndex.reserve(nChainLength);
+        CBlockIndex* pindexPrev = nullptr;
+        for (int i = 0; i < nChainLength; i++) {
+            CBlockHeader header;
+            header.hashMerkleRoot = ArithToUint256(arith_uint256(i));
+            header.nTime = 1700000000 + i * 150;
+            header.nBits = 0x200f0f0f;
+
+            CBlockIndex* pindex = pool.Allocate();
+            *pindex = CBlockIndex(header);
+            BlockMap::iterator mi = mapIndex.insert(std::make_pair(GetRandHash(), pindex)).first;
+            pindex->phashBlock = &mi->first;
+            pindex->pprev = pindexPrev;
+            pindex->nHeight = i;
+            pindex->nChainWork = (pindexPrev ? pindexPrev->nChainWork : 0) + 1;
+            pindex->nStatus = BLOCK_VALID_SCRIPTS | BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO;
+            pindex->BuildSkip();
+            pindexPrev = pindex;
+        }
+        chain.SetTip(pindexPrev);
+
+        size_t nUsage = memusage::DynamicUsage(mapIndex) + pool.DynamicMemoryUsage();
+        std::cout << "#BlockIndexMemory,entries," << mapIndex.size() << ",bytes," << nUsage
+                  << ",bytes/entry," << nUsage / mapIndex.size() << "\n";
+    }
+};
+
+static SyntheticBlockIndex& GetSyntheticBlockIndex()
+{
+    static SyntheticBlockIndex index;
+    return index;
+}
+
+// Walk back along pprev from random entries, as when computing the median
+// time past or the work of a fork
+static void BlockIndexWalk(benchmark::State& state)
+{
+    SyntheticBlockIndex& index = GetSyntheticBlockIndex();
+
+    int64_t nTimeSum = 0;
+    while (state.KeepRunning()) {
+        const CBlockIndex* pindex = index.chain[WALK_LENGTH + GetRand(index.chain.Height() + 1 - WALK_LENGTH)];
+        for (int i = 0; i < WALK_LENGTH && pindex->IsValid(BLOCK_VALID_SCRIPTS); i++) {
+            nTimeSum += pindex->GetBlockTime();
+            pindex = pindex->pprev;
+        }
+    }
+    assert(nTimeSum > 0);
+}
+
+static void BlockIndexAncestor(benchmark::State& state)
+{
+    SyntheticBlockIndex& index = GetSyntheticBlockIndex();
+
+    while (state.KeepRunning()) {
+        int nHeight = GetRand(index.chain.Height() + 1);
+        const CBlockIndex* pindex = index.chain.Tip()->GetAncestor(nHeight);
+        assert(pindex->nHeight == nHeight);
+    }
+}
+
+BENCHMARK(BlockIndexWalk);
+BENCHMARK(BlockIndexAncestor);
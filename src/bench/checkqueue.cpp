@@ -7,6 +7,8 @@
 #include "util/system.h"
 #include "main.h"
 #include "checkqueue.h"
+#include "checkpool.h"
+#include "crypto/sha256.h"
 #include "prevector.h"
 #include <vector>
 #include <boost/thread/thread.hpp>
@@ -100,5 +102,99 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.interrupt_all();
     tg.join_all();
 }
+
+// The benchmarks below compare CCheckQueue with CCheckPool for a fixed
+// number of worker threads. Checks that do no work show the cost of
+// handing out work; hashing the size of a typical transaction is closer
+// to the cheapest checks done while connecting a block.
+static const size_t HASH_JOB_SIZE = 250;
+
+struct NoWorkJob {
+    bool operator()()
+    {
+        return true;
+    }
+    void swap(NoWorkJob& x){};
+};
+
+struct HashJob {
+    static uint8_t data[HASH_JOB_SIZE];
+    bool operator()()
+    {
+        uint8_t hash[CSHA256::OUTPUT_SIZE];
+        CSHA256().Write(data, sizeof(data)).Finalize(hash);
+        return hash[0] != data[0] || hash[1] != data[1];
+    }
+    void swap(HashJob& x){};
+};
+uint8_t HashJob::data[HASH_JOB_SIZE] = {1};
+
+template <typename Job>
+static void CheckQueueWorkers(benchmark::State& state, int nWorkers)
+{
+    CCheckQueue<Job> queue {QUEUE_BATCH_SIZE};
+    boost::thread_group tg;
+    for (auto x = 0; x < nWorkers; ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<Job> control(&queue);
+        std::vector<std::vector<Job>> vBatches(BATCHES);
+        for (auto& vChecks : vBatches) {
+            vChecks.resize(BATCH_SIZE);
+            control.Add(vChecks);
+        }
+        control.Wait();
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+template <typename Job>
+static void CheckPoolWorkers(benchmark::State& state, int nWorkers)
+{
+    CCheckPool pool(nWorkers);
+    boost::thread_group tg;
+    for (auto x = 0; x < nWorkers; ++x) {
+       tg.create_thread([&]{pool.Thread();});
+    }
+    while (state.KeepRunning()) {
+        CCheckPoolControl control(&pool);
+        std::vector<std::vector<Job>> vBatches(BATCHES);
+        for (auto& vChecks : vBatches) {
+            vChecks.resize(BATCH_SIZE);
+            control.Add(vChecks);
+        }
+        control.Wait();
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+static void CCheckQueueNoWork4(benchmark::State& state) { CheckQueueWorkers<NoWorkJob>(state, 4); }
+static void CCheckQueueNoWork16(benchmark::State& state) { CheckQueueWorkers<NoWorkJob>(state, 16); }
+static void CCheckQueueNoWork64(benchmark::State& state) { CheckQueueWorkers<NoWorkJob>(state, 64); }
+static void CCheckPoolNoWork4(benchmark::State& state) { CheckPoolWorkers<NoWorkJob>(state, 4); }
+static void CCheckPoolNoWork16(benchmark::State& state) { CheckPoolWorkers<NoWorkJob>(state, 16); }
+static void CCheckPoolNoWork64(benchmark::State& state) { CheckPoolWorkers<NoWorkJob>(state, 64); }
+static void CCheckQueueHash4(benchmark::State& state) { CheckQueueWorkers<HashJob>(state, 4); }
+static void CCheckQueueHash16(benchmark::State& state) { CheckQueueWorkers<HashJob>(state, 16); }
+static void CCheckQueueHash64(benchmark::State& state) { CheckQueueWorkers<HashJob>(state, 64); }
+static void CCheckPoolHash4(benchmark::State& state) { CheckPoolWorkers<HashJob>(state, 4); }
+static void CCheckPoolHash16(benchmark::State& state) { CheckPoolWorkers<HashJob>(state, 16); }
+static void CCheckPoolHash64(benchmark::State& state) { CheckPoolWorkers<HashJob>(state, 64); }
+
 BENCHMARK(CCheckQueueSpeed);
 BENCHMARK(CCheckQueueSpeedPrevectorJob);
+BENCHMARK(CCheckQueueNoWork4);
+BENCHMARK(CCheckQueueNoWork16);
+BENCHMARK(CCheckQueueNoWork64);
+BENCHMARK(CCheckPoolNoWork4);
+BENCHMARK(CCheckPoolNoWork16);
+BENCHMARK(CCheckPoolNoWork64);
+BENCHMARK(CCheckQueueHash4);
+BENCHMARK(CCheckQueueHash16);
+BENCHMARK(CCheckQueueHash64);
+BENCHMARK(CCheckPoolHash4);
+BENCHMARK(CCheckPoolHash16);
+BENCHMARK(CCheckPoolHash64);
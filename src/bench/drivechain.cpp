@@ -0,0 +1,273 @@
+// Copyright (c) 2025 L2L
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench.h"
+#include "arith_uint256.h"
+#include "chainparams.h"
+#include "drivechain.h"
+#include "hash.h"
+#include "main.h"
+#include "miner.h"
+#include "pow.h"
+#include "random.h"
+#include "script/script.h"
+#include "test/mainchain_mock.h"
+#include "tinyformat.h"
+#include "txdb.h"
+#include "uint256.h"
+
+#include <univalue.h>
+
+#include <assert.h>
+#include <map>
+
+static const int BATCH_SIZE = 1000;
+static const int INDEX_SIZE = 1000000;
+
+// Pretty-printed reply to a batch of 'getblockhash' calls, as returned by a
+// mainchain node
+static std::string BlockHashBatchReply()
+{
+    std::string strReply = "[\n";
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        const uint256 hash = ArithToUint256(arith_uint256(i + 1));
+        strReply += strprintf("  {\n    \"result\": \"%s\",\n    \"error\": null,\n    \"id\": %d\n  }%s\n",
+                hash.GetHex(), i, i + 1 < BATCH_SIZE ? "," : "");
+    }
+    strReply += "]\n";
+    return strReply;
+}
+
+static void DecodeBlockHashBatch(benchmark::State& state)
+{
+    const std::string strReply = BlockHashBatchReply();
+    std::vector<uint256> vHash;
+
+    while (state.KeepRunning()) {
+        UniValue reply;
+        bool fRead = reply.read(strReply.data(), strReply.size());
+        assert(fRead);
+
+        vHash.assign(BATCH_SIZE, uint256());
+        bool fDecoded = DecodeBTCBlockHashBatch(reply, 0, vHash);
+        assert(fDecoded);
+    }
+}
+
+static std::vector<uint256> MainBlockHashes()
+{
+    std::vector<uint256> vHash;
+    vHash.reserve(INDEX_SIZE);
+    for (int i = 0; i < INDEX_SIZE; i++)
+        vHash.push_back(SerializeHash(i));
+    return vHash;
+}
+
+static void MainBlockHashIndexAppend(benchmark::State& state)
+{
+    const std::vector<uint256> vHash = MainBlockHashes();
+    std::unique_ptr<CMainBlockHashIndex> index(new CMainBlockHashIndex());
+
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        if (i == vHash.size()) {
+            index.reset(new CMainBlockHashIndex());
+            i = 0;
+        }
+        index->Append(vHash[i++]);
+    }
+}
+
+static void MainBlockHashIndexLookup(benchmark::State& state)
+{
+    const std::vector<uint256> vHash = MainBlockHashes();
+    CMainBlockHashIndex index;
+    for (const uint256& hash : vHash)
+        index.Append(hash);
+
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        // Alternate between hits and misses
+        uint256 hash = vHash[i++ % vHash.size()];
+        if (i & 1)
+            hash.begin()[0] ^= 1;
+        bool fFound = index.Contains(hash);
+        assert(fFound == !(i & 1));
+    }
+}
+
+// The std::map the index replaced, for comparison
+static void MainBlockMapLookup(benchmark::State& state)
+{
+    const std::vector<uint256> vHash = MainBlockHashes();
+    std::map<uint256, size_t> mapIndex;
+    for (size_t i = 0; i < vHash.size(); i++)
+        mapIndex[vHash[i]] = i;
+
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        uint256 hash = vHash[i++ % vHash.size()];
+        if (i & 1)
+            hash.begin()[0] ^= 1;
+        bool fFound = mapIndex.count(hash);
+        assert(fFound == !(i & 1));
+    }
+}
+
+// Mainchain for the benchmarks against the mainchain node stand-in, which
+// answers each request after MAINCHAIN_LATENCY milliseconds
+static const int MAINCHAIN_BLOCKS = 10000;
+static const int64_t MAINCHAIN_LATENCY = 1;
+
+static void ResetMainBlockCache()
+{
+    std::vector<uint256> vDisconnected;
+    std::shared_ptr<const CMainBlockCacheSnapshot> pBase;
+    do {
+        pBase = GetMainBlockCacheSnapshot();
+    } while (!PublishMainBlockCache(pBase, -1, {}, vDisconnected));
+}
+
+// Fill an empty mainchain block cache
+static void MainchainCacheCatchUp(benchmark::State& state)
+{
+    CMainchainMock mock(MAINCHAIN_BLOCKS);
+    mock.SetLatency(MAINCHAIN_LATENCY);
+    mock.Install();
+
+    while (state.KeepRunning()) {
+        ResetMainBlockCache();
+
+        bool fReorg = false;
+        std::vector<uint256> vDisconnected;
+        bool fUpdated = UpdateMainBlockHashCache(fReorg, vDisconnected);
+        assert(fUpdated);
+    }
+
+    ResetMainBlockCache();
+}
+
+// Follow a 6 block mainchain reorg
+static void MainchainCacheReorg(benchmark::State& state)
+{
+    CMainchainMock mock(MAINCHAIN_BLOCKS);
+    mock.SetLatency(MAINCHAIN_LATENCY);
+    mock.Install();
+
+    ResetMainBlockCache();
+    bool fReorg = false;
+    std::vector<uint256> vDisconnected;
+    bool fUpdated = UpdateMainBlockHashCache(fReorg, vDisconnected);
+    assert(fUpdated);
+
+    while (state.KeepRunning()) {
+        mock.Reorg(6, 7);
+
+        fReorg = false;
+        vDisconnected.clear();
+        fUpdated = UpdateMainBlockHashCache(fReorg, vDisconnected);
+        assert(fUpdated && fReorg);
+    }
+
+    ResetMainBlockCache();
+}
+
+// A full 'headers' message of regtest headers with valid proof of work
+static std::vector<CBlockHeader> HeadersMessage(const Consensus::Params& params, uint32_t nTime)
+{
+    std::vector<CBlockHeader> vHeader(MAX_HEADERS_RESULTS);
+    uint256 hashPrev;
+    for (CBlockHeader& header : vHeader) {
+        header.nVersion = CBlockHeader::CURRENT_VERSION;
+        header.hashPrevBlock = hashPrev;
+        header.hashMerkleRoot = GetRandHash(); // h*
+        header.nTime = nTime++;
+        header.nBits = UintToArith256(params.powLimit).GetCompact();
+        while (!CheckProofOfWork(header.GetHash(), header.nBits, params))
+            header.nNonce = ArithToUint256(UintToArith256(header.nNonce) + 1);
+        hashPrev = header.GetHash();
+    }
+    return vHeader;
+}
+
+// Verify BMM for the headers of a 'headers' message that aren't cached yet.
+// The enforcer request is still a stub, so this measures the cost added to
+// header sync on top of the enforcer round trip.
+static void HeaderSyncBMM(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    const Consensus::Params& params = Params().GetConsensus();
+
+    std::vector<std::vector<CBlockHeader>> vMessage;
+    for (int i = 0; i < 10; i++)
+        vMessage.push_back(HeadersMessage(params, i * MAX_HEADERS_RESULTS));
+
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        // Start over with an empty cache once every message was verified
+        if (i % vMessage.size() == 0)
+            InitBMMCache(DEFAULT_BMM_CACHE_SIZE << 20);
+
+        size_t nVerified = VerifyBMMBatch(vMessage[i++ % vMessage.size()], params);
+        assert(nVerified == MAX_HEADERS_RESULTS);
+    }
+}
+
+// Build the coinbase of a new block paying out nDeposits pending deposits
+static void CreateCoinbaseWithDeposits(benchmark::State& state, int nDeposits)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+
+    CMainchainMock mock;
+    mock.AddDeposits(nDeposits, COIN);
+    mock.Install();
+
+    // Store the deposits and publish them as the deposit payout snapshot
+    ResetMainBlockCache();
+    pdepositdb = new CDepositDB(1 << 20, true);
+    bool fReorg = false;
+    std::vector<uint256> vDisconnected;
+    bool fSynced = UpdateMainBlockHashCache(fReorg, vDisconnected) && SyncDrivechainDeposits() && RefreshDepositPayouts();
+    assert(fSynced);
+
+    boost::shared_ptr<CReserveScript> coinbaseScript(new CReserveScript());
+    coinbaseScript->reserveScript = CScript() << OP_TRUE;
+    const MinerAddress minerAddress = coinbaseScript;
+
+    while (state.KeepRunning()) {
+        std::shared_ptr<const CDepositPayoutSnapshot> pDeposits = GetDepositPayouts(uint256());
+        CMutableTransaction mtx = CreateCoinbaseTransaction(Params(), 0, minerAddress, 1, pDeposits->vDeposit);
+        assert(mtx.vout.size() > (size_t)nDeposits);
+    }
+
+    delete pdepositdb;
+    pdepositdb = nullptr;
+    ResetMainBlockCache();
+}
+
+static void CreateCoinbase0Deposits(benchmark::State& state)
+{
+    CreateCoinbaseWithDeposits(state, 0);
+}
+
+static void CreateCoinbase100Deposits(benchmark::State& state)
+{
+    CreateCoinbaseWithDeposits(state, 100);
+}
+
+static void CreateCoinbase1000Deposits(benchmark::State& state)
+{
+    CreateCoinbaseWithDeposits(state, 1000);
+}
+
+BENCHMARK(DecodeBlockHashBatch);
+BENCHMARK(MainBlockHashIndexAppend);
+BENCHMARK(MainBlockHashIndexLookup);
+BENCHMARK(MainBlockMapLookup);
+BENCHMARK(MainchainCacheCatchUp);
+BENCHMARK(MainchainCacheReorg);
+BENCHMARK(HeaderSyncBMM);
+BENCHMARK(CreateCoinbase0Deposits);
+BENCHMARK(CreateCoinbase100Deposits);
+BENCHMARK(CreateCoinbase1000Deposits);
@@ -0,0 +1,150 @@
+// Copyright (c) 2025 L2L
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "consensus/upgrades.h"
+#include "key.h"
+#include "keystore.h"
+#include "main.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/sigcache.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "txmempool.h"
+#include "util/system.h"
+
+#include <assert.h>
+#include <list>
+#include <vector>
+
+#include <boost/thread/thread.hpp>
+
+static const int MEMPOOL_SIZE = 50000;
+static const int PRECHECK_BATCH_SIZE = 1000;
+
+// A transaction with a JoinSplit revealing two random nullifiers
+static CTransaction ShieldedTransaction()
+{
+    CMutableTransaction mtx;
+    mtx.nVersion = 2;
+    JSDescription jsdesc;
+    for (uint256& nf : jsdesc.nullifiers)
+        nf = GetRandHash();
+    jsdesc.randomSeed = GetRandHash();
+    mtx.vJoinSplit.push_back(jsdesc);
+    return CTransaction(mtx);
+}
+
+// The mempool side of AcceptToMemoryPool for shielded transactions, with
+// MEMPOOL_SIZE shielded transactions in the mempool: check the nullifiers
+// of a new transaction against the mempool, add it, and evict the oldest
+// transaction to keep the size of the mempool constant.
+static void MempoolShieldedAccept(benchmark::State& state)
+{
+    CTxMemPool pool(CFeeRate(0));
+    std::vector<CTransaction> vTx;
+    for (int i = 0; i < MEMPOOL_SIZE + 1000; i++)
+        vTx.push_back(ShieldedTransaction());
+
+    auto addTx = [&](const CTransaction& tx) {
+        CTxMemPoolEntry entry(tx, 0, 0, 1, true, false, 0, SPROUT_BRANCH_ID);
+        pool.addUnchecked(tx.GetHash(), entry);
+    };
+    for (int i = 0; i < MEMPOOL_SIZE; i++)
+        addTx(vTx[i]);
+
+    size_t nNext = MEMPOOL_SIZE;
+    size_t nOldest = 0;
+    std::list<CTransaction> removed;
+    while (state.KeepRunning()) {
+        const CTransaction& tx = vTx[nNext];
+        {
+            LOCK(pool.cs);
+            for (const JSDescription& jsdesc : tx.vJoinSplit) {
+                for (const uint256& nf : jsdesc.nullifiers) {
+                    bool fExists = pool.nullifierExists(nf, SPROUT);
+                    assert(!fExists);
+                }
+            }
+        }
+        addTx(tx);
+
+        removed.clear();
+        pool.remove(vTx[nOldest], removed);
+        nNext = (nNext + 1) % vTx.size();
+        nOldest = (nOldest + 1) % vTx.size();
+    }
+}
+
+// Verify a batch of PRECHECK_BATCH_SIZE transactions, each spending two
+// P2PKH outputs, with PreCheckTransactions() on nThreads threads. Every round
+// starts with an empty signature cache, so that all signatures are verified.
+static void MempoolPreCheck(benchmark::State& state, int nThreads)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    auto consensusBranchId = CurrentEpochBranchId(0, Params().GetConsensus());
+
+    CKey key = CKey::TestOnlyRandomKey(true);
+    CBasicKeyStore keystore;
+    keystore.AddKey(key);
+    CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    CCoinsViewDummy dummy;
+    CCoinsViewCache coins(&dummy);
+    std::vector<CTransaction> vtx;
+    for (int i = 0; i < PRECHECK_BATCH_SIZE; i++) {
+        CMutableTransaction mtx;
+        std::vector<CTxOut> allPrevOutputs;
+        for (uint32_t n = 0; n < 2; n++) {
+            uint256 prevId = GetRandHash();
+            CCoinsModifier prev = coins.ModifyCoins(prevId);
+            prev->vout.resize(1);
+            prev->vout[0] = CTxOut(1000, scriptPubKey);
+            mtx.vin.push_back(CTxIn(COutPoint(prevId, 0)));
+            allPrevOutputs.push_back(prev->vout[0]);
+        }
+        mtx.vout.push_back(CTxOut(1500, scriptPubKey));
+
+        const PrecomputedTransactionData txdata(mtx, allPrevOutputs);
+        for (uint32_t n = 0; n < mtx.vin.size(); n++) {
+            bool fSigned = SignSignature(keystore, scriptPubKey, mtx, txdata, n, 1000, SIGHASH_ALL, consensusBranchId);
+            assert(fSigned);
+        }
+        vtx.push_back(CTransaction(mtx));
+    }
+
+    CTxMemPool pool(CFeeRate(0));
+    pcoinsTip = &coins;
+    nScriptCheckThreads = nThreads;
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads - 1; i++)
+        threadGroup.create_thread(&ThreadScriptCheck);
+
+    while (state.KeepRunning()) {
+        InitSignatureCache(1 << 22);
+        PreCheckTransactions(Params(), pool, vtx);
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    nScriptCheckThreads = 0;
+    pcoinsTip = nullptr;
+}
+
+static void MempoolPreCheckSerial(benchmark::State& state)
+{
+    MempoolPreCheck(state, 0);
+}
+
+static void MempoolPreCheckParallel(benchmark::State& state)
+{
+    MempoolPreCheck(state, std::max(2, GetNumCores()));
+}
+
+BENCHMARK(MempoolShieldedAccept);
+BENCHMARK(MempoolPreCheckSerial);
+BENCHMARK(MempoolPreCheckParallel);
@@ -7,6 +7,7 @@
 #include "chain.h"
 
 #include "main.h"
+#include "memusage.h"
 #include "primitives/block.h"
 #include "txdb.h"
 
@@ -73,10 +74,10 @@ void CBlockIndex::TrimSolution()
     // handled by re-reading the solution from the existing db entry. It does not help to
     // try to avoid these reads by gating trimming on the validity status: the re-reads are
     // efficient anyway because of caching in leveldb, and most of them are unavoidable.
-    if (HasSolution()) {
+    // Entries with the placeholder solution have nothing to trim.
+    if (pSolution) {
         MetricsIncrementCounter("zcashd.debug.memory.trimmed_equihash_solutions");
-        std::vector<unsigned char> empty;
-        nSolution.swap(empty);
+        pSolution.reset();
     }
 }
 
@@ -94,7 +95,18 @@ CBlockHeader CBlockIndex::GetBlockHeader() const
     header.nTime                = nTime;
     header.nBits                = nBits;
     header.nNonce               = nNonce;
-    header.nSolution            = DRIVECHAIN_EH_SOLUTION;
+    if (fPlaceholderSolution) {
+        header.nSolution        = DRIVECHAIN_EH_SOLUTION;
+    } else if (pSolution) {
+        header.nSolution        = *pSolution;
+    } else {
+        CDiskBlockIndex dbindex;
+        if (!pblocktree->ReadDiskBlockIndex(GetBlockHash(), dbindex)) {
+            LogPrintf("%s: ReadDiskBlockIndex failed to read index entry", __func__);
+            throw std::runtime_error("Failed to read index entry");
+        }
+        header.nSolution        = dbindex.GetSolution();
+    }
     return header;
 }
 
@@ -148,3 +160,38 @@ void CBlockIndex::BuildSkip()
     if (pprev)
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
+
+CBlockIndex* CBlockIndexPool::Allocate()
+{
+    if (!vFree.empty()) {
+        CBlockIndex* pindex = vFree.back();
+        vFree.pop_back();
+        return pindex;
+    }
+    if (nChunkUsed == CHUNK_SIZE) {
+        vChunk.emplace_back(new CBlockIndex[CHUNK_SIZE]);
+        nChunkUsed = 0;
+    }
+    return &vChunk.back()[nChunkUsed++];
+}
+
+void CBlockIndexPool::Free(const CBlockIndex* pindex)
+{
+    // The entry is owned by the pool, like delete on a const pointer
+    CBlockIndex* pindexFree = const_cast<CBlockIndex*>(pindex);
+    *pindexFree = CBlockIndex();
+    vFree.push_back(pindexFree);
+}
+
+void CBlockIndexPool::Clear()
+{
+    vChunk.clear();
+    vFree.clear();
+    nChunkUsed = CHUNK_SIZE;
+}
+
+size_t CBlockIndexPool::DynamicMemoryUsage() const
+{
+    return vChunk.size() * memusage::MallocUsage(CHUNK_SIZE * sizeof(CBlockIndex)) +
+        memusage::DynamicUsage(vChunk) + memusage::DynamicUsage(vFree);
+}
@@ -14,6 +14,7 @@
 #include "uint256.h"
 #include "util/strencodings.h"
 
+#include <memory>
 #include <optional>
 #include <vector>
 
@@ -233,6 +234,18 @@ public:
     //! Verification status of this block. See enum BlockStatus
     unsigned int nStatus;
 
+    //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
+    uint32_t nSequenceId;
+
+    //! block header fields read while walking the chain (the remaining header
+    //! fields are kept with the commitments below)
+    unsigned int nTime;
+    unsigned int nBits;
+
+    // Fields above are read on most walks along pprev/pskip and are kept
+    // together at the start of the entry; fields below are only needed when
+    // connecting blocks or serving RPCs.
+
     //! Branch ID corresponding to the consensus rules used to validate this block.
     //! Only cached if block validity is BLOCK_VALID_CONSENSUS.
     //! Persisted at each activation height, memory-only for intervening blocks.
@@ -350,18 +363,17 @@ public:
     int nVersion;
     uint256 hashMerkleRoot;
     uint256 hashBlockCommitments;
-    unsigned int nTime;
-    unsigned int nBits;
     uint256 nNonce;
 protected:
-    // The Equihash solution, if it is stored. Once we know that the block index
-    // entry is present in leveldb, this field can be cleared via the TrimSolution
-    // method to save memory.
-    std::vector<unsigned char> nSolution = DRIVECHAIN_EH_SOLUTION;
+    // Blocks of this chain carry the fixed DRIVECHAIN_EH_SOLUTION, which is not
+    // stored per entry. Any other solution (such as those of the genesis blocks)
+    // is kept in pSolution until we know that the block index entry is present
+    // in leveldb, after which it can be cleared via the TrimSolution method to
+    // save memory.
+    bool fPlaceholderSolution;
+    std::shared_ptr<const std::vector<unsigned char>> pSolution;
 
 public:
-    //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
-    uint32_t nSequenceId;
 
     void SetNull()
     {
@@ -384,6 +396,8 @@ public:
         hashFinalOrchardRoot = uint256();
         hashChainHistoryRoot = uint256();
         nSequenceId = 0;
+        fPlaceholderSolution = true;
+        pSolution.reset();
 
         nChainSupplyDelta = std::nullopt;
         nChainTotalSupply = std::nullopt;
@@ -422,8 +436,11 @@ public:
         nTime          = block.nTime;
         nBits          = block.nBits;
         nNonce         = block.nNonce;
-        nSolution      = block.nSolution;
-        MetricsIncrementCounter("zcashd.debug.memory.allocated_equihash_solutions");
+        if (block.nSolution != DRIVECHAIN_EH_SOLUTION) {
+            fPlaceholderSolution = false;
+            pSolution = std::make_shared<const std::vector<unsigned char>>(block.nSolution);
+            MetricsIncrementCounter("zcashd.debug.memory.allocated_equihash_solutions");
+        }
     }
 
     CDiskBlockPos GetBlockPos() const {
@@ -498,7 +515,15 @@ public:
     //! Is the Equihash solution stored?
     bool HasSolution() const
     {
-        return true;
+        return fPlaceholderSolution || pSolution;
+    }
+
+    //! Record that the Equihash solution of this entry is only stored in
+    //! leveldb, as when loading the entry from there.
+    void SetDiskSolution(const std::vector<unsigned char>& solution)
+    {
+        fPlaceholderSolution = solution == DRIVECHAIN_EH_SOLUTION;
+        pSolution.reset();
     }
 
     //! Raise the validity level of this block index entry.
@@ -535,13 +560,20 @@ public:
     // objects from disk anyway).
     int nClientVersion = 0;
 
+    //! The Equihash solution, as stored in leveldb.
+    std::vector<unsigned char> nSolution;
+
     CDiskBlockIndex() {
         hashPrev = uint256();
     }
 
     explicit CDiskBlockIndex(const CBlockIndex* pindex, std::function<std::vector<unsigned char>()> getSolution) : CBlockIndex(*pindex) {
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
-        if (!HasSolution()) {
+        if (fPlaceholderSolution) {
+            nSolution = DRIVECHAIN_EH_SOLUTION;
+        } else if (pSolution) {
+            nSolution = *pSolution;
+        } else {
             nSolution = getSolution();
         }
     }
@@ -660,7 +692,6 @@ public:
 
     std::vector<unsigned char> GetSolution() const
     {
-        assert(HasSolution());
         return nSolution;
     }
 
@@ -682,6 +713,40 @@ private:
     }
 };
 
+/**
+ * Allocates block index entries in large contiguous chunks, so that entries
+ * created one after another (as when loading the block index or syncing
+ * headers) are adjacent in memory, and no entry needs a heap allocation of
+ * its own. Memory is only returned when the pool is cleared; freed entries
+ * are reused by later allocations.
+ */
+class CBlockIndexPool
+{
+private:
+    static const size_t CHUNK_SIZE = 4096;
+
+    std::vector<std::unique_ptr<CBlockIndex[]>> vChunk;
+    size_t nChunkUsed = CHUNK_SIZE;
+    std::vector<CBlockIndex*> vFree;
+
+public:
+    CBlockIndexPool() {}
+    CBlockIndexPool(const CBlockIndexPool&) = delete;
+    CBlockIndexPool& operator=(const CBlockIndexPool&) = delete;
+
+    //! Return a null entry owned by the pool.
+    CBlockIndex* Allocate();
+
+    //! Return an entry to the pool. pindex must have been allocated from it.
+    void Free(const CBlockIndex* pindex);
+
+    //! Release all entries. Invalidates every pointer handed out.
+    void Clear();
+
+    size_t Size() const { return vChunk.size() * CHUNK_SIZE - (CHUNK_SIZE - nChunkUsed) - vFree.size(); }
+    size_t DynamicMemoryUsage() const;
+};
+
 /** An in-memory indexed chain of blocks. */
 class CChain {
 private:
@@ -0,0 +1,238 @@
+// Copyright (c) 2025 L2L
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "checkpool.h"
+
+#include <boost/thread/locks.hpp>
+#include <boost/thread/thread.hpp>
+
+CCheckPool::CCheckPool(size_t nMaxWorkersIn, size_t nMaxControls) : nMaxWorkers(nMaxWorkersIn)
+{
+    for (size_t i = 0; i < nMaxWorkers + nMaxControls; i++)
+        vDeques.emplace_back(new TaskDeque());
+}
+
+int CCheckPool::AcquireDeque(size_t nBegin, size_t nEnd)
+{
+    for (size_t i = nBegin; i < nEnd; i++) {
+        bool fExpected = false;
+        if (vDeques[i]->fInUse.compare_exchange_strong(fExpected, true))
+            return i;
+    }
+    return -1;
+}
+
+void CCheckPool::ReleaseDeque(int nDeque)
+{
+    vDeques[nDeque]->fInUse = false;
+}
+
+void CCheckPool::Push(int nDeque, std::unique_ptr<CCheckPoolTask> task)
+{
+    TaskDeque& deque = *vDeques[nDeque];
+    {
+        boost::unique_lock<boost::mutex> lock(deque.mutex);
+        deque.tasks.push_back(std::move(task));
+        deque.nSize = deque.tasks.size();
+    }
+    {
+        boost::unique_lock<boost::mutex> lock(mutexIdle);
+        nQueued++;
+    }
+    condWorker.notify_one();
+}
+
+std::unique_ptr<CCheckPoolTask> CCheckPool::Pop(int nDeque)
+{
+    TaskDeque& deque = *vDeques[nDeque];
+    if (deque.nSize == 0)
+        return nullptr;
+
+    std::unique_ptr<CCheckPoolTask> task;
+    {
+        boost::unique_lock<boost::mutex> lock(deque.mutex);
+        if (deque.tasks.empty())
+            return nullptr;
+        task = std::move(deque.tasks.back());
+        deque.tasks.pop_back();
+        deque.nSize = deque.tasks.size();
+    }
+    nQueued--;
+    return task;
+}
+
+std::unique_ptr<CCheckPoolTask> CCheckPool::Steal(int nThief)
+{
+    // Take half of the tasks at the front of the first deque that has any,
+    // as those are the ones its owner will get to last. Taking half means
+    // that the thief doesn't have to come back for more right away; it runs
+    // the first task and the rest go to the back of its own deque.
+    std::vector<std::unique_ptr<CCheckPoolTask>> vStolen;
+    for (size_t n = 1; n < vDeques.size() && vStolen.empty(); n++) {
+        TaskDeque& victim = *vDeques[(nThief + n) % vDeques.size()];
+        if (victim.nSize == 0)
+            continue;
+
+        boost::unique_lock<boost::mutex> lock(victim.mutex);
+        size_t nSteal = (victim.tasks.size() + 1) / 2;
+        for (size_t i = 0; i < nSteal; i++) {
+            vStolen.push_back(std::move(victim.tasks.front()));
+            victim.tasks.pop_front();
+        }
+        victim.nSize = victim.tasks.size();
+    }
+    if (vStolen.empty())
+        return nullptr;
+
+    if (vStolen.size() > 1) {
+        TaskDeque& deque = *vDeques[nThief];
+        {
+            boost::unique_lock<boost::mutex> lock(deque.mutex);
+            for (size_t i = 1; i < vStolen.size(); i++)
+                deque.tasks.push_back(std::move(vStolen[i]));
+            deque.nSize = deque.tasks.size();
+        }
+        // Another idle worker can now steal from this one.
+        condWorker.notify_one();
+    }
+    nQueued--;
+    return std::move(vStolen[0]);
+}
+
+std::unique_ptr<CCheckPoolTask> CCheckPool::Reclaim(const CCheckPoolControl* pcontrol)
+{
+    // Tasks of pcontrol that aren't in its own deque have been stolen by
+    // workers, and only ever sit in the deques of workers.
+    for (size_t n = 0; n < nMaxWorkers; n++) {
+        TaskDeque& deque = *vDeques[n];
+        if (deque.nSize == 0)
+            continue;
+
+        boost::unique_lock<boost::mutex> lock(deque.mutex);
+        for (auto it = deque.tasks.begin(); it != deque.tasks.end(); ++it) {
+            if ((*it)->pcontrol == pcontrol) {
+                std::unique_ptr<CCheckPoolTask> task = std::move(*it);
+                deque.tasks.erase(it);
+                deque.nSize = deque.tasks.size();
+                nQueued--;
+                return task;
+            }
+        }
+    }
+    return nullptr;
+}
+
+void CCheckPool::RunTask(std::unique_ptr<CCheckPoolTask> task)
+{
+    CCheckPoolControl* pcontrol = task->pcontrol;
+    // Once a check has failed, the remaining tasks of that control are skipped.
+    bool fOk = !pcontrol->fAllOk.load(std::memory_order_relaxed) || task->Run();
+    // Destroy the checks before reporting back, so that a control never
+    // returns while its checks are still being cleaned up.
+    task.reset();
+    pcontrol->TaskDone(fOk);
+}
+
+void CCheckPool::Thread()
+{
+    int nDeque = AcquireDeque(0, nMaxWorkers);
+    if (nDeque < 0)
+        return;
+
+    try {
+        while (true) {
+            std::unique_ptr<CCheckPoolTask> task = Pop(nDeque);
+            if (!task)
+                task = Steal(nDeque);
+            if (task) {
+                RunTask(std::move(task));
+                continue;
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutexIdle);
+            if (nQueued == 0) {
+                condWorker.wait(lock);
+            } else {
+                // The remaining tasks are being moved between deques.
+                lock.unlock();
+                boost::this_thread::interruption_point();
+                boost::this_thread::yield();
+            }
+        }
+    } catch (...) {
+        // Our deque is empty whenever we can be interrupted.
+        ReleaseDeque(nDeque);
+        throw;
+    }
+}
+
+CCheckPoolControl::CCheckPoolControl(CCheckPool* poolIn) : pool(poolIn), nDeque(-1), fDone(false), fAllOk(true), nPending(0)
+{
+    if (pool)
+        nDeque = pool->AcquireDeque(pool->nMaxWorkers, pool->vDeques.size());
+}
+
+CCheckPoolControl::~CCheckPoolControl()
+{
+    // Tasks in the pool point to this control, so they must all have
+    // finished before it goes away, even when unwinding.
+    boost::this_thread::disable_interruption noInterruption;
+    if (!fDone)
+        Wait();
+    if (nDeque >= 0)
+        pool->ReleaseDeque(nDeque);
+}
+
+void CCheckPoolControl::Submit(std::unique_ptr<CCheckPoolTask> task)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nPending++;
+    }
+    pool->Push(nDeque, std::move(task));
+}
+
+void CCheckPoolControl::Flush()
+{
+    for (std::unique_ptr<CCheckPoolTask>& task : vPartial) {
+        if (task)
+            Submit(std::move(task));
+    }
+    vPartial.clear();
+}
+
+void CCheckPoolControl::TaskDone(bool fOk)
+{
+    if (!fOk)
+        fAllOk = false;
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (--nPending == 0)
+        condDone.notify_all();
+}
+
+bool CCheckPoolControl::Wait()
+{
+    if (nDeque >= 0) {
+        Flush();
+        while (true) {
+            // Only run our own tasks, so that we can return as soon as they
+            // are done. Tasks of other controls are left to the workers.
+            std::unique_ptr<CCheckPoolTask> task = pool->Pop(nDeque);
+            if (!task)
+                task = pool->Reclaim(this);
+            if (task) {
+                pool->RunTask(std::move(task));
+                continue;
+            }
+
+            // The rest are running on workers, which wake us once done.
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (nPending == 0)
+                break;
+            condDone.wait(lock);
+        }
+    }
+    fDone = true;
+    return fAllOk;
+}
@@ -0,0 +1,236 @@
+// Copyright (c) 2025 L2L
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef L2L_CHECKPOOL_H
+#define L2L_CHECKPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+class CCheckPoolControl;
+
+//! A task aims to keep a worker busy for about this long (in nanoseconds).
+static const int64_t CHECKPOOL_TARGET_TASK_NANOS = 100000;
+//! Checks per task before anything is known about the cost of a check type.
+static const size_t CHECKPOOL_INITIAL_BATCH_SIZE = 16;
+//! Never put more checks than this in one task.
+static const size_t CHECKPOOL_MAX_BATCH_SIZE = 1024;
+//! Default number of controls that can be using a pool at the same time.
+static const size_t CHECKPOOL_DEFAULT_MAX_CONTROLS = 8;
+
+/** A batch of checks of one type, and the unit of work moved between threads. */
+class CCheckPoolTask
+{
+public:
+    CCheckPoolControl* const pcontrol;
+
+    explicit CCheckPoolTask(CCheckPoolControl* pcontrolIn) : pcontrol(pcontrolIn) {}
+    virtual ~CCheckPoolTask() {}
+
+    //! Run the checks in this task, stopping at the first one that fails.
+    virtual bool Run() = 0;
+};
+
+/**
+ * A batch of checks of type T. The time taken by each batch feeds a running
+ * estimate of the cost of a single T, which sizes the batches that follow.
+ */
+template <typename T>
+class CCheckPoolBatch : public CCheckPoolTask
+{
+private:
+    //! Moving average of the nanoseconds spent in one check of this type.
+    static std::atomic<int64_t> nCheckNanos;
+
+public:
+    std::vector<T> vChecks;
+
+    explicit CCheckPoolBatch(CCheckPoolControl* pcontrolIn) : CCheckPoolTask(pcontrolIn)
+    {
+        vChecks.reserve(TargetSize());
+    }
+
+    //! How many checks of this type to put in one task.
+    static size_t TargetSize()
+    {
+        int64_t nCost = nCheckNanos.load(std::memory_order_relaxed);
+        if (nCost <= 0)
+            return CHECKPOOL_INITIAL_BATCH_SIZE;
+        return std::max<size_t>(1, std::min<size_t>(CHECKPOOL_MAX_BATCH_SIZE, CHECKPOOL_TARGET_TASK_NANOS / nCost));
+    }
+
+    bool Run() override
+    {
+        auto nStart = std::chrono::steady_clock::now();
+        bool fOk = true;
+        size_t nRun = 0;
+        for (T& check : vChecks) {
+            nRun++;
+            if (!check()) {
+                fOk = false;
+                break;
+            }
+        }
+        int64_t nNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - nStart).count();
+        // Updates racing with each other may lose a sample, which is fine for
+        // an estimate. Round up so that a measured cost never decays to zero.
+        int64_t nSample = std::max<int64_t>(1, (nNanos + nRun - 1) / nRun);
+        int64_t nCost = nCheckNanos.load(std::memory_order_relaxed);
+        nCheckNanos.store(nCost <= 0 ? nSample : nCost + (nSample - nCost) / 8, std::memory_order_relaxed);
+        return fOk;
+    }
+};
+
+template <typename T>
+std::atomic<int64_t> CCheckPoolBatch<T>::nCheckNanos{0};
+
+/**
+ * Pool of threads that run verifications of any type.
+ *
+ * Unlike CCheckQueue, there is no single queue and lock that every thread
+ * takes for every batch. Each worker, and each control that is adding work,
+ * owns a deque of tasks. Masters push to the back of their own deque and
+ * workers that run out of work steal half of the tasks at the front of
+ * another deque, so threads only meet on a lock when one of them is out of
+ * work. A task is a batch of checks whose size adapts to the observed cost
+ * of its check type, aiming for CHECKPOOL_TARGET_TASK_NANOS per task.
+ *
+ * Several controls, each with checks of any number of types, may use the
+ * pool at once. A master waiting for its control only runs that control's
+ * tasks, taking them back from workers that haven't got to them yet, so that
+ * it never waits on another control's checks.
+ */
+class CCheckPool
+{
+private:
+    friend class CCheckPoolControl;
+
+    struct TaskDeque {
+        boost::mutex mutex;
+        std::deque<std::unique_ptr<CCheckPoolTask>> tasks;
+        //! Number of tasks, readable without taking the lock.
+        std::atomic<size_t> nSize{0};
+        //! Whether a thread owns this deque.
+        std::atomic<bool> fInUse{false};
+    };
+
+    //! Deques [0, nMaxWorkers) belong to workers, the rest to controls.
+    //! They are never freed while the pool is alive, so any thread may try
+    //! to steal from any of them.
+    std::vector<std::unique_ptr<TaskDeque>> vDeques;
+    const size_t nMaxWorkers;
+
+    //! Protects the sleep of idle workers.
+    boost::mutex mutexIdle;
+    boost::condition_variable condWorker;
+
+    //! Tasks sitting in any deque. Incremented with mutexIdle held.
+    std::atomic<int64_t> nQueued{0};
+
+    int AcquireDeque(size_t nBegin, size_t nEnd);
+    void ReleaseDeque(int nDeque);
+
+    void Push(int nDeque, std::unique_ptr<CCheckPoolTask> task);
+    std::unique_ptr<CCheckPoolTask> Pop(int nDeque);
+    std::unique_ptr<CCheckPoolTask> Steal(int nThief);
+    std::unique_ptr<CCheckPoolTask> Reclaim(const CCheckPoolControl* pcontrol);
+    void RunTask(std::unique_ptr<CCheckPoolTask> task);
+
+public:
+    explicit CCheckPool(size_t nMaxWorkersIn, size_t nMaxControls = CHECKPOOL_DEFAULT_MAX_CONTROLS);
+
+    CCheckPool(const CCheckPool&) = delete;
+    CCheckPool& operator=(const CCheckPool&) = delete;
+
+    //! Worker thread. Returns immediately if nMaxWorkers threads are already running.
+    void Thread();
+};
+
+/**
+ * RAII-style controller object for a CCheckPool that guarantees the passed
+ * checks are finished before continuing. With a NULL pool, or when the pool
+ * already has its maximum number of controls, checks are run as they are added.
+ */
+class CCheckPoolControl
+{
+private:
+    friend class CCheckPool;
+
+    CCheckPool* const pool;
+    int nDeque;
+    bool fDone;
+
+    //! Cleared as soon as any check fails, so later tasks can be skipped.
+    std::atomic<bool> fAllOk;
+
+    //! Protects nPending.
+    boost::mutex mutex;
+    boost::condition_variable condDone;
+    //! Tasks pushed to the pool that haven't completed yet.
+    int nPending;
+
+    //! Batches that are still being filled, at most one per check type.
+    std::vector<std::unique_ptr<CCheckPoolTask>> vPartial;
+
+    void Submit(std::unique_ptr<CCheckPoolTask> task);
+    void Flush();
+    void TaskDone(bool fOk);
+
+public:
+    explicit CCheckPoolControl(CCheckPool* poolIn);
+    ~CCheckPoolControl();
+
+    CCheckPoolControl(const CCheckPoolControl&) = delete;
+    CCheckPoolControl& operator=(const CCheckPoolControl&) = delete;
+
+    //! Wait for all checks to complete, and return whether they all succeeded.
+    bool Wait();
+
+    //! Add checks of type T. T must be default constructible and provide
+    //! swap(T&) and bool operator()(), as for CCheckQueue.
+    template <typename T>
+    void Add(std::vector<T>& vChecks)
+    {
+        if (nDeque < 0) {
+            for (T& check : vChecks) {
+                if (fAllOk.load(std::memory_order_relaxed) && !check())
+                    fAllOk = false;
+            }
+            return;
+        }
+
+        // Find the batch of this type being filled, or a free slot for one.
+        CCheckPoolBatch<T>* pbatch = nullptr;
+        size_t nSlot = vPartial.size();
+        for (size_t i = 0; i < vPartial.size() && !pbatch; i++) {
+            if (!vPartial[i]) {
+                nSlot = std::min(nSlot, i);
+            } else if ((pbatch = dynamic_cast<CCheckPoolBatch<T>*>(vPartial[i].get()))) {
+                nSlot = i;
+            }
+        }
+        for (T& check : vChecks) {
+            if (!pbatch) {
+                if (nSlot == vPartial.size())
+                    vPartial.emplace_back();
+                vPartial[nSlot].reset(pbatch = new CCheckPoolBatch<T>(this));
+            }
+            pbatch->vChecks.emplace_back();
+            pbatch->vChecks.back().swap(check);
+            if (pbatch->vChecks.size() >= CCheckPoolBatch<T>::TargetSize()) {
+                Submit(std::move(vPartial[nSlot]));
+                pbatch = nullptr;
+            }
+        }
+    }
+};
+
+#endif // L2L_CHECKPOOL_H
@@ -24,13 +24,25 @@
 #include <amount.h>
 #include <chainparams.h>
 #include <clientversion.h>
+#include <crypto/common.h>
+#include <crypto/sha256.h>
+#include <cuckoocache.h>
 #include <fs.h>
 #include <hash.h>
+#include <memusage.h>
+#include <pow.h>
 #include <primitives/block.h>
+#include <random.h>
+#include <scheduler.h>
+#include <script/sigcache.h>
 #include <serialize.h>
 #include <streams.h>
+#include <sync.h>
+#include <txdb.h>
 #include <util/strencodings.h>
 #include <util/system.h>
+#include <util/time.h>
+#include <validationinterface.h>
 #include <univalue.h>
 
 #include <deque>
@@ -42,346 +54,1375 @@
 #include <string>
 #include <vector>
 
-#include <boost/array.hpp>
+#include <boost/algorithm/string.hpp>
 #include <boost/asio.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
-#include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/json_parser.hpp>
+#include <boost/thread.hpp>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h> // for mmap
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using boost::asio::ip::tcp;
 
 const std::string BITCOIN_RPC_USER = "user"; // TODO currently hardcoded by enforcer
 const std::string BITCOIN_RPC_PASS = "password"; // TODO currently hardcoded by enforcer
-const std::string BITCOIN_RPC_HOST = "127.0.0.1";
-const int BITCOIN_RPC_PORT = 38332;
 
 const unsigned int THIS_SIDECHAIN = 255;
 
-struct MainBlockCacheIndex
+// Current snapshot of the mainchain block hash cache. Only accessed through
+// std::atomic_load and std::atomic_store so readers never take a lock.
+static std::shared_ptr<const CMainBlockCacheSnapshot> pMainBlockCache = std::make_shared<const CMainBlockCacheSnapshot>();
+
+// Serializes publishing new snapshots. Never held during network I/O.
+static Mutex cs_mainblockcache;
+
+namespace {
+/**
+ * Sidechain block hashes we already verified BMM for with the enforcer.
+ * Bounded, older entries are evicted as new ones are added.
+ */
+class CBMMCache
 {
-    size_t index;
-    uint256 hash;
+private:
+    //! Entries are SHA256(nonce || block hash)
+    uint256 nonce;
+    typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
+    map_type setValid;
+    boost::shared_mutex cs_bmmcache;
+
+public:
+    CBMMCache()
+    {
+        GetRandBytes(nonce.begin(), 32);
+        setValid.setup_bytes(DEFAULT_BMM_CACHE_SIZE << 20);
+    }
+
+    void
+    ComputeEntry(uint256& entry, const uint256& hashBlock)
+    {
+        CSHA256().Write(nonce.begin(), 32).Write(hashBlock.begin(), 32).Finalize(entry.begin());
+    }
+
+    bool
+    Get(const uint256& entry)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_bmmcache);
+        return setValid.contains(entry, false);
+    }
+
+    void Set(uint256& entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_bmmcache);
+        setValid.insert(entry);
+    }
+    uint32_t setup_bytes(size_t n)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_bmmcache);
+        return setValid.setup_bytes(n);
+    }
 };
 
-// Index of mainchain block hash in vMainBlockHash
-std::map<uint256 /* hashMainchainBlock */, MainBlockCacheIndex> mapMainBlock;
+static CBMMCache bmmCache;
+
+// Number of entries bmmCache can hold, also the number of block hashes kept
+// in bmm.dat
+static std::atomic<size_t> nBMMCacheElems{0};
+}
+
+// Verified BMM block hashes that haven't been written to bmm.dat yet, oldest
+// first
+static Mutex cs_bmmunflushed;
+static std::deque<uint256> vBMMUnflushed GUARDED_BY(cs_bmmunflushed);
 
-// List of all known mainchain block hashes in order
-std::vector<uint256> vMainBlockHash;
+// Magic numbers of bmm.dat and mainblockhash.dat
+static const uint32_t BMM_CACHE_MAGIC = 0x314d4d42; // "BMM1"
+static const uint32_t MAINBLOCK_CACHE_MAGIC = 0x3148424d; // "MBH1"
 
-// Sidechain block hashes we already verified with the enforcer
-std::set<uint256 /* hashBlock */> setBMMVerified;
+// Guards the cache files. Lock before cs_bmmunflushed.
+static Mutex cs_cachefiles;
+
+// Cache files, opened by ReadBMMCache and ReadMainBlockCache
+static std::unique_ptr<CHashRecordLog> pbmmlog GUARDED_BY(cs_cachefiles);
+static std::unique_ptr<CHashRecordLog> pmainblocklog GUARDED_BY(cs_cachefiles);
+
+// mainblockhash.dat holds the first pmainblocklog->Size() hashes of this
+// snapshot
+static std::shared_ptr<const CMainBlockCacheSnapshot> pFlushedMainBlockCache GUARDED_BY(cs_cachefiles);
+
+unsigned int nMainchainRPCBatchSize = DEFAULT_MAINCHAIN_RPC_BATCH_SIZE;
 
 // Bitcoin-patched RPC client:
 
-bool RPCBitcoinPatched(const std::string& json, boost::property_tree::ptree &ptree)
+struct CMainchainRPCClient::Connection
+{
+    boost::asio::io_context io;
+    tcp::socket socket;
+
+    // Response bytes are read into this buffer, which keeps its storage
+    // between requests on the same connection.
+    boost::asio::streambuf buf;
+
+    // Body of a chunked response, reassembled from buf
+    std::string strChunked;
+
+    Connection() : socket(io) {}
+};
+
+CMainchainRPCClient::CMainchainRPCClient(const std::string& strHostIn, int nPortIn,
+        const std::string& strUser, const std::string& strPass, size_t nMaxIdleIn, int64_t nTimeoutIn) :
+    strHost(strHostIn),
+    nPort(nPortIn),
+    strAuth(EncodeBase64(strUser + ":" + strPass)),
+    nMaxIdle(nMaxIdleIn),
+    nTimeout(nTimeoutIn)
 {
-    // Format user:pass for authentication
-    std::string auth = BITCOIN_RPC_USER + ":" + BITCOIN_RPC_PASS;
-    if (auth == ":")
+}
+
+CMainchainRPCClient::~CMainchainRPCClient()
+{
+    Disconnect();
+}
+
+void CMainchainRPCClient::Disconnect()
+{
+    LOCK(cs_pool);
+    vIdle.clear();
+}
+
+/**
+ * Run the asynchronous socket operation started by start() until it
+ * completes, or until nTimeout milliseconds have passed. On timeout the
+ * socket is closed, so the connection can't be used again.
+ */
+template <typename Start>
+static boost::system::error_code RunWithDeadline(boost::asio::io_context& io, tcp::socket& socket, int64_t nTimeout, Start start)
+{
+    boost::system::error_code error = boost::asio::error::would_block;
+    start([&error](const boost::system::error_code& ec, size_t nBytes) { error = ec; });
+
+    io.restart();
+    io.run_for(std::chrono::milliseconds(nTimeout));
+    if (error == boost::asio::error::would_block) {
+        // Closing the socket cancels the operation; let its handler run
+        // before the captured error code goes out of scope.
+        boost::system::error_code ignored;
+        socket.close(ignored);
+        io.restart();
+        io.run();
+        throw std::runtime_error(strprintf("no response within %dms", nTimeout));
+    }
+    return error;
+}
+
+template <typename Start>
+static size_t RunOrThrow(boost::asio::io_context& io, tcp::socket& socket, int64_t nTimeout, Start start)
+{
+    size_t nResult = 0;
+    boost::system::error_code error = RunWithDeadline(io, socket, nTimeout, [&](auto handler) {
+        start([&nResult, handler](const boost::system::error_code& ec, size_t nBytes) {
+            nResult = nBytes;
+            handler(ec, nBytes);
+        });
+    });
+    if (error)
+        throw boost::system::system_error(error);
+    return nResult;
+}
+
+std::unique_ptr<CMainchainRPCClient::Connection> CMainchainRPCClient::Connect()
+{
+    auto conn = std::make_unique<Connection>();
+    const tcp::endpoint endpoint(boost::asio::ip::make_address(strHost), nPort);
+    RunOrThrow(conn->io, conn->socket, nTimeout, [&](auto handler) {
+        conn->socket.async_connect(endpoint, [handler](const boost::system::error_code& ec) { handler(ec, 0); });
+    });
+    conn->socket.set_option(tcp::no_delay(true));
+    nConnects++;
+    return conn;
+}
+
+void CMainchainRPCClient::Release(std::unique_ptr<Connection> conn)
+{
+    LOCK(cs_pool);
+    if (vIdle.size() < nMaxIdle)
+        vIdle.push_back(std::move(conn));
+}
+
+static size_t ReadUntil(boost::asio::io_context& io, tcp::socket& socket, boost::asio::streambuf& buf, const char* delim, int64_t nTimeout)
+{
+    return RunOrThrow(io, socket, nTimeout, [&](auto handler) {
+        boost::asio::async_read_until(socket, buf, delim, handler);
+    });
+}
+
+static void ReadExactly(boost::asio::io_context& io, tcp::socket& socket, boost::asio::streambuf& buf, size_t nBytes, int64_t nTimeout)
+{
+    RunOrThrow(io, socket, nTimeout, [&](auto handler) {
+        boost::asio::async_read(socket, buf, boost::asio::transfer_exactly(nBytes), handler);
+    });
+}
+
+static void ReadChunkedBody(boost::asio::io_context& io, tcp::socket& socket, boost::asio::streambuf& buf, std::string& strBody, int64_t nTimeout)
+{
+    strBody.clear();
+    for (;;) {
+        // Chunk size line: hex size, optionally followed by extensions
+        size_t nLine = ReadUntil(io, socket, buf, "\r\n", nTimeout);
+        auto begin = boost::asio::buffers_begin(buf.data());
+        std::string strSize(begin, begin + nLine - 2);
+        buf.consume(nLine);
+
+        strSize = strSize.substr(0, strSize.find(';'));
+        boost::algorithm::trim(strSize);
+        if (strSize.empty() || strSize.size() > 8 ||
+                !std::all_of(strSize.begin(), strSize.end(), [](char c) { return HexDigit(c) >= 0; }))
+            throw std::runtime_error("invalid chunk size: " + strSize);
+        size_t nChunk = std::stoul(strSize, nullptr, 16);
+
+        if (nChunk == 0) {
+            // Skip any trailer fields up to the final empty line
+            for (;;) {
+                nLine = ReadUntil(io, socket, buf, "\r\n", nTimeout);
+                buf.consume(nLine);
+                if (nLine == 2)
+                    return;
+            }
+        }
+
+        // Chunk data is followed by CRLF
+        if (buf.size() < nChunk + 2)
+            ReadExactly(io, socket, buf, nChunk + 2 - buf.size(), nTimeout);
+        begin = boost::asio::buffers_begin(buf.data());
+        strBody.append(begin, begin + nChunk);
+        buf.consume(nChunk + 2);
+    }
+}
+
+int CMainchainRPCClient::Exchange(Connection& conn, const std::string& strRequest, const BodyHandler& handler, bool& fKeepAlive)
+{
+    // HTTP request (package the json for sending)
+    const std::string strHeader = strprintf(
+            "POST / HTTP/1.1\r\n"
+            "Host: %s\r\n"
+            "Content-Type: application/json\r\n"
+            "Authorization: Basic %s\r\n"
+            "Connection: keep-alive\r\n"
+            "Content-Length: %u\r\n\r\n",
+            strHost, strAuth, strRequest.size());
+
+    const std::array<boost::asio::const_buffer, 2> request = {{
+        boost::asio::buffer(strHeader), boost::asio::buffer(strRequest)
+    }};
+    RunOrThrow(conn.io, conn.socket, nTimeout, [&](auto handler) {
+        boost::asio::async_write(conn.socket, request, handler);
+    });
+
+    // Read the status line and headers. read_until may read past the end of
+    // the headers, anything extra stays in the buffer as the start of the body.
+    ReadUntil(conn.io, conn.socket, conn.buf, "\r\n\r\n", nTimeout);
+    std::istream is(&conn.buf);
+
+    std::string strLine;
+    std::string strVersion;
+    int nStatus = 0;
+    std::getline(is, strLine);
+    std::istringstream(strLine) >> strVersion >> nStatus;
+
+    // HTTP/1.1 connections are persistent unless the server says otherwise
+    fKeepAlive = (strVersion == "HTTP/1.1");
+    int64_t nContentLength = -1;
+    bool fChunked = false;
+    while (std::getline(is, strLine) && strLine != "\r") {
+        size_t nColon = strLine.find(':');
+        if (nColon == std::string::npos)
+            continue;
+
+        const std::string strName = boost::algorithm::trim_copy(strLine.substr(0, nColon));
+        const std::string strValue = boost::algorithm::trim_copy(strLine.substr(nColon + 1));
+        if (boost::algorithm::iequals(strName, "Content-Length")) {
+            if (!ParseInt64(strValue, &nContentLength) || nContentLength < 0)
+                throw std::runtime_error("invalid Content-Length: " + strValue);
+        } else if (boost::algorithm::iequals(strName, "Transfer-Encoding")) {
+            fChunked = boost::algorithm::iends_with(strValue, "chunked");
+        } else if (boost::algorithm::iequals(strName, "Connection")) {
+            fKeepAlive = !boost::algorithm::iequals(strValue, "close");
+        }
+    }
+
+    bool fHandled = true;
+    if (fChunked) {
+        ReadChunkedBody(conn.io, conn.socket, conn.buf, conn.strChunked, nTimeout);
+        if (nStatus == 200)
+            fHandled = handler(conn.strChunked.data(), conn.strChunked.size());
+    } else if (nContentLength >= 0) {
+        // The body is handed to the handler straight from the receive buffer
+        size_t nBody = nContentLength;
+        if (conn.buf.size() < nBody)
+            ReadExactly(conn.io, conn.socket, conn.buf, nBody - conn.buf.size(), nTimeout);
+        if (nStatus == 200)
+            fHandled = handler(static_cast<const char*>(conn.buf.data().data()), nBody);
+        conn.buf.consume(nBody);
+    } else {
+        // Without a Content-Length the body runs until the server closes the
+        // connection, so it can't be reused.
+        boost::system::error_code error = RunWithDeadline(conn.io, conn.socket, nTimeout, [&](auto handler) {
+            boost::asio::async_read(conn.socket, conn.buf, handler);
+        });
+        if (error != boost::asio::error::eof)
+            throw boost::system::system_error(error);
+
+        if (nStatus == 200)
+            fHandled = handler(static_cast<const char*>(conn.buf.data().data()), conn.buf.size());
+        conn.buf.consume(conn.buf.size());
+        fKeepAlive = false;
+    }
+
+    if (!fHandled)
+        throw std::runtime_error("invalid response body");
+
+    return nStatus;
+}
+
+bool CMainchainRPCClient::Request(const std::string& strRequest, const BodyHandler& handler)
+{
+    std::unique_ptr<Connection> conn;
+    {
+        LOCK(cs_pool);
+        if (!vIdle.empty()) {
+            conn = std::move(vIdle.back());
+            vIdle.pop_back();
+        }
+    }
+
+    // A pooled connection may have been closed by the server while it was
+    // idle. In that case retry once with a new connection.
+    bool fRetry = (conn != nullptr);
+    for (;;) {
+        bool fKeepAlive = false;
+        int nStatus = 0;
+        try {
+            if (!conn)
+                conn = Connect();
+
+            nStatus = Exchange(*conn, strRequest, handler, fKeepAlive);
+        } catch (const std::exception& e) {
+            conn.reset();
+            if (fRetry) {
+                fRetry = false;
+                continue;
+            }
+            if (fReachable.exchange(false))
+                LogPrintf("ERROR Sidechain client at %s:%d: %s, will keep retrying\n", strHost, nPort, e.what());
+            else
+                LogPrint("drivechain", "Sidechain client at %s:%d: %s\n", strHost, nPort, e.what());
+            return false;
+        }
+
+        if (!fReachable.exchange(true))
+            LogPrintf("Sidechain client at %s:%d: connected again\n", strHost, nPort);
+
+        if (fKeepAlive)
+            Release(std::move(conn));
+
+        if (nStatus != 200) {
+            LogPrintf("ERROR Sidechain client at %s:%d: HTTP status %d\n", strHost, nPort, nStatus);
+            return false;
+        }
+        return true;
+    }
+}
+
+bool CMainchainRPCClient::Post(const std::string& strRequest, std::string& strBody)
+{
+    return Request(strRequest, [&strBody](const char* pBody, size_t nBody) {
+        strBody.assign(pBody, nBody);
+        return true;
+    });
+}
+
+bool CMainchainRPCClient::Post(const std::string& strRequest, UniValue& reply)
+{
+    return Request(strRequest, [&reply](const char* pBody, size_t nBody) {
+        reply.clear();
+        return reply.read(pBody, nBody);
+    });
+}
+
+static Mutex cs_mainchainclient;
+static std::shared_ptr<CMainchainRPCClient> pmainchainclient GUARDED_BY(cs_mainchainclient);
+
+static std::shared_ptr<CMainchainRPCClient> GetMainchainRPCClient()
+{
+    LOCK(cs_mainchainclient);
+    if (!pmainchainclient) {
+        pmainchainclient = std::make_shared<CMainchainRPCClient>(DEFAULT_MAINCHAIN_RPC_HOST, DEFAULT_MAINCHAIN_RPC_PORT,
+                BITCOIN_RPC_USER, BITCOIN_RPC_PASS);
+    }
+    return pmainchainclient;
+}
+
+void SetMainchainRPCEndpoint(const std::string& strHost, int nPort)
+{
+    // Requests in flight finish on the old client, which is destroyed with
+    // the last reference to it
+    auto client = std::make_shared<CMainchainRPCClient>(strHost, nPort, BITCOIN_RPC_USER, BITCOIN_RPC_PASS);
+
+    LOCK(cs_mainchainclient);
+    pmainchainclient = client;
+}
+
+bool RPCBitcoinPatched(const std::string& json, UniValue& reply)
+{
+    return GetMainchainRPCClient()->Post(json, reply);
+}
+
+/** Return the result of a single JSON-RPC reply, or null if the call failed */
+static const UniValue& GetRPCResult(const UniValue& reply)
+{
+    const UniValue& error = find_value(reply, "error");
+    if (!error.isNull()) {
+        LogPrintf("ERROR Sidechain client received error: %s\n", error.write());
+        return NullUniValue;
+    }
+    return find_value(reply, "result");
+}
+
+bool DrivechainRPCGetBTCBlockCount(int& nBlocks)
+{
+    // JSON for 'getblockcount' bitcoin HTTP-RPC
+    std::string json;
+    json.append("{\"jsonrpc\": \"1.0\", \"id\":\"Drivechain\", ");
+    json.append("\"method\": \"getblockcount\", \"params\": ");
+    json.append("[] }");
+
+    // Try to request mainchain block count
+    UniValue reply;
+    if (!RPCBitcoinPatched(json, reply)) {
+        LogPrint("drivechain", "ERROR failed to request block count\n");
         return false;
+    }
 
-    try {
-        // Setup BOOST ASIO for a synchronus call to the mainchain
-        boost::asio::io_service io_service;
-        boost::asio::ip::tcp::socket socket(io_service);
-        boost::system::error_code error;
-        socket.connect(boost::asio::ip::tcp::endpoint(
-                    boost::asio::ip::address::from_string(BITCOIN_RPC_HOST), BITCOIN_RPC_PORT), error);
-
-        if (error) throw boost::system::system_error(error);
-
-        // HTTP request (package the json for sending)
-        boost::asio::streambuf output;
-        std::ostream os(&output);
-        os << "POST / HTTP/1.1\n";
-        os << "Host: 127.0.0.1\n";
-        os << "Content-Type: application/json\n";
-        os << "Authorization: Basic " << EncodeBase64(auth) << std::endl;
-        os << "Connection: close\n";
-        os << "Content-Length: " << json.size() << "\n\n";
-        os << json;
-
-        // Send the request
-        boost::asio::write(socket, output);
-
-        // Read the reponse
-        std::string data;
-        for (;;)
-        {
-            boost::array<char, 256> buf;
+    // Process result
+    const UniValue& result = GetRPCResult(reply);
+    if (!result.isNum())
+        return false;
+
+    nBlocks = result.get_int();
+
+    return nBlocks >= 0;
+}
+
+bool DrivechainRPCGetBTCBlockHash(const int& nHeight, uint256& hash)
+{
+    // JSON for 'getblockhash' mainchain HTTP-RPC
+    std::string json;
+    json.append("{\"jsonrpc\": \"1.0\", \"id\":\"Drivechain\", ");
+    json.append("\"method\": \"getblockhash\", \"params\": ");
+    json.append("[");
+    json.append(UniValue(nHeight).write());
+    json.append("] }");
+
+    // Try to request mainchain block hash
+    UniValue reply;
+    if (!RPCBitcoinPatched(json, reply)) {
+        LogPrintf("ERROR Sidechain client failed to request block hash!\n");
+        return false;
+    }
+
+    const UniValue& result = GetRPCResult(reply);
+    if (!result.isStr())
+        return false;
+
+    hash = uint256S(result.get_str());
+
+    return (!hash.IsNull());
+}
+
+bool DecodeBTCBlockHashBatch(const UniValue& reply, int nFirst, std::vector<uint256>& vHash)
+{
+    if (!reply.isArray() || reply.size() != vHash.size())
+        return false;
+
+    // Replies to a batch may come back in any order, match them up by id
+    for (const UniValue& item : reply.getValues()) {
+        const UniValue& id = find_value(item, "id");
+        if (!id.isNum())
+            return false;
+
+        int64_t nIndex = id.get_int64() - nFirst;
+        if (nIndex < 0 || nIndex >= (int64_t)vHash.size())
+            return false;
+
+        const UniValue& result = GetRPCResult(item);
+        if (!result.isStr())
+            return false;
+
+        uint256& hash = vHash[nIndex];
+        if (!hash.IsNull())
+            return false;
+
+        hash = uint256S(result.get_str());
+        if (hash.IsNull())
+            return false;
+    }
+
+    return true;
+}
+
+bool DrivechainRPCGetBTCBlockHashes(int nFirst, int nCount, std::vector<uint256>& vHash)
+{
+    vHash.clear();
+    if (nFirst < 0 || nCount < 0)
+        return false;
+
+    vHash.reserve(nCount);
+
+    const int nBatchSize = std::max(1u, nMainchainRPCBatchSize);
+    const int nEnd = nFirst + nCount;
+    std::string json;
+    UniValue reply;
+    std::vector<uint256> vBatch;
+    for (int nStart = nFirst; nStart < nEnd; nStart += nBatchSize) {
+        const int nStop = std::min(nEnd, nStart + nBatchSize);
+
+        // JSON-RPC batch of 'getblockhash' calls, using the height as the id
+        json.clear();
+        json.append("[");
+        for (int nHeight = nStart; nHeight < nStop; nHeight++) {
+            if (nHeight != nStart)
+                json.append(",");
+            json.append("{\"jsonrpc\": \"1.0\", \"id\":");
+            json.append(UniValue(nHeight).write());
+            json.append(", \"method\": \"getblockhash\", \"params\": [");
+            json.append(UniValue(nHeight).write());
+            json.append("] }");
+        }
+        json.append("]");
+
+        if (!RPCBitcoinPatched(json, reply)) {
+            LogPrintf("ERROR Sidechain client failed to request block hashes %d to %d!\n", nStart, nStop - 1);
+            return false;
+        }
+
+        vBatch.assign(nStop - nStart, uint256());
+        if (!DecodeBTCBlockHashBatch(reply, nStart, vBatch)) {
+            LogPrintf("ERROR Sidechain client received invalid block hashes %d to %d!\n", nStart, nStop - 1);
+            return false;
+        }
+        vHash.insert(vHash.end(), vBatch.begin(), vBatch.end());
+    }
+
+    return true;
+}
+
+bool DrivechainRPCVerifyBMM(const uint256& hashMainBlock, const uint256& hashHStar, uint256& txid, int nTime)
+{
+    // TODO We cannot use http rpc to ask enforcer to verify BMM,
+    // so this will return true until we have grpc support here or
+    // the enforcer adds http rpc support.
+    return true;
+}
+
+/**
+ * Verify BMM for each (mainchain block hash, h*) pair in vCommit, setting
+ * vValid[i] for each valid one. Returns false if the request failed.
+ */
+static bool DrivechainRPCVerifyBMMBatch(const std::vector<std::pair<uint256, uint256>>& vCommit, std::vector<bool>& vValid)
+{
+    // TODO Send all of the commitments to the enforcer in a single request
+    // once it can verify BMM for us, see DrivechainRPCVerifyBMM.
+    vValid.assign(vCommit.size(), false);
+    for (size_t i = 0; i < vCommit.size(); i++) {
+        uint256 txid;
+        vValid[i] = DrivechainRPCVerifyBMM(vCommit[i].first, vCommit[i].second, txid, 0);
+    }
+    return true;
+}
+
+static Mutex cs_bmmhandler;
+static std::function<bool(const uint256&, uint256&, int64_t)> bmmHandler GUARDED_BY(cs_bmmhandler);
+
+void SetBMMRequestHandler(std::function<bool(const uint256&, uint256&, int64_t)> handler)
+{
+    LOCK(cs_bmmhandler);
+    bmmHandler = handler;
+}
+
+bool HaveBMMRequestHandler()
+{
+    LOCK(cs_bmmhandler);
+    return (bool) bmmHandler;
+}
+
+bool DrivechainRequestBMM(const uint256& hashHStar, uint256& hashMainBlock, int64_t nTimeout)
+{
+    std::function<bool(const uint256&, uint256&, int64_t)> handler;
+    {
+        LOCK(cs_bmmhandler);
+        handler = bmmHandler;
+    }
+    if (!handler) {
+        // The enforcer only takes BMM requests over gRPC, which we can't send
+        LogPrintf("%s: ERROR: No BMM request handler installed, can't request BMM for h* %s!\n", __func__, hashHStar.ToString());
+        return false;
+    }
+
+    const int64_t nDeadline = GetTime() + nTimeout;
+    if (!handler(hashHStar, hashMainBlock, nTimeout))
+        return false;
+
+    // The handler is asked to give up by the deadline; a commitment it
+    // found later is stale, the caller has moved on to a new template
+    if (GetTime() > nDeadline) {
+        LogPrint("drivechain", "%s: BMM for h* %s took longer than %d seconds\n", __func__, hashHStar.ToString(), nTimeout);
+        return false;
+    }
+    return true;
+}
 
-            // Read until end of file (socket closed)
-            boost::system::error_code e;
-            size_t sz = socket.read_some(boost::asio::buffer(buf), e);
+static Mutex cs_depositsource;
+static std::function<bool(const uint256&, std::vector<DrivechainDeposit>&)> depositSource GUARDED_BY(cs_depositsource);
+
+void SetDrivechainDepositSource(std::function<bool(const uint256&, std::vector<DrivechainDeposit>&)> source)
+{
+    LOCK(cs_depositsource);
+    depositSource = source;
+}
+
+// Get the deposits made in mainchain block hashMainchainBlock
+static bool DrivechainRPCGetBlockDeposits(const uint256& hashMainchainBlock, std::vector<DrivechainDeposit>& vDeposit)
+{
+    {
+        LOCK(cs_depositsource);
+        if (depositSource)
+            return depositSource(hashMainchainBlock, vDeposit);
+    }
 
-            data.insert(data.size(), buf.data(), sz);
+    // TODO
+    // The enforcer doesn't give a list of sidechain deposits like the
+    // deprecated L1. Instead we will use GetTwoWayPegData or GetBlockInfo
+    // for every L1 block to collect valid deposits, which
+    // SyncDrivechainDeposits stores in the deposit database.
+    //
+    // TODO can we verify a specific deposit with the enforcer?
+    //
+    // TODO We cannot use http rpc to ask enforcer for deposits, so this
+    // will return true and no deposits until we have grpc support here or
+    // the enforcer adds http rpc support.
+
+    vDeposit.clear();
+
+    return true;
+}
+
+
+// On-disk caches:
+
+CHashRecordLog::CHashRecordLog(const fs::path& pathIn, uint32_t nMagicIn) :
+    path(pathIn), nMagic(nMagicIn)
+{
+}
+
+uint32_t CHashRecordLog::Checksum(const uint256& hash, size_t nPos) const
+{
+    // Keyed by position so that stale records left after a truncation, or
+    // records shifted by a torn write, are never accepted.
+    return SipHashUint256(nMagic, nPos, hash);
+}
+
+bool CHashRecordLog::Create()
+{
+    FILE* file = fsbridge::fopen(path, "wb");
+    if (!file)
+        return false;
+
+    unsigned char header[HEADER_SIZE];
+    WriteLE32(header, nMagic);
+    WriteLE32(header + 4, VERSION);
+
+    bool fWritten = fwrite(header, 1, sizeof(header), file) == sizeof(header);
+    if (fWritten)
+        FileCommit(file);
+    fclose(file);
+
+    nRecords = 0;
+    return fWritten;
+}
+
+bool CHashRecordLog::Parse(const unsigned char* pData, size_t nSize, std::vector<uint256>& vRecord) const
+{
+    if (nSize < HEADER_SIZE || ReadLE32(pData) != nMagic || ReadLE32(pData + 4) != VERSION)
+        return false;
+
+    const size_t nMax = (nSize - HEADER_SIZE) / RECORD_SIZE;
+    vRecord.reserve(nMax);
+    for (size_t i = 0; i < nMax; i++) {
+        const unsigned char* pRecord = pData + HEADER_SIZE + i * RECORD_SIZE;
+
+        uint256 hash;
+        memcpy(hash.begin(), pRecord, hash.size());
+        if (ReadLE32(pRecord + hash.size()) != Checksum(hash, i))
+            break;
+
+        vRecord.push_back(hash);
+    }
+
+    return true;
+}
+
+bool CHashRecordLog::Open(std::vector<uint256>& vRecord)
+{
+    vRecord.clear();
+    fOpen = false;
+
+    if (!fs::exists(path)) {
+        fOpen = Create();
+        return fOpen;
+    }
+
+    bool fValid = false;
+    size_t nSize = 0;
+#ifdef WIN32
+    FILE* file = fsbridge::fopen(path, "rb");
+    if (!file)
+        return false;
+
+    std::vector<unsigned char> vData;
+    unsigned char buf[65536];
+    size_t nRead;
+    while ((nRead = fread(buf, 1, sizeof(buf), file)) > 0)
+        vData.insert(vData.end(), buf, buf + nRead);
+    fclose(file);
+
+    nSize = vData.size();
+    fValid = Parse(vData.data(), nSize, vRecord);
+#else
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+
+    nSize = st.st_size;
+    if (nSize > 0) {
+        void* pData = mmap(nullptr, nSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (pData == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        madvise(pData, nSize, MADV_SEQUENTIAL);
+        fValid = Parse(static_cast<const unsigned char*>(pData), nSize, vRecord);
+        munmap(pData, nSize);
+    }
+    close(fd);
+#endif
+
+    if (!fValid) {
+        LogPrintf("%s: %s is not a valid cache file, starting a new one\n", __func__, path.filename().string());
+        vRecord.clear();
+        fOpen = Create();
+        return fOpen;
+    }
+
+    nRecords = vRecord.size();
+    fOpen = true;
+
+    // Cut off a torn or corrupt tail so that new records follow valid ones
+    const size_t nValidSize = HEADER_SIZE + nRecords * RECORD_SIZE;
+    if (nSize != nValidSize) {
+        LogPrintf("%s: Dropping %u bytes of invalid records from %s\n", __func__, nSize - nValidSize, path.filename().string());
+        return Truncate(nRecords);
+    }
+
+    return true;
+}
+
+bool CHashRecordLog::Append(const std::vector<uint256>& vRecord)
+{
+    if (!fOpen)
+        return false;
+
+    if (vRecord.empty())
+        return true;
+
+    std::vector<unsigned char> vData(vRecord.size() * RECORD_SIZE);
+    for (size_t i = 0; i < vRecord.size(); i++) {
+        unsigned char* pRecord = vData.data() + i * RECORD_SIZE;
+        memcpy(pRecord, vRecord[i].begin(), vRecord[i].size());
+        WriteLE32(pRecord + vRecord[i].size(), Checksum(vRecord[i], nRecords + i));
+    }
+
+    FILE* file = fsbridge::fopen(path, "ab");
+    if (!file)
+        return false;
+
+    bool fWritten = fwrite(vData.data(), 1, vData.size(), file) == vData.size();
+    if (fWritten)
+        FileCommit(file);
+    fclose(file);
+
+    if (!fWritten) {
+        // Don't leave part of a record behind for later appends to follow
+        Truncate(nRecords);
+        return false;
+    }
+
+    nRecords += vRecord.size();
+    return true;
+}
+
+bool CHashRecordLog::Truncate(size_t nRecordsIn)
+{
+    if (!fOpen || nRecordsIn > nRecords)
+        return false;
+
+    FILE* file = fsbridge::fopen(path, "r+b");
+    if (!file)
+        return false;
+
+    bool fTruncated = TruncateFile(file, HEADER_SIZE + nRecordsIn * RECORD_SIZE);
+    if (fTruncated)
+        FileCommit(file);
+    fclose(file);
+
+    if (fTruncated)
+        nRecords = nRecordsIn;
+
+    return fTruncated;
+}
+
+bool CHashRecordLog::Compact(size_t nKeep)
+{
+    if (!fOpen)
+        return false;
+
+    if (nRecords <= nKeep)
+        return true;
+
+    std::vector<uint256> vRecord;
+    CHashRecordLog logOld(path, nMagic);
+    if (!logOld.Open(vRecord))
+        return false;
+    vRecord.erase(vRecord.begin(), vRecord.end() - std::min(nKeep, vRecord.size()));
+
+    // Write the kept records to a new file and move it over this one
+    fs::path pathNew = path;
+    pathNew += ".new";
+    fs::remove(pathNew);
+
+    std::vector<uint256> vNone;
+    CHashRecordLog logNew(pathNew, nMagic);
+    if (!logNew.Open(vNone) || !logNew.Append(vRecord))
+        return false;
+
+    if (!RenameOver(pathNew, path))
+        return false;
+
+    nRecords = vRecord.size();
+    return true;
+}
+
+void FlushDrivechainCaches()
+{
+    WriteMainBlockCache();
+    WriteBMMCache();
+}
+
+
+// BMM validation & cache:
+
+void InitBMMCache(size_t nMaxCacheSize)
+{
+    size_t nElems = bmmCache.setup_bytes(nMaxCacheSize);
+    nBMMCacheElems = nElems;
+    LogPrintf("Using %zu MiB out of %zu requested for BMM cache, able to store %zu elements\n",
+            (nElems * sizeof(uint256)) >> 20, nMaxCacheSize >> 20, nElems);
+}
+
+bool ReadBMMCache()
+{
+    LOCK(cs_cachefiles);
+
+    pbmmlog.reset(new CHashRecordLog(GetDataDir() / "bmm.dat", BMM_CACHE_MAGIC));
+
+    std::vector<uint256> vHash;
+    if (!pbmmlog->Open(vHash)) {
+        LogPrintf("%s: Failed to open BMM cache!\n", __func__);
+        pbmmlog.reset();
+        return false;
+    }
+
+    // Only the most recent entries would survive in the cache anyway
+    const size_t nKeep = std::min(vHash.size(), (size_t)nBMMCacheElems);
+    for (auto it = vHash.end() - nKeep; it != vHash.end(); it++) {
+        uint256 entry;
+        bmmCache.ComputeEntry(entry, *it);
+        bmmCache.Set(entry);
+    }
+
+    LogPrintf("%s: Loaded %u verified BMM block hashes\n", __func__, nKeep);
+
+    if (vHash.size() > nKeep && !pbmmlog->Compact(nKeep))
+        LogPrintf("%s: Failed to compact BMM cache!\n", __func__);
+
+    return true;
+}
+
+bool WriteBMMCache()
+{
+    LOCK(cs_cachefiles);
+
+    if (!pbmmlog)
+        return false;
+
+    std::vector<uint256> vNew;
+    {
+        LOCK(cs_bmmunflushed);
+        vNew.assign(vBMMUnflushed.begin(), vBMMUnflushed.end());
+        vBMMUnflushed.clear();
+    }
+
+    if (vNew.empty())
+        return true;
+
+    if (!pbmmlog->Append(vNew)) {
+        LogPrintf("%s: Error writing BMM cache!\n", __func__);
+
+        LOCK(cs_bmmunflushed);
+        vBMMUnflushed.insert(vBMMUnflushed.begin(), vNew.begin(), vNew.end());
+        while (vBMMUnflushed.size() > std::max<size_t>(1, nBMMCacheElems))
+            vBMMUnflushed.pop_front();
+        return false;
+    }
+
+    LogPrintf("%s: Wrote %u verified BMM block hashes\n", __func__, vNew.size());
+
+    // Keep the file at most twice the size of the cache, so that rewriting
+    // it is rare and startup never reads more than two caches worth.
+    const size_t nKeep = nBMMCacheElems;
+    if (pbmmlog->Size() > 2 * nKeep && !pbmmlog->Compact(nKeep)) {
+        LogPrintf("%s: Failed to compact BMM cache!\n", __func__);
+        return false;
+    }
+
+    return true;
+}
+
+bool HaveVerifiedBMM(const uint256& hashBlock)
+{
+    if (hashBlock.IsNull())
+        return false;
+
+    uint256 entry;
+    bmmCache.ComputeEntry(entry, hashBlock);
+    return bmmCache.Get(entry);
+}
+
+void CacheVerifiedBMM(const uint256& hashBlock)
+{
+    if (hashBlock.IsNull())
+        return;
+
+    uint256 entry;
+    bmmCache.ComputeEntry(entry, hashBlock);
+    if (bmmCache.Get(entry))
+        return;
+
+    bmmCache.Set(entry);
+
+    LOCK(cs_bmmunflushed);
+    // If flushing keeps failing, only the entries that still fit in the
+    // cache are worth writing later
+    if (vBMMUnflushed.size() >= std::max<size_t>(1, nBMMCacheElems))
+        vBMMUnflushed.pop_front();
+    vBMMUnflushed.push_back(hashBlock);
+}
+
+bool VerifyBMM(const CBlockHeader& block)
+{
+    const uint256 hashBlock = block.GetHash();
+
+    // Skip genesis block
+    if (hashBlock == Params().GetConsensus().hashGenesisBlock)
+        return true;
+
+    // Have we already verified BMM for this block?
+    if (HaveVerifiedBMM(hashBlock))
+        return true;
+
+    // h*
+    const uint256 hashMerkleRoot = block.hashMerkleRoot;
+
+    // Mainchain block hash
+    const uint256 hashMainBlock = uint256(); // TODO block.hashMerkleRoot;
+
+    // Verify BMM with local mainchain node
+    uint256 txid;
+    uint32_t nTime;
+    if (!DrivechainRPCVerifyBMM(hashMainBlock, hashMerkleRoot, txid, nTime)) {
+        LogPrintf("%s: Did not find BMM h*: %s in mainchain block: %s!\n", __func__, hashMerkleRoot.ToString(), hashMainBlock.ToString());
+        return false;
+    }
+
+    // Cache that we have verified BMM for this block
+    CacheVerifiedBMM(hashBlock);
+
+    return true;
+}
+
+size_t VerifyBMMBatch(const std::vector<CBlockHeader>& vHeader, const Consensus::Params& params)
+{
+    // Collect the BMM commitments of the headers we haven't verified yet.
+    // Stop at the first header that is out of sequence or fails the proof of
+    // work check, so that a peer can't make us ask the enforcer about headers
+    // that AcceptBlockHeader would reject before looking at BMM anyway.
+    std::vector<uint256> vHash;
+    std::vector<std::pair<uint256, uint256>> vCommit;
+    uint256 hashPrev;
+    for (const CBlockHeader& header : vHeader) {
+        if (!hashPrev.IsNull() && header.hashPrevBlock != hashPrev)
+            break;
+
+        const uint256 hashBlock = header.GetHash();
+        if (!CheckProofOfWork(hashBlock, header.nBits, params))
+            break;
+        hashPrev = hashBlock;
+
+        if (hashBlock == params.hashGenesisBlock || HaveVerifiedBMM(hashBlock))
+            continue;
+
+        // TODO mainchain block hash, see VerifyBMM
+        vHash.push_back(hashBlock);
+        vCommit.emplace_back(uint256(), header.hashMerkleRoot);
+    }
+
+    if (vCommit.empty())
+        return 0;
+
+    std::vector<bool> vValid;
+    if (!DrivechainRPCVerifyBMMBatch(vCommit, vValid)) {
+        LogPrintf("%s: Failed to verify BMM for %u headers!\n", __func__, vCommit.size());
+        return 0;
+    }
+
+    // Invalid headers are left for VerifyBMM to reject, so that the peer is
+    // punished exactly as if the headers had been checked one at a time.
+    size_t nVerified = 0;
+    for (size_t i = 0; i < vHash.size(); i++) {
+        if (vValid[i]) {
+            CacheVerifiedBMM(vHash[i]);
+            nVerified++;
+        }
+    }
+
+    return nVerified;
+}
+
+
+// Deposit validation & DB
+
+CDepositDB* pdepositdb = nullptr;
+
+//! Number of mainchain blocks whose deposits are stored in one batch
+static const int DEPOSIT_SYNC_BLOCKS = 1000;
+
+// Serializes SyncDrivechainDeposits
+static Mutex cs_depositsync;
+
+// Serializes changes to the unpaid deposits in pdepositdb, so that a deposit
+// stored while a block paying it out is connected ends up paid
+static Mutex cs_depositdb;
+
+// Last sidechain block whose payouts were applied to pdepositdb
+static uint256 hashDepositTip GUARDED_BY(cs_depositdb);
+
+bool SyncDrivechainDeposits()
+{
+    LOCK(cs_depositsync);
+
+    if (!pdepositdb)
+        return false;
+
+    std::shared_ptr<const CMainBlockCacheSnapshot> pCache = GetMainBlockCacheSnapshot();
+
+    // Find the last stored mainchain block that is still in the cache. A
+    // block hash commits to all of its ancestors, so this only walks back
+    // over blocks disconnected by a mainchain reorg.
+    int nBest;
+    if (!pdepositdb->ReadBestMainBlock(nBest))
+        return false;
+
+    int nFork = std::min(nBest, pCache->Height());
+    uint256 hash;
+    while (nFork >= 0 && !(pdepositdb->ReadMainBlockHash(nFork, hash) && hash == pCache->Hashes()[nFork]))
+        nFork--;
+
+    if (nFork == nBest && nFork == pCache->Height())
+        return true;
+
+    // Store the deposits of the new blocks a batch at a time, so that a long
+    // catch up keeps what it has stored if the enforcer goes away
+    while (nFork < pCache->Height()) {
+        const int nCount = std::min(DEPOSIT_SYNC_BLOCKS, pCache->Height() - nFork);
+
+        std::vector<uint256> vHash;
+        std::vector<DrivechainDeposit> vDeposit;
+        for (int nHeight = nFork + 1; nHeight <= nFork + nCount; nHeight++) {
+            const uint256& hashBlock = pCache->Hashes()[nHeight];
+
+            std::vector<DrivechainDeposit> vBlockDeposit;
+            if (!DrivechainRPCGetBlockDeposits(hashBlock, vBlockDeposit)) {
+                LogPrintf("%s: Failed to request deposits of mainchain block %s from enforcer!\n", __func__, hashBlock.ToString());
+                return false;
+            }
+
+            for (DrivechainDeposit& deposit : vBlockDeposit) {
+                deposit.hashMainchainBlock = hashBlock;
+                deposit.nMainchainHeight = nHeight;
+                vDeposit.push_back(deposit);
+            }
+            vHash.push_back(hashBlock);
+        }
 
-            if (e == boost::asio::error::eof)
-                break; // socket closed
-            else if (e)
-                throw boost::system::system_error(e);
+        {
+            LOCK(cs_depositdb);
+            if (!pdepositdb->WriteMainBlocks(nFork, vHash, vDeposit)) {
+                LogPrintf("%s: Failed to write deposits to database!\n", __func__);
+                return false;
+            }
         }
 
-        std::stringstream ss;
-        ss << data;
+        nFork += nCount;
+    }
 
-        // Get response code
-        ss.ignore(std::numeric_limits<std::streamsize>::max(), ' ');
-        int code;
-        ss >> code;
+    return true;
+}
 
-        // Check response code
-        if (code != 200)
-            return false;
+// The miner uses this function to get the deposits that should be paid out
+// by the next block. Deposits are read from the deposit database, so there
+// is no enforcer request when creating a block.
+bool GetUnpaidDrivechainDeposits(std::vector<DrivechainDeposit>& vDeposit)
+{
+    vDeposit.clear();
 
-        // Skip the rest of the header
-        for (size_t i = 0; i < 5; i++)
-            ss.ignore(std::numeric_limits<std::streamsize>::max(), '\r');
+    if (!pdepositdb)
+        return false;
 
-        // Parse json response;
-        std::string JSON;
-        ss >> JSON;
-        std::stringstream jss;
-        jss << JSON;
-        boost::property_tree::json_parser::read_json(jss, ptree);
-    } catch (std::exception &exception) {
-        LogPrintf("ERROR Sidechain client at %s:%d (sendRequestToMainchain): %s\n", BITCOIN_RPC_HOST, BITCOIN_RPC_PORT, exception.what());
+    if (!pdepositdb->ReadUnpaidDeposits(vDeposit)) {
+        LogPrintf("%s: Failed to read unpaid deposits from database!\n", __func__);
         return false;
     }
+
     return true;
 }
 
-bool DrivechainRPCGetBTCBlockCount(int& nBlocks)
+static std::vector<DrivechainDepositKey> GetDepositPayoutKeys(const CTransaction& coinbase)
 {
-    // JSON for 'getblockcount' bitcoin HTTP-RPC
-    std::string json;
-    json.append("{\"jsonrpc\": \"1.0\", \"id\":\"Drivechain\", ");
-    json.append("\"method\": \"getblockcount\", \"params\": ");
-    json.append("[] }");
-
-    // Try to request mainchain block count
-    boost::property_tree::ptree ptree;
-    if (!RPCBitcoinPatched(json, ptree)) {
-        LogPrintf("ERROR failed to request block count\n");
-        return false;
+    std::vector<DrivechainDepositKey> vKey;
+    for (const CTxOut& out : coinbase.vout) {
+        DrivechainDepositKey key;
+        if (GetDepositPayoutKey(out.scriptPubKey, key))
+            vKey.push_back(key);
     }
-
-    // Process result
-    nBlocks = ptree.get("result", 0);
-
-    return nBlocks >= 0;
+    return vKey;
 }
 
-bool DrivechainRPCGetBTCBlockHash(const int& nHeight, uint256& hash)
+bool ConnectDrivechainDeposits(const CTransaction& coinbase, const uint256& hashBlock)
 {
-    // JSON for 'getblockhash' mainchain HTTP-RPC
-    std::string json;
-    json.append("{\"jsonrpc\": \"1.0\", \"id\":\"Drivechain\", ");
-    json.append("\"method\": \"getblockhash\", \"params\": ");
-    json.append("[");
-    json.append(UniValue(nHeight).write());
-    json.append("] }");
+    if (!pdepositdb)
+        return true;
 
-    // Try to request mainchain block hash
-    boost::property_tree::ptree ptree;
-    if (!RPCBitcoinPatched(json, ptree)) {
-        LogPrintf("ERROR Sidechain client failed to request block hash!\n");
-        return false;
-    }
+    std::vector<DrivechainDepositKey> vKey = GetDepositPayoutKeys(coinbase);
 
-    std::string strHash = ptree.get("result", "");
-    hash = uint256S(strHash);
+    LOCK(cs_depositdb);
+    if (!pdepositdb->WritePaid(vKey, hashBlock))
+        return false;
 
-    return (!hash.IsNull());
+    hashDepositTip = hashBlock;
+    return true;
 }
 
-bool DrivechainRPCVerifyBMM(const uint256& hashMainBlock, const uint256& hashHStar, uint256& txid, int nTime)
+bool DisconnectDrivechainDeposits(const CTransaction& coinbase, const uint256& hashPrevBlock)
 {
-    // TODO We cannot use http rpc to ask enforcer to verify BMM,
-    // so this will return true until we have grpc support here or
-    // the enforcer adds http rpc support.
+    if (!pdepositdb)
+        return true;
+
+    std::vector<DrivechainDepositKey> vKey = GetDepositPayoutKeys(coinbase);
+
+    LOCK(cs_depositdb);
+    if (!pdepositdb->ErasePaid(vKey, hashPrevBlock))
+        return false;
+
+    hashDepositTip = hashPrevBlock;
     return true;
 }
 
-bool DrivechainRPCGetDeposits(std::vector<DrivechainDeposit>& vDeposit)
+void SetDrivechainDepositTip(const uint256& hashBlock)
 {
-    // TODO
-    // The enforcer doesn't give a list of sidechain deposits like the
-    // deprecated L1. Instead we will use GetTwoWayPegData or GetBlockInfo
-    // for every L1 block to collect valid deposits and store them.
-    //
-    // Then we will need a function that the miner can use to include 
-    // any unpaid deposits when creating new blocks
-    //
-    // TODO how are they ordered? 
-    //
-    // TODO can we verify a specific deposit with the enforcer?
-    //
-    // TODO 
-    //
-    // TODO We cannot use http rpc to ask enforcer for a list of deposits,
-    // so this will return true and a vector of test deposits  until we 
-    // have grpc support here or the enforcer adds http rpc support.
-    
-
-    // Vector of test deposits
-
-    DrivechainDeposit d1;
-    d1.strDest = "1Test";
-    d1.amount = CAmount(1 * COIN);
-    d1.mtx = CMutableTransaction();
-    d1.nBurnIndex = 1;
-    d1.nTx = 1;
-    d1.hashMainchainBlock = uint256();
-
-    DrivechainDeposit d2;
-    d2.strDest = "2Test";
-    d2.amount = CAmount(1 * COIN);
-    d2.mtx = CMutableTransaction();
-    d2.nBurnIndex = 1;
-    d2.nTx = 1;
-    d2.hashMainchainBlock = uint256();
-
-    vDeposit = {d1, d2};
-    
-    return true;
+    LOCK(cs_depositdb);
+    hashDepositTip = hashBlock;
 }
 
+static std::shared_ptr<const CDepositPayoutSnapshot> pDepositPayouts;
 
-// BMM validation & cache:
-
-bool ReadBMMCache()
+bool RefreshDepositPayouts()
 {
-    fs::path path = GetDataDir() / "bmm.dat";
-    CAutoFile filein(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
-        return false;
-    }
-
-    try {
-        int nVersionRequired, nVersionThatWrote;
-        filein >> nVersionRequired;
-        filein >> nVersionThatWrote;
-        if (nVersionRequired > CLIENT_VERSION) {
+    auto pSnapshot = std::make_shared<CDepositPayoutSnapshot>();
+    {
+        LOCK(cs_depositdb);
+        if (!GetUnpaidDrivechainDeposits(pSnapshot->vDeposit))
             return false;
-        }
-
-        int nBMM = 0;
-        filein >> nBMM;
-        for (int i = 0; i < nBMM; i++) {
-            uint256 hash;
-            filein >> hash;
-            CacheVerifiedBMM(hash);
-        }
-    }
-    catch (const std::exception& e) {
-        LogPrintf("%s: Error reading BMM cache: %s", __func__, e.what());
-        return false;
+        pSnapshot->hashBlock = hashDepositTip;
     }
+    pSnapshot->nTime = GetTime();
 
+    std::atomic_store(&pDepositPayouts, std::shared_ptr<const CDepositPayoutSnapshot>(pSnapshot));
     return true;
 }
 
-bool WriteBMMCache()
+std::shared_ptr<const CDepositPayoutSnapshot> GetDepositPayoutSnapshot()
 {
-    int nBMM = setBMMVerified.size();
-
-    fs::path path = GetDataDir() / "bmm.dat.new";
-    CAutoFile fileout(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull()) {
-        return;
-    }
+    return std::atomic_load(&pDepositPayouts);
+}
 
-    try {
-        fileout << 160000; // version required to read: 0.16.00 or later
-        fileout << CLIENT_VERSION; // version that wrote the file
+std::shared_ptr<const CDepositPayoutSnapshot> GetDepositPayouts(const uint256& hashBlock)
+{
+    std::shared_ptr<const CDepositPayoutSnapshot> pSnapshot = GetDepositPayoutSnapshot();
+    if (pSnapshot && pSnapshot->hashBlock == hashBlock)
+        return pSnapshot;
+
+    // The refresh for the new tip hasn't run yet
+    if (!RefreshDepositPayouts())
+        LogPrintf("%s: Failed to refresh deposit payouts!\n", __func__);
+
+    pSnapshot = GetDepositPayoutSnapshot();
+    if (!pSnapshot)
+        pSnapshot = std::make_shared<const CDepositPayoutSnapshot>();
+    return pSnapshot;
+}
 
-        // Verified BMM hash cache
-        fileout << nBMM; // Number of Withdrawal Bundle hashes in file
-        for (const uint256& u : setBMMVerified) {
-            fileout << u;
-        }
-    }
-    catch (const std::exception& e) {
-        LogPrintf("%s: Error writing BMM cache: %s", __func__, e.what());
-        return false;
+std::vector<DrivechainDeposit> GetExpectedDepositPayouts(const std::vector<DrivechainDeposit>& vUnpaid,
+        const std::vector<DrivechainDeposit>& vNextPayout)
+{
+    std::set<DrivechainDepositKey> setNextPayout;
+    for (const DrivechainDeposit& deposit : vNextPayout)
+        setNextPayout.insert(DrivechainDepositKey(deposit));
+
+    std::vector<DrivechainDeposit> vExpected;
+    for (const DrivechainDeposit& deposit : vUnpaid) {
+        if (!setNextPayout.count(DrivechainDepositKey(deposit)))
+            vExpected.push_back(deposit);
     }
-
-    FileCommit(fileout.Get());
-    fileout.fclose();
-    RenameOver(GetDataDir() / "bmm.dat.new", GetDataDir() / "bmm.dat");
-
-    LogPrintf("%s: Wrote BMM cache.\n", __func__);
-
-    return true;
+    return vExpected;
 }
 
-bool HaveVerifiedBMM(const uint256& hashBlock)
+bool SameDepositPayouts(const std::vector<DrivechainDeposit>& a, const std::vector<DrivechainDeposit>& b)
 {
-    if (hashBlock.IsNull())
+    if (a.size() != b.size())
         return false;
 
-    return (setBMMVerified.count(hashBlock));
+    for (size_t i = 0; i < a.size(); i++) {
+        if (!(DrivechainDepositKey(a[i]) == DrivechainDepositKey(b[i])) || a[i].amount != b[i].amount)
+            return false;
+    }
+    return true;
 }
 
-void CacheVerifiedBMM(const uint256& hashBlock)
+// Set while a refresh of the deposit payout snapshot is queued
+static std::atomic<bool> fDepositRefreshQueued{false};
+
+static void ScheduleDepositPayoutRefresh(CScheduler& scheduler)
 {
-    if (hashBlock.IsNull())
+    if (fDepositRefreshQueued.exchange(true))
         return;
 
-    setBMMVerified.insert(hashBlock);
+    scheduler.schedule([] {
+        // Tip changes from now on need another refresh
+        fDepositRefreshQueued = false;
+        RefreshDepositPayouts();
+    }, boost::chrono::system_clock::now());
 }
 
-bool VerifyBMM(const CBlock& block)
+namespace {
+
+class CDepositPayoutRefresher : public CValidationInterface
 {
-    // Skip genesis block
-    if (block.GetHash() == Params().GetConsensus().hashGenesisBlock)
-        return true;
+public:
+    explicit CDepositPayoutRefresher(CScheduler& schedulerIn) : scheduler(schedulerIn) {}
 
-    // Have we already verified BMM for this block?
-    if (HaveVerifiedBMM(block.GetHash()))
-        return true;
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindex) override
+    {
+        ScheduleDepositPayoutRefresh(scheduler);
+    }
 
-    // h*
-    const uint256 hashMerkleRoot = block.hashMerkleRoot;
+    void UpdatedMainchainTip(const uint256& hashTip, int nHeight, const std::vector<uint256>& vDisconnected) override
+    {
+        ScheduleDepositPayoutRefresh(scheduler);
+    }
 
-    // Mainchain block hash
-    const uint256 hashMainBlock = uint256(); // TODO block.hashMerkleRoot;
+private:
+    CScheduler& scheduler;
+};
 
-    // Verify BMM with local mainchain node
-    uint256 txid;
-    uint32_t nTime;
-    if (!DrivechainRPCVerifyBMM(hashMainBlock, hashMerkleRoot, txid, nTime)) {
-        LogPrintf("%s: Did not find BMM h*: %s in mainchain block: %s!\n", __func__, hashMerkleRoot.ToString(), hashMainBlock.ToString());
-        return false;
-    }
+} // namespace
 
-    // Cache that we have verified BMM for this block
-    CacheVerifiedBMM(block.GetHash());
+static std::unique_ptr<CDepositPayoutRefresher> pDepositPayoutRefresher;
 
-    return true;
+void RegisterDepositPayoutRefresher(CScheduler& scheduler)
+{
+    pDepositPayoutRefresher.reset(new CDepositPayoutRefresher(scheduler));
+    RegisterValidationInterface(pDepositPayoutRefresher.get());
+    ScheduleDepositPayoutRefresh(scheduler);
 }
 
+void UnregisterDepositPayoutRefresher()
+{
+    if (!pDepositPayoutRefresher)
+        return;
 
-// Deposit validation & DB
+    UnregisterValidationInterface(pDepositPayoutRefresher.get());
+    pDepositPayoutRefresher.reset();
+}
 
-// The miner will use this function to ask for a list of new deposits
-// that should be added to the next block. It should return a list of
-// valid deposits that haven't been paid out yet.
-bool GetUnpaidDrivechainDeposits(std::vector<DrivechainDeposit>& vDeposit) 
+CScript GetDepositPayoutScript(const DrivechainDeposit& deposit)
 {
-    std::vector<DrivechainDeposit> vDepositNew;
-    if (!DrivechainRPCGetDeposits(vDepositNew)) {
-        LogPrintf("%s: Failed to request deposits from enforcer!\n", __func__);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << DrivechainDepositKey(deposit);
+
+    CScript script;
+    script.resize(1);
+    script[0] = 0xDC;
+    script << std::vector<unsigned char>(ss.begin(), ss.end());
+    return script;
+}
+
+bool GetDepositPayoutKey(const CScript& script, DrivechainDepositKey& key)
+{
+    if (!IsDrivechainDepositScript(script))
         return false;
-    }
 
-    // TODO filter / sort deposits ?
-    vDeposit = vDepositNew; 
+    CScript::const_iterator pc = script.begin() + 1;
+    opcodetype opcode;
+    std::vector<unsigned char> vch;
+    if (!script.GetOp(pc, opcode, vch) || pc != script.end())
+        return false;
+
+    if (vch.size() != ::GetSerializeSize(key, SER_DISK, CLIENT_VERSION))
+        return false;
 
+    CDataStream ss(vch, SER_DISK, CLIENT_VERSION);
+    ss >> key;
     return true;
 }
 
@@ -495,96 +1536,266 @@ bool VerifyDrivechainDeposit(const CTxOut& out)
 
 bool ReadMainBlockCache()
 {
-    fs::path path = GetDataDir() / "mainblockhash.dat";
-    CAutoFile filein(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
+    LOCK(cs_cachefiles);
+
+    pmainblocklog.reset(new CHashRecordLog(GetDataDir() / "mainblockhash.dat", MAINBLOCK_CACHE_MAGIC));
+
+    std::vector<uint256> vHash;
+    if (!pmainblocklog->Open(vHash)) {
+        LogPrintf("%s: Failed to open main block cache!\n", __func__);
+        pmainblocklog.reset();
         return false;
     }
 
-    std::vector<uint256> vHash;
-    try {
-        int nVersionRequired, nVersionThatWrote;
-        filein >> nVersionRequired;
-        filein >> nVersionThatWrote;
-        if (nVersionRequired > CLIENT_VERSION) {
-            return false;
-        }
+    // Replace the cache with the file as a single new snapshot. This runs
+    // before the mainchain follower thread starts, so nothing else publishes
+    // in between and the snapshot loaded below is the one we just published.
+    std::vector<uint256> vDisconnected;
+    std::shared_ptr<const CMainBlockCacheSnapshot> pBase;
+    do {
+        pBase = GetMainBlockCacheSnapshot();
+    } while (!PublishMainBlockCache(pBase, -1, vHash, vDisconnected));
+
+    pFlushedMainBlockCache = GetMainBlockCacheSnapshot();
+    LogPrintf("%s: Loaded %d mainchain block hashes (%u bytes)\n", __func__,
+            pFlushedMainBlockCache->Hashes().size(), pFlushedMainBlockCache->index.DynamicMemoryUsage());
+
+    return true;
+}
+
+bool WriteMainBlockCache()
+{
+    LOCK(cs_cachefiles);
+
+    if (!pmainblocklog)
+        return false;
 
-        int count = 0;
-        filein >> count;
-        for (int i = 0; i < count; i++) {
-            uint256 hash;
-            filein >> hash;
-            vHash.push_back(hash);
+    std::shared_ptr<const CMainBlockCacheSnapshot> pCache = GetMainBlockCacheSnapshot();
+    if (pCache == pFlushedMainBlockCache)
+        return true;
+
+    const std::vector<uint256>& vHash = pCache->Hashes();
+    const std::vector<uint256>& vFlushed = pFlushedMainBlockCache->Hashes();
+
+    // Find the last block that is both in the file and in the cache. A block
+    // hash commits to all of its ancestors, so this only walks back over
+    // blocks disconnected by a mainchain reorg.
+    int nFork = std::min(pCache->Height(), (int)pmainblocklog->Size() - 1);
+    while (nFork >= 0 && vHash[nFork] != vFlushed[nFork])
+        nFork--;
+
+    if (nFork + 1 < (int)pmainblocklog->Size()) {
+        if (!pmainblocklog->Truncate(nFork + 1)) {
+            LogPrintf("%s: Error truncating main block cache!\n", __func__);
+            return false;
         }
+        LogPrintf("%s: Removed mainchain block hashes after height %d\n", __func__, nFork);
     }
-    catch (const std::exception& e) {
-        LogPrintf("%s: Error reading main block cache: %s", __func__, e.what());
+
+    std::vector<uint256> vNew(vHash.begin() + nFork + 1, vHash.end());
+    if (!pmainblocklog->Append(vNew)) {
+        LogPrintf("%s: Error writing main block cache!\n", __func__);
         return false;
     }
 
-    for (const uint256& u : vHash)
-        CacheMainBlockHash(u);
+    pFlushedMainBlockCache = pCache;
+
+    if (!vNew.empty())
+        LogPrintf("%s: Wrote %u\n", __func__, vNew.size());
 
     return true;
 }
 
-bool WriteMainBlockCache()
+CMainBlockHashIndex::CMainBlockHashIndex() :
+    k0(GetRand(std::numeric_limits<uint64_t>::max())),
+    k1(GetRand(std::numeric_limits<uint64_t>::max()))
 {
-    if (vMainBlockHash.empty())
-        return false;
+}
 
-    int count = vMainBlockHash.size();
+uint64_t CMainBlockHashIndex::Key(const uint256& hash) const
+{
+    return SipHashUint256(k0, k1, hash);
+}
 
-    fs::path path = GetDataDir() / "mainblockhash.dat.new";
-    CAutoFile fileout(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull()) {
-        return false;
+int CMainBlockHashIndex::Find(const uint256& hash) const
+{
+    if (vSlot.empty())
+        return -1;
+
+    const size_t nMask = vSlot.size() - 1;
+    const uint64_t nKey = Key(hash);
+    for (size_t i = nKey & nMask; vSlot[i].nHeight != EMPTY; i = (i + 1) & nMask) {
+        if (vSlot[i].nKey == nKey && vHash[vSlot[i].nHeight] == hash)
+            return vSlot[i].nHeight;
     }
+    return -1;
+}
 
-    try {
-        fileout << 160000; // version required to read: 0.16.00 or later
-        fileout << CLIENT_VERSION; // version that wrote the file
-        fileout << count; // Number of Withdrawal Bundle hashes in file
+size_t CMainBlockHashIndex::FindSlot(uint32_t nHeight) const
+{
+    const size_t nMask = vSlot.size() - 1;
+    size_t i = Key(vHash[nHeight]) & nMask;
+    while (vSlot[i].nHeight != nHeight) {
+        assert(vSlot[i].nHeight != EMPTY);
+        i = (i + 1) & nMask;
+    }
+    return i;
+}
+
+void CMainBlockHashIndex::Insert(uint64_t nKey, uint32_t nHeight)
+{
+    const size_t nMask = vSlot.size() - 1;
+    size_t i = nKey & nMask;
+    while (vSlot[i].nHeight != EMPTY)
+        i = (i + 1) & nMask;
+
+    vSlot[i].nKey = nKey;
+    vSlot[i].nHeight = nHeight;
+}
+
+void CMainBlockHashIndex::Rehash(size_t nSlots)
+{
+    std::vector<Slot> vOld;
+    vOld.swap(vSlot);
+    vSlot.assign(nSlots, Slot{0, EMPTY});
+
+    for (const Slot& slot : vOld) {
+        if (slot.nHeight != EMPTY)
+            Insert(slot.nKey, slot.nHeight);
+    }
+}
+
+void CMainBlockHashIndex::Append(const uint256& hash)
+{
+    assert(vHash.size() < EMPTY);
+
+    // Keep the table at most half full
+    if ((vHash.size() + 1) * 2 > vSlot.size())
+        Rehash(std::max<size_t>(16, vSlot.size() * 2));
+
+    vHash.push_back(hash);
+    Insert(Key(hash), vHash.size() - 1);
+}
 
-        for (const uint256& u : vMainBlockHash) {
-            fileout << u;
+void CMainBlockHashIndex::PopBack()
+{
+    assert(!vHash.empty());
+
+    // Remove the slot and shift later slots of the probe sequence back into
+    // the hole, so that lookups never stop early at an empty slot.
+    const size_t nMask = vSlot.size() - 1;
+    size_t nHole = FindSlot(vHash.size() - 1);
+    for (size_t i = (nHole + 1) & nMask; vSlot[i].nHeight != EMPTY; i = (i + 1) & nMask) {
+        const size_t nHome = vSlot[i].nKey & nMask;
+        // Move the slot unless its home lies cyclically in (nHole, i]
+        if (((i - nHome) & nMask) >= ((i - nHole) & nMask)) {
+            vSlot[nHole] = vSlot[i];
+            nHole = i;
         }
     }
-    catch (const std::exception& e) {
-        LogPrintf("%s: Error writing main block cache: %s", __func__, e.what());
+    vSlot[nHole].nHeight = EMPTY;
+
+    vHash.pop_back();
+}
+
+void CMainBlockHashIndex::Reserve(size_t nBlocks)
+{
+    vHash.reserve(nBlocks);
+
+    size_t nSlots = std::max<size_t>(16, vSlot.size());
+    while (nBlocks * 2 > nSlots)
+        nSlots *= 2;
+
+    if (nSlots != vSlot.size())
+        Rehash(nSlots);
+}
+
+size_t CMainBlockHashIndex::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(vHash) + memusage::DynamicUsage(vSlot);
+}
+
+bool CMainBlockCacheSnapshot::GetHeight(const uint256& hash, int& nHeight) const
+{
+    int nFound = index.Find(hash);
+    if (nFound < 0)
         return false;
-    }
 
-    FileCommit(fileout.Get());
-    fileout.fclose();
-    RenameOver(GetDataDir() / "mainblockhash.dat.new", GetDataDir() / "mainblockhash.dat");
+    nHeight = nFound;
+    return true;
+}
 
-    LogPrintf("%s: Wrote %u\n", __func__, count);
+bool CMainBlockCacheSnapshot::GetHash(int nHeight, uint256& hash) const
+{
+    if (nHeight < 0 || nHeight > Height())
+        return false;
 
+    hash = Hashes()[nHeight];
     return true;
 }
 
-void CacheMainBlockHash(const uint256& hash)
+std::shared_ptr<const CMainBlockCacheSnapshot> GetMainBlockCacheSnapshot()
 {
-    // Don't re-cache the genesis block
-    if (vMainBlockHash.size() == 1 && hash == vMainBlockHash.front())
-        return;
+    return std::atomic_load(&pMainBlockCache);
+}
+
+bool PublishMainBlockCache(const std::shared_ptr<const CMainBlockCacheSnapshot>& pBase, int nFork,
+        const std::vector<uint256>& vAppend, std::vector<uint256>& vDisconnected)
+{
+    LOCK(cs_mainblockcache);
+
+    if (std::atomic_load(&pMainBlockCache) != pBase)
+        return false;
+
+    if (nFork < -1 || nFork > pBase->Height())
+        return false;
+
+    auto pNew = std::make_shared<CMainBlockCacheSnapshot>(*pBase);
+    pNew->nVersion++;
+
+    // Remove the blocks after the fork point
+    for (int i = pNew->Height(); i > nFork; i--) {
+        vDisconnected.push_back(pNew->Hashes()[i]);
+        pNew->index.PopBack();
+    }
+
+    // Add and index the new blocks
+    pNew->index.Reserve(nFork + 1 + vAppend.size());
+    for (const uint256& hash : vAppend)
+        pNew->index.Append(hash);
 
-    // Add to ordered vector of main block hashes
-    vMainBlockHash.push_back(hash);
+    std::atomic_store(&pMainBlockCache, std::shared_ptr<const CMainBlockCacheSnapshot>(std::move(pNew)));
 
-    // Add to index of hashes
-    MainBlockCacheIndex index;
-    index.hash = hash;
-    index.index = vMainBlockHash.size() - 1;
+    return true;
+}
+
+void CacheMainBlockHash(const uint256& hash)
+{
+    std::vector<uint256> vDisconnected;
+    std::shared_ptr<const CMainBlockCacheSnapshot> pBase;
+    do {
+        pBase = GetMainBlockCacheSnapshot();
 
-    mapMainBlock[hash] = index;
+        // Don't re-cache the genesis block
+        if (pBase->Hashes().size() == 1 && hash == pBase->Hashes().front())
+            return;
+    } while (!PublishMainBlockCache(pBase, pBase->Height(), {hash}, vDisconnected));
 }
 
 bool HaveMainBlock(const uint256& hash)
 {
-    return mapMainBlock.count(hash);
+    return GetMainBlockCacheSnapshot()->Contains(hash);
+}
+
+bool GetMainchainTip(uint256& hashTip, int& nHeight)
+{
+    std::shared_ptr<const CMainBlockCacheSnapshot> pCache = GetMainBlockCacheSnapshot();
+    if (pCache->Hashes().empty())
+        return false;
+
+    hashTip = pCache->Hashes().back();
+    nHeight = pCache->Height();
+    return true;
 }
 
 bool UpdateMainBlockHashCache(bool& fReorg, std::vector<uint256>& vDisconnected)
@@ -597,124 +1808,98 @@ bool UpdateMainBlockHashCache(bool& fReorg, std::vector<uint256>& vDisconnected)
     // Note: bitcoin core does not count genesis block towards block count but
     // we will cache it.
     //
+    // All mainchain requests are made against the snapshot loaded here, and
+    // the result is published as a new snapshot at the end. If another
+    // snapshot was published in the meantime the update fails and should be
+    // retried.
+    //
 
     // Get the current mainchain block height
     int nMainBlocks = 0;
-    if (DrivechainRPCGetBTCBlockCount(nMainBlocks)) {
-        LogPrintf("%s: Failed to update - cannot get block count from mainchain. (connection issue?)\n", __func__);
-        return false;
-    }
-
-    uint256 hashMainTip;
-    if (DrivechainRPCGetBTCBlockHash(nMainBlocks, hashMainTip)) {
-        LogPrintf("%s: Failed to get to mainchain tip block hash!\n", __func__);
+    if (!DrivechainRPCGetBTCBlockCount(nMainBlocks)) {
+        LogPrint("drivechain", "%s: Failed to update - cannot get block count from mainchain. (connection issue?)\n", __func__);
         return false;
     }
 
-    // If the block height hasn't changed, check that if cached chain tip is the
-    // same as the current mainchain tip. If it is we don't need to do anything
-    // else. If it isn't we will continue to update / reorg handling.
-    int nCachedBlocks = vMainBlockHash.size();
-    if (nMainBlocks + 1 == nCachedBlocks && vMainBlockHash.size() && vMainBlockHash.back() == hashMainTip) {
-        return true;
-    }
-
-    // Otherwise;
-    // From the new mainchain tip, start looping back through mainchain blocks
-    // while keeping track of them in order until we find one that connects to
-    // one of our cached blocks by prevblock.
-    uint256 hashPrevBlock;
-    std::deque<uint256> deqHashNew;
-    for (int i = nMainBlocks; i > 0; i--) {
-        // Get the prevblockhash
-        if (!DrivechainRPCGetBTCBlockHash(i - 1, hashPrevBlock)) {
-            LogPrintf("%s: Failed to get to mainchain block: %u\n", __func__, i - 1);
+    std::shared_ptr<const CMainBlockCacheSnapshot> pBase = GetMainBlockCacheSnapshot();
+    const std::vector<uint256>& vCached = pBase->Hashes();
+    const int nCachedBlocks = vCached.size();
+
+    // Find the highest cached block that is still in the mainchain, walking
+    // back from the lower of the two tips. Usually the first block checked
+    // matches, so start with a single height and double the range on every
+    // miss up to the batch size.
+    int nFork = std::min(nCachedBlocks - 1, nMainBlocks);
+    int nWindow = 1;
+    const int nBatchSize = std::max(1u, nMainchainRPCBatchSize);
+    std::vector<uint256> vHash;
+    while (nFork >= 0) {
+        const int nStart = std::max(0, nFork - nWindow + 1);
+        if (!DrivechainRPCGetBTCBlockHashes(nStart, nFork - nStart + 1, vHash)) {
+            LogPrintf("%s: Failed to get mainchain block hashes %d to %d!\n", __func__, nStart, nFork);
             return false;
         }
 
-        // Check if the prevblock is in our cache. Once we find a prevblock in
-        // our cache we can update our cache from that block up to the new
-        // mainchain tip.
-        if (HaveMainBlock(hashPrevBlock)) {
-            deqHashNew.push_front(hashPrevBlock);
+        while (nFork >= nStart && vHash[nFork - nStart] != vCached[nFork])
+            nFork--;
+
+        if (nFork >= nStart)
             break;
-        }
 
-        deqHashNew.push_front(hashPrevBlock);
+        nWindow = std::min(nWindow * 2, nBatchSize);
     }
-    // Also add the new mainchain tip
-    deqHashNew.push_back(hashMainTip);
 
-    if (deqHashNew.empty()) {
-        LogPrintf("%s: Error - called with empty list of new block hashes!\n", __func__);
+    // If the cached chain tip is the same as the current mainchain tip we
+    // don't need to do anything else.
+    if (nFork == nMainBlocks && nCachedBlocks == nMainBlocks + 1)
+        return true;
+
+    // Fetch the new blocks from the fork point up to the mainchain tip
+    if (!DrivechainRPCGetBTCBlockHashes(nFork + 1, nMainBlocks - nFork, vHash)) {
+        LogPrintf("%s: Failed to get mainchain block hashes %d to %d!\n", __func__, nFork + 1, nMainBlocks);
         return false;
     }
 
-    // If the main block cache doesn't have the genesis block yet, add it first
-    if (vMainBlockHash.empty())
-        CacheMainBlockHash(deqHashNew.front());
-
-    // Figure out the block in our cache that we will append the new blocks to
-    MainBlockCacheIndex index;
-    if (mapMainBlock.count(deqHashNew.front())) {
-        index = mapMainBlock[deqHashNew.front()];
-    } else {
-        LogPrintf("%s: Error - New blocks do not connect to cached chain!\n", __func__);
+    // Replace any blocks in our cache after the fork point with the new
+    // blocks. The replaced blocks are added to vDisconnected.
+    std::vector<uint256> vRemoved;
+    if (!PublishMainBlockCache(pBase, nFork, vHash, vRemoved)) {
+        LogPrintf("%s: Error - main block cache changed during update!\n", __func__);
         return false;
     }
 
-    // If there were any blocks in our cache after the block we will be building
-    // on, remove them, add them to vOrphan as they were disconnected, set
-    // fReorg true.
-    if (index.index != vMainBlockHash.size() - 1) {
+    if (!vRemoved.empty()) {
         LogPrintf("%s: Mainchain reorg detected!\n", __func__);
         fReorg = true;
+        vDisconnected.insert(vDisconnected.end(), vRemoved.begin(), vRemoved.end());
     }
 
-    std::vector<uint256> vOrphan;
-
-    for (size_t i = vMainBlockHash.size() - 1; i > index.index; i--) {
-        vOrphan.push_back(vMainBlockHash[i]);
-        vMainBlockHash.pop_back();
-    }
-
-    // Remove disconnected blocks from index map
-    for (const uint256& u : vOrphan)
-        mapMainBlock.erase(u);
-
-    // Check if we already know the first block in the deque and remove it if
-    // we do.
-    if (HaveMainBlock(deqHashNew.front()))
-        deqHashNew.pop_front();
-
-    // Append new blocks
-    for (const uint256& u : deqHashNew)
-        CacheMainBlockHash(u);
-
-    LogPrintf("%s: Updated cached mainchain tip to: %s.\n", __func__, deqHashNew.back().ToString());
+    LogPrintf("%s: Updated cached mainchain tip to: %s.\n", __func__, vHash.empty() ? vCached[nFork].ToString() : vHash.back().ToString());
 
     return true;
 }
 
 bool VerifyMainBlockCache(std::string& strError)
 {
-    if (!vMainBlockHash.size()) {
+    std::shared_ptr<const CMainBlockCacheSnapshot> pCache = GetMainBlockCacheSnapshot();
+    const std::vector<uint256>& vCached = pCache->Hashes();
+
+    if (!vCached.size()) {
         strError = "No mainchain blocks in cache!";
         return false;
     }
 
     // Compare cached hash at height with mainchain block hash at height
-    for (size_t i = 0; i < vMainBlockHash.size(); i++) {
-        uint256 hashBlock;
-
-        if (!DrivechainRPCGetBTCBlockHash(i, hashBlock)) {
-            strError = "Failed to request mainchain block hash!";
-            return false;
-        }
+    std::vector<uint256> vHash;
+    if (!DrivechainRPCGetBTCBlockHashes(0, vCached.size(), vHash)) {
+        strError = "Failed to request mainchain block hashes!";
+        return false;
+    }
 
-        if (hashBlock != vMainBlockHash[i]) {
+    for (size_t i = 0; i < vCached.size(); i++) {
+        if (vHash[i] != vCached[i]) {
             strError = "Invalid hash cached: ";
-            strError += vMainBlockHash[i].ToString();
+            strError += vCached[i].ToString();
             strError += " height: ";
             strError += std::to_string(i);
 
@@ -725,6 +1910,34 @@ bool VerifyMainBlockCache(std::string& strError)
     return true;
 }
 
+void ThreadMainchainFollower()
+{
+    const int64_t nPollInterval = GetArg("-mainchainpollinterval", DEFAULT_MAINCHAIN_POLL_INTERVAL);
+
+    while (true) {
+        std::shared_ptr<const CMainBlockCacheSnapshot> pPrev = GetMainBlockCacheSnapshot();
+
+        bool fReorg = false;
+        std::vector<uint256> vDisconnected;
+        bool fUpdated = UpdateMainBlockHashCache(fReorg, vDisconnected);
+        // Mainchain requests can take up to their timeout, check for
+        // shutdown after each round of them
+        boost::this_thread::interruption_point();
+
+        // Store the deposits of new mainchain blocks before announcing them
+        SyncDrivechainDeposits();
+        boost::this_thread::interruption_point();
+
+        if (fUpdated) {
+            std::shared_ptr<const CMainBlockCacheSnapshot> pCache = GetMainBlockCacheSnapshot();
+            if (pCache != pPrev && !pCache->Hashes().empty())
+                GetMainSignals().UpdatedMainchainTip(pCache->Hashes().back(), pCache->Height(), vDisconnected);
+        }
+
+        MilliSleep(nPollInterval * 1000);
+    }
+}
+
 void HandleMainchainReorg(const std::vector<uint256>& vOrphan)
 {
     // TODO unused, waiting for enforcer to handle reorgs 
@@ -9,12 +9,44 @@
 #define L2L_DRIVECHAIN_H
 
 #include <amount.h>
+#include <fs.h>
 #include <primitives/transaction.h>
+#include <sync.h>
 #include <uint256.h>
 
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <memory>
 #include <string>
+#include <tuple>
+#include <vector>
 
 class CBlock;
+class CBlockHeader;
+class CScheduler;
+class UniValue;
+
+namespace Consensus { struct Params; }
+
+//! Address of the mainchain node's JSON-RPC server
+static const char* const DEFAULT_MAINCHAIN_RPC_HOST = "127.0.0.1";
+static const int DEFAULT_MAINCHAIN_RPC_PORT = 38332;
+//! Number of idle keep-alive connections kept open to the mainchain node
+static const size_t DEFAULT_MAINCHAIN_RPC_POOL_SIZE = 4;
+//! Milliseconds a mainchain connect, read or write may take before the
+//! connection is closed and the request fails
+static const int64_t DEFAULT_MAINCHAIN_RPC_TIMEOUT = 30000;
+//! Number of calls sent to the mainchain node in one JSON-RPC batch
+static const unsigned int DEFAULT_MAINCHAIN_RPC_BATCH_SIZE = 1000;
+//! Seconds between polls of the mainchain tip by the follower thread
+static const int64_t DEFAULT_MAINCHAIN_POLL_INTERVAL = 5;
+//! Default size of the BMM verification cache in MiB
+static const unsigned int DEFAULT_BMM_CACHE_SIZE = 1;
+//! Seconds between flushes of the mainchain block and BMM caches to disk
+static const int64_t DRIVECHAIN_CACHE_FLUSH_INTERVAL = 60;
+
+extern unsigned int nMainchainRPCBatchSize;
 
 struct DrivechainDeposit {
     // TODO Update to match enforcer response deposit info
@@ -24,15 +56,217 @@ struct DrivechainDeposit {
     uint32_t nBurnIndex; // Deposit burn output index
     uint32_t nTx; // Deposit transaction number in mainchain block
     uint256 hashMainchainBlock;
+    uint32_t nMainchainHeight = 0; // Height of hashMainchainBlock
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(strDest);
+        READWRITE(amount);
+        READWRITE(mtx);
+        READWRITE(nBurnIndex);
+        READWRITE(nTx);
+        READWRITE(hashMainchainBlock);
+        READWRITE(nMainchainHeight);
+    }
+};
+
+/**
+ * Position of a deposit on the mainchain. Serialized big endian so that the
+ * deposit database keeps deposits in mainchain order.
+ */
+struct DrivechainDepositKey {
+    uint32_t nMainchainHeight;
+    uint32_t nTx;
+    uint32_t nBurnIndex;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return 12;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata32be(s, nMainchainHeight);
+        ser_writedata32be(s, nTx);
+        ser_writedata32be(s, nBurnIndex);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        nMainchainHeight = ser_readdata32be(s);
+        nTx = ser_readdata32be(s);
+        nBurnIndex = ser_readdata32be(s);
+    }
+
+    DrivechainDepositKey(uint32_t nMainchainHeightIn, uint32_t nTxIn, uint32_t nBurnIndexIn) :
+        nMainchainHeight(nMainchainHeightIn), nTx(nTxIn), nBurnIndex(nBurnIndexIn) {}
+
+    explicit DrivechainDepositKey(const DrivechainDeposit& deposit) :
+        DrivechainDepositKey(deposit.nMainchainHeight, deposit.nTx, deposit.nBurnIndex) {}
+
+    DrivechainDepositKey() : DrivechainDepositKey(0, 0, 0) {}
+
+    friend bool operator==(const DrivechainDepositKey& a, const DrivechainDepositKey& b) {
+        return a.nMainchainHeight == b.nMainchainHeight && a.nTx == b.nTx && a.nBurnIndex == b.nBurnIndex;
+    }
+
+    friend bool operator<(const DrivechainDepositKey& a, const DrivechainDepositKey& b) {
+        return std::tie(a.nMainchainHeight, a.nTx, a.nBurnIndex) < std::tie(b.nMainchainHeight, b.nTx, b.nBurnIndex);
+    }
 };
 
 // Bitcoin-patched RPC client interface
 
+/**
+ * HTTP/1.1 JSON-RPC client for the mainchain node.
+ *
+ * Connections are kept alive after a request and parked in a small pool so
+ * that a sequence of calls (such as walking the mainchain one height at a
+ * time) pays for a single TCP handshake. If a pooled connection turns out to
+ * have been closed by the server the request is retried once on a fresh
+ * connection, so callers must only send idempotent requests.
+ *
+ * Every socket operation has a deadline of nTimeout milliseconds. A
+ * connection that misses one is closed and the request fails, so a stalled
+ * mainchain node can't block the caller indefinitely.
+ */
+class CMainchainRPCClient
+{
+public:
+    CMainchainRPCClient(const std::string& strHostIn, int nPortIn,
+            const std::string& strUser, const std::string& strPass,
+            size_t nMaxIdleIn = DEFAULT_MAINCHAIN_RPC_POOL_SIZE,
+            int64_t nTimeoutIn = DEFAULT_MAINCHAIN_RPC_TIMEOUT);
+    ~CMainchainRPCClient();
+
+    /**
+     * Send a JSON-RPC request and read the response body into strBody.
+     * Returns false on connection errors or a non-200 HTTP status.
+     */
+    bool Post(const std::string& strRequest, std::string& strBody);
+
+    /**
+     * Send a JSON-RPC request and decode the response body into reply. The
+     * body is parsed directly from the connection's receive buffer.
+     */
+    bool Post(const std::string& strRequest, UniValue& reply);
+
+    /** Close all idle pooled connections */
+    void Disconnect();
+
+    /** Number of TCP connections opened since construction */
+    uint64_t GetConnectCount() const { return nConnects; }
+
+private:
+    struct Connection;
+
+    /** Called with the body of a successful response, returns false if the body is invalid */
+    typedef std::function<bool(const char* pBody, size_t nBody)> BodyHandler;
+
+    std::unique_ptr<Connection> Connect();
+    void Release(std::unique_ptr<Connection> conn);
+    bool Request(const std::string& strRequest, const BodyHandler& handler);
+    int Exchange(Connection& conn, const std::string& strRequest, const BodyHandler& handler, bool& fKeepAlive);
+
+    const std::string strHost;
+    const int nPort;
+    const std::string strAuth;
+    const size_t nMaxIdle;
+    const int64_t nTimeout;
+
+    Mutex cs_pool;
+    std::vector<std::unique_ptr<Connection>> vIdle GUARDED_BY(cs_pool);
+
+    std::atomic<uint64_t> nConnects{0};
+
+    /** Whether the last request got a response, so that an unreachable server is only reported once */
+    std::atomic<bool> fReachable{true};
+};
+
+/**
+ * Send mainchain requests to strHost:nPort from now on. Set at startup from
+ * -mainchainrpchost and -mainchainrpcport, and by tests and benchmarks to
+ * talk to a local stand-in for the mainchain node.
+ */
+void SetMainchainRPCEndpoint(const std::string& strHost, int nPort);
+
+/**
+ * Return the deposits of a mainchain block from source instead of asking the
+ * enforcer, for tests and benchmarks. An empty function restores the default.
+ */
+void SetDrivechainDepositSource(std::function<bool(const uint256&, std::vector<DrivechainDeposit>&)> source);
+
 bool DrivechainRPCGetBTCBlockCount(int& nBlocks);
 
+/**
+ * Request the mainchain block hashes at heights nFirst to nFirst + nCount - 1
+ * using JSON-RPC batches of up to nMainchainRPCBatchSize calls each.
+ */
+bool DrivechainRPCGetBTCBlockHashes(int nFirst, int nCount, std::vector<uint256>& vHash);
+
+/**
+ * Decode the reply to a batch of 'getblockhash' calls with ids nFirst to
+ * nFirst + vHash.size() - 1 into vHash, which must be all null on entry.
+ */
+bool DecodeBTCBlockHashBatch(const UniValue& reply, int nFirst, std::vector<uint256>& vHash);
+
+
+// On-disk caches
+
+/**
+ * Append-only file of uint256 records, used for the mainchain block hash and
+ * BMM caches. The file starts with a magic number and version, followed by
+ * fixed size records of a hash and a checksum over the hash and its position.
+ * Loading maps the file into memory and stops at the first torn or corrupt
+ * record, which is cut off along with everything after it. Saving only
+ * writes new records, and only a mainchain reorg truncates the file.
+ */
+class CHashRecordLog
+{
+public:
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t HEADER_SIZE = 8;
+    static constexpr size_t RECORD_SIZE = 36;
+
+    CHashRecordLog(const fs::path& pathIn, uint32_t nMagicIn);
+
+    /**
+     * Read all valid records from the file, creating it if it doesn't exist
+     * or isn't in this format. Must be called before Append and Truncate.
+     */
+    bool Open(std::vector<uint256>& vRecord);
+
+    /** Append records to the end of the file and sync it */
+    bool Append(const std::vector<uint256>& vRecord);
+
+    /** Remove all records after the first nRecordsIn and sync the file */
+    bool Truncate(size_t nRecordsIn);
+
+    /** Rewrite the file with only the last nKeep records */
+    bool Compact(size_t nKeep);
+
+    /** Number of records in the file */
+    size_t Size() const { return nRecords; }
+
+private:
+    fs::path path;
+    uint32_t nMagic;
+    size_t nRecords = 0;
+    bool fOpen = false;
+
+    uint32_t Checksum(const uint256& hash, size_t nPos) const;
+    bool Create();
+    bool Parse(const unsigned char* pData, size_t nSize, std::vector<uint256>& vRecord) const;
+};
+
+/** Write new mainchain block and BMM cache entries to disk */
+void FlushDrivechainCaches();
+
 
 // BMM validation & cache
 
+/** Set the size of the BMM cache, before ReadBMMCache */
+void InitBMMCache(size_t nMaxCacheSize);
+
 // DAT files to save BMM info
 bool ReadBMMCache();
 bool WriteBMMCache();
@@ -43,13 +277,119 @@ bool HaveVerifiedBMM(const uint256& hashBlock);
 // Cache that we verified BMM for this sidechain block
 void CacheVerifiedBMM(const uint256& hashBlock);
 
-bool VerifyBMM(const CBlock& block);
+bool VerifyBMM(const CBlockHeader& block);
+
+/**
+ * Verify the BMM commitments of a batch of headers from a 'headers' message
+ * with a single enforcer request, and cache the ones that are valid so that
+ * VerifyBMM finds them when the headers are accepted. Only the continuous
+ * run of headers with valid proof of work at the start of the batch is
+ * checked. Must not be called with cs_main held. Returns the number of
+ * headers newly verified.
+ */
+size_t VerifyBMMBatch(const std::vector<CBlockHeader>& vHeader, const Consensus::Params& params);
+
+/**
+ * Have the mainchain commit to h* (the hashMerkleRoot of a sidechain block we
+ * mined) and wait up to nTimeout seconds for a mainchain block with the
+ * commitment, returned in hashMainBlock. Returns false if none was found.
+ *
+ * The enforcer only takes BMM requests over gRPC, so requests go to the
+ * handler set by SetBMMRequestHandler, and fail if there is none. The handler
+ * is passed nTimeout and should give up once it has passed; a commitment it
+ * returns after that is treated as not found.
+ */
+bool DrivechainRequestBMM(const uint256& hashHStar, uint256& hashMainBlock, int64_t nTimeout);
+
+/**
+ * Send BMM requests to handler, for tests and benchmarks. An empty function
+ * removes it.
+ */
+void SetBMMRequestHandler(std::function<bool(const uint256&, uint256&, int64_t)> handler);
+
+/** Whether DrivechainRequestBMM has a handler to send requests to */
+bool HaveBMMRequestHandler();
 
 
 // Deposit validation & DB
 
+class CDepositDB;
+
+/** Deposits of every followed mainchain block, and which of them were paid */
+extern CDepositDB* pdepositdb;
+
+/**
+ * Bring pdepositdb up to the mainchain block cache: forget the deposits of
+ * blocks that left the mainchain, then store the deposits of each new block.
+ * Called by the mainchain follower thread after updating the cache.
+ */
+bool SyncDrivechainDeposits();
+
+/** Get the stored unpaid deposits in mainchain order, without asking the enforcer */
 bool GetUnpaidDrivechainDeposits(std::vector<DrivechainDeposit>& vDeposit);
 
+/** Mark the deposits paid out by the coinbase of a connected block */
+bool ConnectDrivechainDeposits(const CTransaction& coinbase, const uint256& hashBlock);
+
+/** Mark the deposits paid out by the coinbase of a disconnected block unpaid */
+bool DisconnectDrivechainDeposits(const CTransaction& coinbase, const uint256& hashPrevBlock);
+
+/**
+ * Set the sidechain block the deposit database is known to be at, once it
+ * matches the active chain at startup. Connecting and disconnecting blocks
+ * keeps it up to date from then on.
+ */
+void SetDrivechainDepositTip(const uint256& hashBlock);
+
+/** Unpaid deposits after a sidechain block, ready to be paid out by the next one */
+struct CDepositPayoutSnapshot {
+    //! Last sidechain block connected when the deposits were read, null if
+    //! none was connected since startup
+    uint256 hashBlock;
+    //! Unpaid deposits in mainchain order
+    std::vector<DrivechainDeposit> vDeposit;
+    //! When the deposits were read from the deposit database
+    int64_t nTime = 0;
+};
+
+/** Read the unpaid deposits and publish them as the deposit payout snapshot */
+bool RefreshDepositPayouts();
+
+/** Get the current deposit payout snapshot, null before the first refresh */
+std::shared_ptr<const CDepositPayoutSnapshot> GetDepositPayoutSnapshot();
+
+/**
+ * Get the deposits to pay out in a block on top of hashBlock. Returns the
+ * current snapshot if it was made after hashBlock was connected, otherwise
+ * refreshes it first from the local deposit database. Never null.
+ */
+std::shared_ptr<const CDepositPayoutSnapshot> GetDepositPayouts(const uint256& hashBlock);
+
+/**
+ * Guess the deposits to pay out in the block after next, for a coinbase made
+ * before the next block is known: the unpaid deposits vUnpaid, less the ones
+ * the next block is expected to pay out in vNextPayout.
+ */
+std::vector<DrivechainDeposit> GetExpectedDepositPayouts(const std::vector<DrivechainDeposit>& vUnpaid,
+        const std::vector<DrivechainDeposit>& vNextPayout);
+
+/** Check if two payout lists pay out the same deposits in the same order */
+bool SameDepositPayouts(const std::vector<DrivechainDeposit>& a, const std::vector<DrivechainDeposit>& b);
+
+/**
+ * Refresh the deposit payout snapshot on the scheduler thread whenever the
+ * mainchain or sidechain tip changes, so that creating a block only has to
+ * read it.
+ */
+void RegisterDepositPayoutRefresher(CScheduler& scheduler);
+void UnregisterDepositPayoutRefresher();
+
+/** Coinbase output script paying out deposit */
+CScript GetDepositPayoutScript(const DrivechainDeposit& deposit);
+
+/** Get the deposit paid out by a coinbase output script */
+bool GetDepositPayoutKey(const CScript& script, DrivechainDepositKey& key);
+
 std::string GenerateDepositAddress(const std::string& strDestIn);
 
 bool ParseDepositAddress(const std::string& strAddressIn, std::string& strAddressOut, unsigned int& nSidechainOut);
@@ -61,12 +401,111 @@ bool VerifyDrivechainDeposit(const CTxOut& out);
 
 // Mainchain block hash cache
 
+/**
+ * Index of mainchain block hashes by height and by hash. The hashes are kept
+ * in a dense vector in order of height, and an open addressing table with
+ * linear probing maps a salted 64-bit hash of each block hash to its height.
+ * The table is at most half full, so lookups almost always touch one slot and
+ * one entry of the hash vector.
+ */
+class CMainBlockHashIndex
+{
+public:
+    CMainBlockHashIndex();
+
+    /** Height of the last block, -1 if empty */
+    int Height() const { return (int)vHash.size() - 1; }
+
+    /** Height of hash, -1 if it is not indexed */
+    int Find(const uint256& hash) const;
+
+    bool Contains(const uint256& hash) const { return Find(hash) >= 0; }
+
+    /** All indexed block hashes in order of height */
+    const std::vector<uint256>& Hashes() const { return vHash; }
+
+    /** Add hash at the next height */
+    void Append(const uint256& hash);
+
+    /** Remove the last block */
+    void PopBack();
+
+    /** Make room for nBlocks blocks without rehashing */
+    void Reserve(size_t nBlocks);
+
+    size_t DynamicMemoryUsage() const;
+
+private:
+    static const uint32_t EMPTY = std::numeric_limits<uint32_t>::max();
+
+    struct Slot
+    {
+        uint64_t nKey;
+        uint32_t nHeight;
+    };
+
+    /** Salt */
+    uint64_t k0, k1;
+
+    std::vector<uint256> vHash;
+
+    //! Power of two number of slots, empty slots have nHeight == EMPTY
+    std::vector<Slot> vSlot;
+
+    uint64_t Key(const uint256& hash) const;
+    size_t FindSlot(uint32_t nHeight) const;
+    void Insert(uint64_t nKey, uint32_t nHeight);
+    void Rehash(size_t nSlots);
+};
+
+/**
+ * Immutable version of the mainchain block hash cache. Every change to the
+ * cache publishes a new snapshot; readers load the current one and can use
+ * it without any locking for as long as they hold on to it.
+ */
+class CMainBlockCacheSnapshot
+{
+public:
+    //! Incremented for every published snapshot
+    uint64_t nVersion = 0;
+
+    //! All known mainchain blocks
+    CMainBlockHashIndex index;
+
+    /** Height of the cached tip, -1 if the cache is empty */
+    int Height() const { return index.Height(); }
+
+    /** All known mainchain block hashes in order of height */
+    const std::vector<uint256>& Hashes() const { return index.Hashes(); }
+
+    bool Contains(const uint256& hash) const { return index.Contains(hash); }
+    bool GetHeight(const uint256& hash, int& nHeight) const;
+    bool GetHash(int nHeight, uint256& hash) const;
+};
+
+/** Get the current mainchain block cache snapshot, never null */
+std::shared_ptr<const CMainBlockCacheSnapshot> GetMainBlockCacheSnapshot();
+
+/**
+ * Publish a new snapshot made from pBase by removing the blocks above height
+ * nFork, which are added to vDisconnected, and appending vAppend. Fails if
+ * pBase is no longer the current snapshot.
+ */
+bool PublishMainBlockCache(const std::shared_ptr<const CMainBlockCacheSnapshot>& pBase, int nFork,
+        const std::vector<uint256>& vAppend, std::vector<uint256>& vDisconnected);
+
 // DAT files to save mainchain hash info
 bool ReadMainBlockCache();
 bool WriteMainBlockCache();
 
 void CacheMainBlockHash(const uint256& hash);
 
+/** Check if hash is a block in the cached mainchain */
+bool HaveMainBlock(const uint256& hash);
+
+/** Get the cached mainchain tip, returns false if the cache is empty */
+bool GetMainchainTip(uint256& hashTip, int& nHeight);
+
 /**
  * Update the cache of mainchain blocks. Detect mainchain reorg & return
  * list of disconnected mainchain blocks if a reorg was detected.
@@ -76,6 +515,14 @@ bool UpdateMainBlockHashCache(bool& fReorg, std::vector<uint256>& vDisconnected)
 /* Verify the contents of the mainchain block cache with the mainchain */
 bool VerifyMainBlockCache(std::string& strError);
 
+/**
+ * Keep the mainchain block cache up to date by polling the mainchain node
+ * every -mainchainpollinterval seconds. Tip changes are announced with the
+ * UpdatedMainchainTip validation interface signal. This is the only thread
+ * that updates the cache after startup.
+ */
+void ThreadMainchainFollower();
+
 // TODO 
 // Enforcer does not do anything for reorgs / disconnected blocks yet,
 // so this is unused for now
@@ -1,6 +1,7 @@
 #include "gmock/gmock.h"
 #include "init.h"
 #include "key.h"
+#include "proof_verifier.h"
 #include "pubkey.h"
 #include "random.h"
 #include "script/sigcache.h"
@@ -62,6 +63,7 @@ int main(int argc, char **argv) {
   assert(sodium_init() != -1);
   ECC_Start();
     InitSignatureCache(DEFAULT_MAX_SIG_CACHE_SIZE * ((size_t) 1 << 20));
+    InitJoinSplitCache(DEFAULT_MAX_SIG_CACHE_SIZE * ((size_t) 1 << 20));
     bundlecache::init(DEFAULT_MAX_SIG_CACHE_SIZE * ((size_t) 1 << 20));
 
     // Log all errors to a common test file.
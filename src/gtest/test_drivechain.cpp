@@ -0,0 +1,624 @@
+// Copyright (c) 2025 L2L
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include <gtest/gtest.h>
+
+#include "drivechain.h"
+#include "rpc/protocol.h"
+#include "fs.h"
+#include "test/mainchain_mock.h"
+#include "txdb.h"
+#include "tinyformat.h"
+#include "arith_uint256.h"
+#include "uint256.h"
+#include "util/strencodings.h"
+#include "util/time.h"
+
+#include <univalue.h>
+
+#include <chrono>
+
+static const std::string GETBLOCKCOUNT = "{\"jsonrpc\": \"1.0\", \"id\":\"Drivechain\", \"method\": \"getblockcount\", \"params\": [] }";
+static const std::string BLOCKCOUNT_REPLY = "{\"result\":100,\"error\":null,\"id\":\"Drivechain\"}\n";
+
+TEST(MainchainRPCClient, ReusesKeepAliveConnection) {
+    CMainchainMock mock(101);
+    CMainchainRPCClient client("127.0.0.1", mock.GetPort(), "user", "password");
+
+    std::string strBody;
+    for (int i = 0; i < 50; i++) {
+        ASSERT_TRUE(client.Post(GETBLOCKCOUNT, strBody));
+        EXPECT_EQ(strBody, BLOCKCOUNT_REPLY);
+    }
+
+    EXPECT_EQ(client.GetConnectCount(), 1);
+    EXPECT_EQ(mock.GetConnectionCount(), 1);
+    EXPECT_EQ(mock.GetRequestCount(), 50);
+}
+
+TEST(MainchainRPCClient, HonoursConnectionClose) {
+    CMainchainMock mock(101);
+    mock.SetCloseMode(CMainchainMock::CloseMode::CLOSE_HEADER);
+    CMainchainRPCClient client("127.0.0.1", mock.GetPort(), "user", "password");
+
+    std::string strBody;
+    for (int i = 0; i < 5; i++) {
+        ASSERT_TRUE(client.Post(GETBLOCKCOUNT, strBody));
+    }
+
+    EXPECT_EQ(client.GetConnectCount(), 5);
+    EXPECT_EQ(mock.GetConnectionCount(), 5);
+    EXPECT_EQ(mock.GetRequestCount(), 5);
+}
+
+TEST(MainchainRPCClient, ReconnectsAfterServerDrop) {
+    CMainchainMock mock(101);
+    mock.SetCloseMode(CMainchainMock::CloseMode::DROP_SILENTLY);
+    CMainchainRPCClient client("127.0.0.1", mock.GetPort(), "user", "password");
+
+    // Every request after the first is first tried on the stale pooled
+    // connection and then retried on a new one.
+    std::string strBody;
+    for (int i = 0; i < 5; i++) {
+        ASSERT_TRUE(client.Post(GETBLOCKCOUNT, strBody));
+        EXPECT_EQ(strBody, BLOCKCOUNT_REPLY);
+    }
+
+    EXPECT_EQ(mock.GetConnectionCount(), 5);
+    EXPECT_EQ(mock.GetRequestCount(), 5);
+}
+
+TEST(MainchainRPCClient, FailsOnHTTPError) {
+    CMainchainMock mock;
+    mock.SetHTTPHandler([](const std::string&) {
+        return std::make_pair(401, std::string());
+    });
+    CMainchainRPCClient client("127.0.0.1", mock.GetPort(), "user", "password");
+
+    std::string strBody;
+    EXPECT_FALSE(client.Post(GETBLOCKCOUNT, strBody));
+
+    // The connection is still usable after an error status
+    EXPECT_FALSE(client.Post(GETBLOCKCOUNT, strBody));
+    EXPECT_EQ(mock.GetConnectionCount(), 1);
+}
+
+TEST(MainchainRPCClient, FailsWithoutServer) {
+    int nPort;
+    {
+        CMainchainMock mock;
+        nPort = mock.GetPort();
+    }
+    CMainchainRPCClient client("127.0.0.1", nPort, "user", "password");
+
+    std::string strBody;
+    EXPECT_FALSE(client.Post(GETBLOCKCOUNT, strBody));
+    EXPECT_EQ(client.GetConnectCount(), 0);
+}
+
+TEST(MainchainRPCClient, ReadsChunkedResponse) {
+    CMainchainMock mock(101);
+    mock.SetChunked(true);
+    CMainchainRPCClient client("127.0.0.1", mock.GetPort(), "user", "password");
+
+    std::string strBody;
+    for (int i = 0; i < 5; i++) {
+        ASSERT_TRUE(client.Post(GETBLOCKCOUNT, strBody));
+        EXPECT_EQ(strBody, BLOCKCOUNT_REPLY);
+    }
+    EXPECT_EQ(mock.GetConnectionCount(), 1);
+}
+
+TEST(MainchainRPCClient, ParsesPrettyPrintedJSON) {
+    const std::string strPretty = "{\n  \"result\": 100,\n  \"error\": null,\n  \"id\": \"Drivechain\"\n}\n";
+    for (bool fChunked : {false, true}) {
+        CMainchainMock mock;
+        mock.SetChunked(fChunked);
+        mock.SetHTTPHandler([&](const std::string&) {
+            return std::make_pair(200, strPretty);
+        });
+        CMainchainRPCClient client("127.0.0.1", mock.GetPort(), "user", "password");
+
+        UniValue reply;
+        ASSERT_TRUE(client.Post(GETBLOCKCOUNT, reply));
+        EXPECT_EQ(find_value(reply, "result").get_int(), 100);
+        EXPECT_TRUE(find_value(reply, "error").isNull());
+    }
+}
+
+TEST(MainchainRPCClient, RejectsInvalidJSON) {
+    CMainchainMock mock;
+    mock.SetHTTPHandler([](const std::string&) {
+        return std::make_pair(200, std::string("{\"result\": "));
+    });
+    CMainchainRPCClient client("127.0.0.1", mock.GetPort(), "user", "password");
+
+    UniValue reply;
+    EXPECT_FALSE(client.Post(GETBLOCKCOUNT, reply));
+}
+
+TEST(MainchainRPCClient, TimesOutOnStalledServer) {
+    CMainchainMock mock;
+    mock.SetLatency(1000);
+    CMainchainRPCClient client("127.0.0.1", mock.GetPort(), "user", "password", DEFAULT_MAINCHAIN_RPC_POOL_SIZE, 100);
+
+    auto nStart = std::chrono::steady_clock::now();
+    UniValue reply;
+    EXPECT_FALSE(client.Post(GETBLOCKCOUNT, reply));
+    EXPECT_LT(std::chrono::steady_clock::now() - nStart, std::chrono::milliseconds(900));
+    EXPECT_EQ(mock.GetRequestCount(), 1);
+}
+
+TEST(MainchainRPC, DecodeBlockHashBatch) {
+    std::vector<uint256> vExpected;
+    for (int i = 0; i < 3; i++)
+        vExpected.push_back(ArithToUint256(arith_uint256(1000 + i)));
+
+    // Replies are matched by id, not position
+    UniValue reply;
+    ASSERT_TRUE(reply.read(strprintf(
+            "[{\"result\":\"%s\",\"error\":null,\"id\":12},"
+            " {\"result\":\"%s\",\"error\":null,\"id\":10},"
+            " {\"result\":\"%s\",\"error\":null,\"id\":11}]",
+            vExpected[2].GetHex(), vExpected[0].GetHex(), vExpected[1].GetHex())));
+
+    std::vector<uint256> vHash(3);
+    ASSERT_TRUE(DecodeBTCBlockHashBatch(reply, 10, vHash));
+    EXPECT_EQ(vHash, vExpected);
+
+    // Missing reply
+    vHash.assign(4, uint256());
+    EXPECT_FALSE(DecodeBTCBlockHashBatch(reply, 10, vHash));
+
+    // Id out of range
+    vHash.assign(3, uint256());
+    EXPECT_FALSE(DecodeBTCBlockHashBatch(reply, 11, vHash));
+
+    // Error reply
+    UniValue error;
+    ASSERT_TRUE(error.read("[{\"result\":null,\"error\":{\"code\":-8,\"message\":\"Block height out of range\"},\"id\":0}]"));
+    vHash.assign(1, uint256());
+    EXPECT_FALSE(DecodeBTCBlockHashBatch(error, 0, vHash));
+}
+
+TEST(MainchainRPC, MainBlockCacheSnapshot) {
+    std::vector<uint256> vHash;
+    for (int i = 0; i < 4; i++)
+        vHash.push_back(ArithToUint256(arith_uint256(2000 + i)));
+
+    std::vector<uint256> vDisconnected;
+    std::shared_ptr<const CMainBlockCacheSnapshot> pBase = GetMainBlockCacheSnapshot();
+    const int nBase = pBase->Height();
+    ASSERT_TRUE(PublishMainBlockCache(pBase, nBase, vHash, vDisconnected));
+    EXPECT_TRUE(vDisconnected.empty());
+
+    // Readers keep the snapshot they loaded
+    std::shared_ptr<const CMainBlockCacheSnapshot> pCache = GetMainBlockCacheSnapshot();
+    EXPECT_EQ(pCache->nVersion, pBase->nVersion + 1);
+    EXPECT_EQ(pCache->Height(), nBase + 4);
+    EXPECT_EQ(pBase->Height(), nBase);
+
+    int nHeight;
+    uint256 hash;
+    ASSERT_TRUE(pCache->GetHeight(vHash[2], nHeight));
+    EXPECT_EQ(nHeight, nBase + 3);
+    ASSERT_TRUE(pCache->GetHash(nBase + 4, hash));
+    EXPECT_EQ(hash, vHash[3]);
+    EXPECT_FALSE(pCache->GetHash(nBase + 5, hash));
+
+    // Publishing against a stale snapshot fails
+    EXPECT_FALSE(PublishMainBlockCache(pBase, nBase, vHash, vDisconnected));
+
+    // Replace the last two blocks
+    std::vector<uint256> vReplace = {ArithToUint256(arith_uint256(3000))};
+    ASSERT_TRUE(PublishMainBlockCache(pCache, nBase + 2, vReplace, vDisconnected));
+    EXPECT_EQ(vDisconnected, std::vector<uint256>({vHash[3], vHash[2]}));
+    EXPECT_FALSE(HaveMainBlock(vHash[2]));
+    EXPECT_TRUE(HaveMainBlock(vReplace[0]));
+
+    ASSERT_TRUE(GetMainchainTip(hash, nHeight));
+    EXPECT_EQ(hash, vReplace[0]);
+    EXPECT_EQ(nHeight, nBase + 3);
+}
+
+TEST(MainchainRPC, MainBlockHashIndex) {
+    CMainBlockHashIndex index;
+    EXPECT_EQ(index.Height(), -1);
+    EXPECT_FALSE(index.Contains(uint256()));
+
+    std::vector<uint256> vHash;
+    for (int i = 0; i < 10000; i++)
+        vHash.push_back(ArithToUint256(arith_uint256(i) << 128));
+
+    for (const uint256& hash : vHash)
+        index.Append(hash);
+    ASSERT_EQ(index.Height(), 9999);
+    EXPECT_EQ(index.Hashes(), vHash);
+    for (int i = 0; i < 10000; i++)
+        EXPECT_EQ(index.Find(vHash[i]), i);
+
+    // Removed blocks can no longer be found, and removing them does not
+    // break the probe sequences of the remaining blocks
+    for (int i = 0; i < 5000; i++)
+        index.PopBack();
+    ASSERT_EQ(index.Height(), 4999);
+    for (int i = 0; i < 10000; i++)
+        EXPECT_EQ(index.Find(vHash[i]), i < 5000 ? i : -1);
+
+    // Re-add them at different heights
+    index.Reserve(15000);
+    for (int i = 9999; i >= 5000; i--)
+        index.Append(vHash[i]);
+    for (int i = 5000; i < 10000; i++)
+        EXPECT_EQ(index.Find(vHash[i]), 14999 - i);
+
+    EXPECT_GE(index.DynamicMemoryUsage(), 15000 * sizeof(uint256));
+}
+
+TEST(MainchainRPC, HashRecordLog) {
+    const fs::path path = fs::temp_directory_path() / fs::unique_path("hashlog-%%%%.dat");
+
+    std::vector<uint256> vHash;
+    for (int i = 0; i < 100; i++)
+        vHash.push_back(ArithToUint256(arith_uint256(5000 + i)));
+
+    std::vector<uint256> vRecord;
+    {
+        CHashRecordLog log(path, 0x54534554);
+        ASSERT_TRUE(log.Open(vRecord));
+        EXPECT_TRUE(vRecord.empty());
+
+        ASSERT_TRUE(log.Append(std::vector<uint256>(vHash.begin(), vHash.begin() + 60)));
+        ASSERT_TRUE(log.Append(std::vector<uint256>(vHash.begin() + 60, vHash.end())));
+        EXPECT_EQ(log.Size(), 100);
+    }
+    EXPECT_EQ(fs::file_size(path), CHashRecordLog::HEADER_SIZE + 100 * CHashRecordLog::RECORD_SIZE);
+
+    // Truncate and append a different branch
+    std::vector<uint256> vBranch = {ArithToUint256(arith_uint256(9000))};
+    {
+        CHashRecordLog log(path, 0x54534554);
+        ASSERT_TRUE(log.Open(vRecord));
+        EXPECT_EQ(vRecord, vHash);
+
+        ASSERT_TRUE(log.Truncate(50));
+        ASSERT_TRUE(log.Append(vBranch));
+    }
+    vHash.resize(50);
+    vHash.push_back(vBranch[0]);
+
+    // Simulate a torn write, the partial record is dropped
+    {
+        FILE* file = fsbridge::fopen(path, "ab");
+        ASSERT_TRUE(file != nullptr);
+        fwrite(vBranch[0].begin(), 1, 20, file);
+        fclose(file);
+
+        CHashRecordLog log(path, 0x54534554);
+        ASSERT_TRUE(log.Open(vRecord));
+        EXPECT_EQ(vRecord, vHash);
+        EXPECT_EQ(fs::file_size(path), CHashRecordLog::HEADER_SIZE + 51 * CHashRecordLog::RECORD_SIZE);
+    }
+
+    // A corrupt record drops it and everything after it
+    {
+        FILE* file = fsbridge::fopen(path, "r+b");
+        ASSERT_TRUE(file != nullptr);
+        fseek(file, CHashRecordLog::HEADER_SIZE + 40 * CHashRecordLog::RECORD_SIZE + 3, SEEK_SET);
+        fputc(0xff, file);
+        fclose(file);
+
+        CHashRecordLog log(path, 0x54534554);
+        ASSERT_TRUE(log.Open(vRecord));
+        EXPECT_EQ(vRecord, std::vector<uint256>(vHash.begin(), vHash.begin() + 40));
+    }
+
+    // Compacting keeps the last records, which can still be appended to
+    {
+        CHashRecordLog log(path, 0x54534554);
+        ASSERT_TRUE(log.Open(vRecord));
+        ASSERT_TRUE(log.Compact(10));
+        EXPECT_EQ(log.Size(), 10);
+        ASSERT_TRUE(log.Append(vBranch));
+    }
+    {
+        std::vector<uint256> vExpected(vHash.begin() + 30, vHash.begin() + 40);
+        vExpected.push_back(vBranch[0]);
+
+        CHashRecordLog log(path, 0x54534554);
+        ASSERT_TRUE(log.Open(vRecord));
+        EXPECT_EQ(vRecord, vExpected);
+    }
+
+    // A file in another format is replaced
+    {
+        CHashRecordLog log(path, 0x4f544852);
+        ASSERT_TRUE(log.Open(vRecord));
+        EXPECT_TRUE(vRecord.empty());
+        EXPECT_EQ(fs::file_size(path), CHashRecordLog::HEADER_SIZE);
+    }
+
+    fs::remove(path);
+}
+
+TEST(MainchainRPC, FollowsMockMainchain) {
+    // Start from an empty mainchain block cache
+    std::vector<uint256> vDisconnected;
+    std::shared_ptr<const CMainBlockCacheSnapshot> pBase;
+    do {
+        pBase = GetMainBlockCacheSnapshot();
+    } while (!PublishMainBlockCache(pBase, -1, {}, vDisconnected));
+
+    CMainchainMock mock(100);
+    mock.Install();
+
+    bool fReorg = false;
+    vDisconnected.clear();
+    ASSERT_TRUE(UpdateMainBlockHashCache(fReorg, vDisconnected));
+    EXPECT_FALSE(fReorg);
+    EXPECT_EQ(GetMainBlockCacheSnapshot()->Hashes(), mock.GetBlockHashes());
+
+    // Nothing to do without a new mainchain block
+    const int nRequests = mock.GetRequestCount();
+    ASSERT_TRUE(UpdateMainBlockHashCache(fReorg, vDisconnected));
+    EXPECT_EQ(mock.GetRequestCount(), nRequests + 2);
+
+    const std::vector<uint256> vOld = mock.GetBlockHashes();
+    mock.Reorg(3, 5);
+    ASSERT_TRUE(UpdateMainBlockHashCache(fReorg, vDisconnected));
+    EXPECT_TRUE(fReorg);
+    EXPECT_EQ(vDisconnected, std::vector<uint256>(vOld.rbegin(), vOld.rbegin() + 3));
+    EXPECT_EQ(GetMainBlockCacheSnapshot()->Hashes(), mock.GetBlockHashes());
+
+    // Scripted errors are passed on to the caller
+    mock.SetMethod("getblockcount", [](const UniValue&) -> UniValue {
+        throw JSONRPCError(RPC_MISC_ERROR, "Down for maintenance");
+    });
+    int nBlocks;
+    EXPECT_FALSE(DrivechainRPCGetBTCBlockCount(nBlocks));
+}
+
+TEST(DrivechainDeposits, StoredPerMainchainBlock) {
+    std::vector<uint256> vDisconnected;
+    std::shared_ptr<const CMainBlockCacheSnapshot> pBase;
+    do {
+        pBase = GetMainBlockCacheSnapshot();
+    } while (!PublishMainBlockCache(pBase, -1, {}, vDisconnected));
+
+    CMainchainMock mock(10);
+    mock.AddDeposits(2, COIN);
+    mock.Mine(5);
+    mock.AddDeposits(3, 2 * COIN);
+    mock.Install();
+
+    pdepositdb = new CDepositDB(1 << 20, true);
+
+    bool fReorg = false;
+    ASSERT_TRUE(UpdateMainBlockHashCache(fReorg, vDisconnected));
+    ASSERT_TRUE(SyncDrivechainDeposits());
+
+    int nBest;
+    ASSERT_TRUE(pdepositdb->ReadBestMainBlock(nBest));
+    EXPECT_EQ(nBest, 16);
+
+    // Unpaid deposits come out in mainchain order
+    std::vector<DrivechainDeposit> vDeposit;
+    ASSERT_TRUE(GetUnpaidDrivechainDeposits(vDeposit));
+    ASSERT_EQ(vDeposit.size(), 5);
+    EXPECT_EQ(vDeposit[0].nMainchainHeight, 10);
+    EXPECT_EQ(vDeposit[0].nTx, 1);
+    EXPECT_EQ(vDeposit[4].nMainchainHeight, 16);
+    EXPECT_EQ(vDeposit[4].nTx, 3);
+    EXPECT_EQ(vDeposit[4].amount, 2 * COIN);
+
+    // A coinbase paying out the first two deposits
+    CMutableTransaction mtx;
+    mtx.vout.push_back(CTxOut(COIN, CScript() << OP_TRUE));
+    for (int i = 0; i < 2; i++)
+        mtx.vout.push_back(CTxOut(vDeposit[i].amount, GetDepositPayoutScript(vDeposit[i])));
+    const CTransaction coinbase(mtx);
+
+    DrivechainDepositKey key;
+    EXPECT_FALSE(GetDepositPayoutKey(coinbase.vout[0].scriptPubKey, key));
+    ASSERT_TRUE(GetDepositPayoutKey(coinbase.vout[1].scriptPubKey, key));
+    EXPECT_TRUE(key == DrivechainDepositKey(vDeposit[0]));
+
+    const uint256 hashBlock = SerializeHash(std::string("block"));
+    ASSERT_TRUE(ConnectDrivechainDeposits(coinbase, hashBlock));
+
+    std::vector<DrivechainDeposit> vUnpaid;
+    ASSERT_TRUE(GetUnpaidDrivechainDeposits(vUnpaid));
+    ASSERT_EQ(vUnpaid.size(), 3);
+    EXPECT_EQ(vUnpaid[0].nMainchainHeight, 16);
+
+    uint256 hashPaid;
+    ASSERT_TRUE(pdepositdb->ReadPaid(key, hashPaid));
+    EXPECT_EQ(hashPaid, hashBlock);
+
+    // The paid index records the block it is at, with or without payouts
+    uint256 hashBest;
+    ASSERT_TRUE(pdepositdb->ReadBestBlock(hashBest));
+    EXPECT_EQ(hashBest, hashBlock);
+    const uint256 hashNext = SerializeHash(std::string("next"));
+    ASSERT_TRUE(ConnectDrivechainDeposits(CTransaction(), hashNext));
+    ASSERT_TRUE(pdepositdb->ReadBestBlock(hashBest));
+    EXPECT_EQ(hashBest, hashNext);
+    ASSERT_TRUE(DisconnectDrivechainDeposits(CTransaction(), hashBlock));
+
+    const uint256 hashPrev = SerializeHash(std::string("prev"));
+    ASSERT_TRUE(DisconnectDrivechainDeposits(coinbase, hashPrev));
+    ASSERT_TRUE(GetUnpaidDrivechainDeposits(vUnpaid));
+    EXPECT_EQ(vUnpaid.size(), 5);
+    EXPECT_FALSE(pdepositdb->ReadPaid(key, hashPaid));
+    ASSERT_TRUE(pdepositdb->ReadBestBlock(hashBest));
+    EXPECT_EQ(hashBest, hashPrev);
+
+    // A mainchain reorg drops the deposits of the disconnected block
+    mock.Reorg(1, 2);
+    ASSERT_TRUE(UpdateMainBlockHashCache(fReorg, vDisconnected));
+    ASSERT_TRUE(SyncDrivechainDeposits());
+    ASSERT_TRUE(GetUnpaidDrivechainDeposits(vUnpaid));
+    EXPECT_EQ(vUnpaid.size(), 2);
+    ASSERT_TRUE(pdepositdb->ReadBestMainBlock(nBest));
+    EXPECT_EQ(nBest, 17);
+
+    delete pdepositdb;
+    pdepositdb = nullptr;
+
+    do {
+        pBase = GetMainBlockCacheSnapshot();
+    } while (!PublishMainBlockCache(pBase, -1, {}, vDisconnected));
+}
+
+TEST(DrivechainDeposits, PayoutSnapshot) {
+    std::vector<uint256> vDisconnected;
+    std::shared_ptr<const CMainBlockCacheSnapshot> pBase;
+    do {
+        pBase = GetMainBlockCacheSnapshot();
+    } while (!PublishMainBlockCache(pBase, -1, {}, vDisconnected));
+
+    CMainchainMock mock(10);
+    mock.AddDeposits(2, COIN);
+    mock.Install();
+
+    pdepositdb = new CDepositDB(1 << 20, true);
+
+    // Startup sets the tip the deposit database was reconciled with
+    const uint256 hashTip = SerializeHash(std::string("tip"));
+    SetDrivechainDepositTip(hashTip);
+
+    bool fReorg = false;
+    ASSERT_TRUE(UpdateMainBlockHashCache(fReorg, vDisconnected));
+    ASSERT_TRUE(SyncDrivechainDeposits());
+    ASSERT_TRUE(RefreshDepositPayouts());
+
+    std::shared_ptr<const CDepositPayoutSnapshot> pSnapshot = GetDepositPayoutSnapshot();
+    ASSERT_TRUE(pSnapshot);
+    EXPECT_EQ(pSnapshot->vDeposit.size(), 2);
+    EXPECT_EQ(pSnapshot->hashBlock, hashTip);
+    EXPECT_GT(pSnapshot->nTime, 0);
+
+    // A snapshot for the requested tip is used as is
+    EXPECT_EQ(GetDepositPayouts(hashTip), pSnapshot);
+
+    // Connect a block paying out the first deposit
+    CMutableTransaction mtx;
+    mtx.vout.push_back(CTxOut(pSnapshot->vDeposit[0].amount, GetDepositPayoutScript(pSnapshot->vDeposit[0])));
+    const CTransaction coinbase(mtx);
+    const uint256 hashBlock = SerializeHash(std::string("block"));
+    ASSERT_TRUE(ConnectDrivechainDeposits(coinbase, hashBlock));
+
+    // The snapshot is only replaced by a refresh
+    EXPECT_EQ(GetDepositPayoutSnapshot(), pSnapshot);
+
+    // Asking for the new tip before the refresh ran refreshes it
+    std::shared_ptr<const CDepositPayoutSnapshot> pNext = GetDepositPayouts(hashBlock);
+    EXPECT_NE(pNext, pSnapshot);
+    EXPECT_EQ(pNext->hashBlock, hashBlock);
+    ASSERT_EQ(pNext->vDeposit.size(), 1);
+    EXPECT_EQ(pNext->vDeposit[0].nTx, 2);
+    EXPECT_EQ(GetDepositPayouts(hashBlock), pNext);
+
+    ASSERT_TRUE(DisconnectDrivechainDeposits(coinbase, hashTip));
+    std::shared_ptr<const CDepositPayoutSnapshot> pPrev = GetDepositPayouts(hashTip);
+    EXPECT_EQ(pPrev->hashBlock, hashTip);
+    EXPECT_EQ(pPrev->vDeposit.size(), 2);
+
+    SetDrivechainDepositTip(uint256());
+    delete pdepositdb;
+    pdepositdb = nullptr;
+
+    do {
+        pBase = GetMainBlockCacheSnapshot();
+    } while (!PublishMainBlockCache(pBase, -1, {}, vDisconnected));
+}
+
+TEST(DrivechainDeposits, ExpectedPayouts) {
+    std::vector<DrivechainDeposit> vUnpaid;
+    for (int i = 0; i < 4; i++) {
+        DrivechainDeposit deposit;
+        deposit.nMainchainHeight = 10 + i / 2;
+        deposit.nTx = i % 2 + 1;
+        deposit.amount = (i + 1) * COIN;
+        vUnpaid.push_back(deposit);
+    }
+
+    // The next block pays out the first and third deposits
+    std::vector<DrivechainDeposit> vNextPayout{vUnpaid[0], vUnpaid[2]};
+    std::vector<DrivechainDeposit> vExpected = GetExpectedDepositPayouts(vUnpaid, vNextPayout);
+    ASSERT_EQ(vExpected.size(), 2);
+    EXPECT_TRUE(DrivechainDepositKey(vExpected[0]) == DrivechainDepositKey(vUnpaid[1]));
+    EXPECT_TRUE(DrivechainDepositKey(vExpected[1]) == DrivechainDepositKey(vUnpaid[3]));
+
+    EXPECT_TRUE(SameDepositPayouts(vExpected, {vUnpaid[1], vUnpaid[3]}));
+    EXPECT_FALSE(SameDepositPayouts(vExpected, {vUnpaid[3], vUnpaid[1]}));
+    EXPECT_FALSE(SameDepositPayouts(vExpected, {vUnpaid[1]}));
+
+    // Same deposit, different amount
+    std::vector<DrivechainDeposit> vChanged = vExpected;
+    vChanged[1].amount += 1;
+    EXPECT_FALSE(SameDepositPayouts(vExpected, vChanged));
+
+    EXPECT_TRUE(GetExpectedDepositPayouts(vUnpaid, vUnpaid).empty());
+}
+
+TEST(DrivechainBMM, MockConfirmsRequests) {
+    CMainchainMock mock(10);
+    mock.Install();
+
+    const uint256 hashHStar = SerializeHash(std::string("h*"));
+    uint256 hashMainBlock;
+    ASSERT_TRUE(DrivechainRequestBMM(hashHStar, hashMainBlock, 1));
+
+    // The commitment is in a new mainchain block
+    std::vector<uint256> vHash = mock.GetBlockHashes();
+    ASSERT_EQ(vHash.size(), 11);
+    EXPECT_EQ(hashMainBlock, vHash.back());
+
+    std::vector<std::pair<uint256, uint256>> vCommit = mock.GetBMMCommits();
+    ASSERT_EQ(vCommit.size(), 1);
+    EXPECT_EQ(vCommit[0].first, hashMainBlock);
+    EXPECT_EQ(vCommit[0].second, hashHStar);
+}
+
+TEST(DrivechainBMM, FailsWithoutHandler) {
+    ASSERT_FALSE(HaveBMMRequestHandler());
+
+    const uint256 hashHStar = SerializeHash(std::string("h*"));
+    uint256 hashMainBlock;
+    EXPECT_FALSE(DrivechainRequestBMM(hashHStar, hashMainBlock, 1));
+    EXPECT_TRUE(hashMainBlock.IsNull());
+
+    CMainchainMock mock(10);
+    mock.Install();
+    EXPECT_TRUE(HaveBMMRequestHandler());
+    mock.Uninstall();
+    EXPECT_FALSE(HaveBMMRequestHandler());
+}
+
+TEST(DrivechainBMM, LateConfirmationFails) {
+    const uint256 hashHStar = SerializeHash(std::string("h*"));
+    FixedClock::SetGlobal();
+    FixedClock::Instance()->Set(std::chrono::seconds(1000));
+
+    // The handler is told the timeout, and a commitment found after it is stale
+    int64_t nDelay = 0;
+    SetBMMRequestHandler([&](const uint256& hashRequested, uint256& hashMainBlock, int64_t nTimeout) {
+        EXPECT_EQ(nTimeout, 60);
+        FixedClock::Instance()->Set(std::chrono::seconds(1000 + nDelay));
+        hashMainBlock = hashRequested;
+        return true;
+    });
+
+    uint256 hashMainBlock;
+    nDelay = 60;
+    EXPECT_TRUE(DrivechainRequestBMM(hashHStar, hashMainBlock, 60));
+    EXPECT_EQ(hashMainBlock, hashHStar);
+    nDelay = 61;
+    FixedClock::Instance()->Set(std::chrono::seconds(1000));
+    EXPECT_FALSE(DrivechainRequestBMM(hashHStar, hashMainBlock, 60));
+
+    SetBMMRequestHandler(nullptr);
+    SystemClock::SetGlobal();
+}
@@ -652,3 +652,69 @@ TEST(Joinsplit, BasicJoinsplitVerification)
     }
 
 }
+
+TEST(Joinsplit, JoinSplitCache)
+{
+    LoadProofParameters();
+
+    ed25519::VerificationKey joinSplitPubKey;
+    std::array<libzcash::JSInput, ZC_NUM_JS_INPUTS> inputs = {
+        libzcash::JSInput(),
+        libzcash::JSInput()
+    };
+    std::array<libzcash::JSOutput, ZC_NUM_JS_OUTPUTS> outputs = {
+        libzcash::JSOutput(libzcash::SproutSpendingKey::random().address(), 50),
+        libzcash::JSOutput()
+    };
+    auto jsdesc = JSDescriptionInfo(joinSplitPubKey, SproutMerkleTree().root(), inputs, outputs, 50, 0).BuildDeterministic();
+    auto mempoolVerifier = ProofVerifier::Strict(true);
+    auto blockVerifier = ProofVerifier::Strict();
+
+    // Verifying the proof for a block doesn't add it to the cache
+    auto before = GetJoinSplitCacheStats();
+    EXPECT_TRUE(blockVerifier.VerifySprout(jsdesc, joinSplitPubKey));
+    EXPECT_TRUE(blockVerifier.VerifySprout(jsdesc, joinSplitPubKey));
+    auto after = GetJoinSplitCacheStats();
+    EXPECT_EQ(before.nHits, after.nHits);
+    EXPECT_EQ(before.nMisses + 2, after.nMisses);
+
+    // The first verification for the mempool misses the cache, and the next
+    // one hits it
+    EXPECT_TRUE(mempoolVerifier.VerifySprout(jsdesc, joinSplitPubKey));
+    before = after;
+    after = GetJoinSplitCacheStats();
+    EXPECT_EQ(before.nHits, after.nHits);
+    EXPECT_EQ(before.nMisses + 1, after.nMisses);
+
+    EXPECT_TRUE(mempoolVerifier.VerifySprout(jsdesc, joinSplitPubKey));
+    before = after;
+    after = GetJoinSplitCacheStats();
+    EXPECT_EQ(before.nHits + 1, after.nHits);
+    EXPECT_EQ(before.nMisses, after.nMisses);
+
+    // Verifying it for a block hits the cache too, and lets the cache evict
+    // the entry when it needs the space
+    EXPECT_TRUE(blockVerifier.VerifySprout(jsdesc, joinSplitPubKey));
+    before = after;
+    after = GetJoinSplitCacheStats();
+    EXPECT_EQ(before.nHits + 1, after.nHits);
+    EXPECT_EQ(before.nMisses, after.nMisses);
+
+    // Changing a public input of the proof misses the cache again
+    auto modified = jsdesc;
+    modified.vpub_old = 49;
+    EXPECT_FALSE(mempoolVerifier.VerifySprout(modified, joinSplitPubKey));
+    before = after;
+    after = GetJoinSplitCacheStats();
+    EXPECT_EQ(before.nHits, after.nHits);
+    EXPECT_EQ(before.nMisses + 1, after.nMisses);
+    EXPECT_FALSE(mempoolVerifier.VerifySprout(modified, joinSplitPubKey));
+
+    // Disabled verifiers don't consult the cache
+    auto disabled = ProofVerifier::Disabled();
+    before = GetJoinSplitCacheStats();
+    EXPECT_TRUE(disabled.VerifySprout(modified, joinSplitPubKey));
+    after = GetJoinSplitCacheStats();
+    EXPECT_EQ(before.nHits, after.nHits);
+    EXPECT_EQ(before.nMisses, after.nMisses);
+}
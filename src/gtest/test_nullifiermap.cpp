@@ -0,0 +1,126 @@
+// Copyright (c) 2025 L2L
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include <gtest/gtest.h>
+
+#include "arith_uint256.h"
+#include "nullifier_map.h"
+#include "primitives/transaction.h"
+#include "random.h"
+
+#include <map>
+
+TEST(NullifierMapTests, SetFindErase)
+{
+    NullifierMap m;
+    CTransaction tx1, tx2;
+    uint256 nf1 = GetRandHash();
+    uint256 nf2 = GetRandHash();
+
+    EXPECT_TRUE(m.empty());
+    EXPECT_EQ(nullptr, m.find(nf1));
+    EXPECT_FALSE(m.erase(nf1));
+
+    m.set(nf1, &tx1);
+    m.set(nf2, &tx2);
+    EXPECT_EQ(2, m.size());
+    EXPECT_EQ(&tx1, m.find(nf1));
+    EXPECT_EQ(&tx2, m.find(nf2));
+
+    // setting a nullifier again replaces its transaction
+    m.set(nf1, &tx2);
+    EXPECT_EQ(2, m.size());
+    EXPECT_EQ(&tx2, m.find(nf1));
+
+    EXPECT_TRUE(m.erase(nf1));
+    EXPECT_FALSE(m.erase(nf1));
+    EXPECT_FALSE(m.count(nf1));
+    EXPECT_TRUE(m.count(nf2));
+    EXPECT_EQ(1, m.size());
+
+    m.clear();
+    EXPECT_TRUE(m.empty());
+    EXPECT_FALSE(m.count(nf2));
+    EXPECT_EQ(0, m.DynamicMemoryUsage());
+}
+
+// Check the map against a std::map through enough insertions and erasures
+// to grow and shrink the table several times. Keys are drawn from a small
+// set, so that the same key is set and erased many times over.
+TEST(NullifierMapTests, MatchesStdMap)
+{
+    NullifierMap m;
+    std::map<uint256, const CTransaction*> mapExpected;
+    std::vector<CTransaction> vTx(4);
+
+    for (int nRound = 0; nRound < 3; nRound++) {
+        for (int i = 0; i < 5000; i++) {
+            uint256 nf = ArithToUint256(arith_uint256(GetRand(20000)) << 128);
+            const CTransaction* ptx = &vTx[GetRand(vTx.size())];
+            if (GetRand(3) == 0) {
+                EXPECT_EQ(mapExpected.erase(nf) == 1, m.erase(nf));
+            } else {
+                mapExpected[nf] = ptx;
+                m.set(nf, ptx);
+            }
+        }
+        ASSERT_EQ(mapExpected.size(), m.size());
+        for (const auto& entry : mapExpected)
+            EXPECT_EQ(entry.second, m.find(entry.first));
+
+        size_t nVisited = 0;
+        m.ForEach([&](const uint256& nf, const CTransaction* ptx) {
+            EXPECT_EQ(mapExpected[nf], ptx);
+            nVisited++;
+        });
+        EXPECT_EQ(mapExpected.size(), nVisited);
+
+        // Erase most entries, so that the table shrinks
+        for (auto it = mapExpected.begin(); it != mapExpected.end(); ) {
+            if (GetRand(10) != 0) {
+                EXPECT_TRUE(m.erase(it->first));
+                it = mapExpected.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        ASSERT_EQ(mapExpected.size(), m.size());
+        for (const auto& entry : mapExpected)
+            EXPECT_EQ(entry.second, m.find(entry.first));
+    }
+}
+
+// Keep up to 12 entries in the smallest table of 16 slots. Bucket positions
+// are salted hashes, so collisions can't be chosen, but at this load most
+// entries share a probe sequence with another and many wrap around the end
+// of the table, which exercises moving entries back on erase.
+TEST(NullifierMapTests, FullSmallTable)
+{
+    NullifierMap m;
+    std::map<uint256, const CTransaction*> mapExpected;
+    CTransaction tx;
+    std::vector<uint256> vKey;
+    for (int i = 0; i < 32; i++)
+        vKey.push_back(GetRandHash());
+
+    m.set(vKey[0], &tx);
+    mapExpected[vKey[0]] = &tx;
+    const size_t nUsage = m.DynamicMemoryUsage();
+
+    for (int i = 0; i < 20000; i++) {
+        const uint256& nf = vKey[GetRand(vKey.size())];
+        if (mapExpected.size() < 12 && GetRand(2) == 0) {
+            mapExpected[nf] = &tx;
+            m.set(nf, &tx);
+        } else {
+            EXPECT_EQ(mapExpected.erase(nf) == 1, m.erase(nf));
+        }
+
+        ASSERT_EQ(mapExpected.size(), m.size());
+        for (const uint256& key : vKey)
+            ASSERT_EQ(mapExpected.count(key) == 1, m.count(key));
+        if (!m.empty())
+            ASSERT_EQ(nUsage, m.DynamicMemoryUsage());
+    }
+}
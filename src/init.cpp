@@ -32,6 +32,7 @@
 #include "miner.h"
 #include "net.h"
 #include "policy/policy.h"
+#include "proof_verifier.h"
 #include "rpc/server.h"
 #include "rpc/register.h"
 #include "script/standard.h"
@@ -173,7 +174,6 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 
 void Interrupt(boost::thread_group& threadGroup)
@@ -231,7 +231,10 @@ void Shutdown()
         pcoinsdbview = NULL;
         delete pblocktree;
         pblocktree = NULL;
+        delete pdepositdb;
+        pdepositdb = NULL;
     }
+    FlushDrivechainCaches();
 #ifdef ENABLE_WALLET
     if (pwalletMain)
         pwalletMain->Flush(true);
@@ -245,6 +248,8 @@ void Shutdown()
     }
 #endif
 
+    UnregisterDepositPayoutRefresher();
+
 #ifndef WIN32
     try {
         fs::remove(GetPidFile());
@@ -346,6 +351,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-debuglogfile=<file>", strprintf(_("Specify location of debug log file. Relative paths will be prefixed by a net-specific datadir location. (default: %s)"), DEFAULT_DEBUGLOGFILE));
     strUsage += HelpMessageOpt("-exportdir=<dir>", _("Specify directory to be used when exporting data"));
     strUsage += HelpMessageOpt("-ibdskiptxverification", strprintf(_("Skip transaction verification during initial block download up to the last checkpoint height. Incompatible with flags that disable checkpoints. (default = %u)"), DEFAULT_IBD_SKIP_TX_VERIFICATION));
+    strUsage += HelpMessageOpt("-importthreads=<n>", strprintf(_("Set the number of threads reading block files during -reindex and -loadblock (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+        -GetNumCores(), MAX_IMPORT_THREADS, DEFAULT_IMPORT_THREADS));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
@@ -452,7 +459,7 @@ std::string HelpMessage(HelpMessageMode mode)
                 "-fundingstream=streamId:startHeight:endHeight:comma_delimited_addresses",
                 "Use given addresses for block subsidy share paid to the funding stream with id <streamId> (regtest-only)");
     }
-    std::string debugCategories = "addrman, alert, bench, coindb, db, http, libevent, lock, mempool, mempoolrej, net, partitioncheck, pow, proxy, prune, "
+    std::string debugCategories = "addrman, alert, bench, coindb, db, drivechain, http, libevent, lock, mempool, mempoolrej, net, partitioncheck, pow, proxy, prune, "
                              "rand, receiveunsafe, reindex, rpc, selectcoins, tor, valuepool, zmq, zrpc, zrpcunsafe (implies zrpc)"; // Don't translate these
     strUsage += HelpMessageOpt("-debug=<category>", strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + ". " +
         _("If <category> is not supplied or if <category> = 1, output all debugging information.") + " " + _("<category> can be:") + " " + debugCategories + ". " +
@@ -467,7 +474,7 @@ std::string HelpMessage(HelpMessageMode mode)
     {
         strUsage += HelpMessageOpt("-clockoffset=<n>", "Applies offset of <n> seconds to the actual time. Incompatible with -mocktime (default: 0)");
         strUsage += HelpMessageOpt("-mocktime=<n>", "Replace actual time with <n> seconds since epoch. Incompatible with -clockoffset (default: 0)");
-        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit total size of signature and bundle caches to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit total size of signature, JoinSplit and bundle caches to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
         strUsage += HelpMessageOpt("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Transactions must have at least this fee rate (in %s per 1000 bytes) for relaying, mining and transaction creation (default: %s). This is not the only fee constraint."),
@@ -491,6 +498,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageGroup(_("Block creation options:"));
     strUsage += HelpMessageOpt("-blockmaxsize=<n>", strprintf(_("Set maximum block size in bytes (default: %d)"), DEFAULT_BLOCK_MAX_SIZE));
     strUsage += HelpMessageOpt("-blockunpaidactionlimit=<n>", strprintf(_("Set the limit on unpaid actions that will be accepted in a block for transactions paying less than the ZIP 317 fee (default: %d)"), DEFAULT_BLOCK_UNPAID_ACTION_LIMIT));
+    strUsage += HelpMessageOpt("-incrementaltemplates", strprintf(_("Build block templates on an unchanged tip from the previous template's transactions and the mempool changes since (default: %u)"), DEFAULT_INCREMENTAL_TEMPLATES));
     if (GetBoolArg("-help-debug", false))
         strUsage += HelpMessageOpt("-blockversion=<n>", strprintf("Override block version to test forking scenarios (default: %d)", (int)CBlock::CURRENT_VERSION));
 
@@ -510,6 +518,13 @@ std::string HelpMessage(HelpMessageMode mode)
             ));
 #endif
 
+    strUsage += HelpMessageGroup(_("Drivechain options:"));
+    strUsage += HelpMessageOpt("-bmmcachesize=<n>", strprintf(_("Limit the cache of sidechain blocks with verified BMM to <n> MiB (default: %u)"), DEFAULT_BMM_CACHE_SIZE));
+    strUsage += HelpMessageOpt("-mainchainpollinterval=<n>", strprintf(_("Number of seconds between checks for a new mainchain tip (default: %u)"), DEFAULT_MAINCHAIN_POLL_INTERVAL));
+    strUsage += HelpMessageOpt("-mainchainrpchost=<ip>", strprintf(_("Send mainchain JSON-RPC requests to <ip> (default: %s)"), DEFAULT_MAINCHAIN_RPC_HOST));
+    strUsage += HelpMessageOpt("-mainchainrpcport=<port>", strprintf(_("Send mainchain JSON-RPC requests to <port> (default: %u)"), DEFAULT_MAINCHAIN_RPC_PORT));
+    strUsage += HelpMessageOpt("-mainchainrpcbatchsize=<n>", strprintf(_("Maximum number of calls sent to the mainchain node in one JSON-RPC batch request (default: %u)"), DEFAULT_MAINCHAIN_RPC_BATCH_SIZE));
+
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
     strUsage += HelpMessageOpt("-rest", strprintf(_("Accept public REST requests (default: %u)"), DEFAULT_REST_ENABLE));
@@ -749,33 +764,27 @@ void ThreadImport(std::vector<fs::path> vImportFiles, const CChainParams& chainp
     RenameThread("zcash-loadblk");
     CImportingNow imp;
 
+    int nImportThreads = GetArg("-importthreads", DEFAULT_IMPORT_THREADS);
+    if (nImportThreads <= 0)
+        nImportThreads += GetNumCores();
+    nImportThreads = std::max(1, std::min(nImportThreads, MAX_IMPORT_THREADS));
+
     // -reindex
     if (fReindex) {
-        nSizeReindexed = 0;  // will be modified inside LoadExternalBlockFile
-        // Find the summary size of all block files first
-        int nFile = 0;
+        nSizeReindexed = 0;  // will be modified inside ImportBlockFiles
+        // Find the block files and their summary size first
+        std::vector<fs::path> vBlockFiles;
         size_t fullSize = 0;
         while (true) {
-            CDiskBlockPos pos(nFile, 0);
+            CDiskBlockPos pos(vBlockFiles.size(), 0);
             fs::path blkFile = GetBlockPosFilename(pos, "blk");
             if (!fs::exists(blkFile))
                 break; // No block files left to reindex
-            nFile++;
             fullSize += fs::file_size(blkFile);
+            vBlockFiles.push_back(blkFile);
         }
         nFullSizeToReindex = std::max<size_t>(1, fullSize);
-        nFile = 0;
-        while (true) {
-            CDiskBlockPos pos(nFile, 0);
-            if (!fs::exists(GetBlockPosFilename(pos, "blk")))
-                break; // No block files left to reindex
-            FILE *file = OpenBlockFile(pos, true);
-            if (!file)
-                break; // This error is logged in OpenBlockFile
-            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
-            LoadExternalBlockFile(chainparams, file, &pos);
-            nFile++;
-        }
+        ImportBlockFiles(chainparams, vBlockFiles, true, nImportThreads);
         pblocktree->WriteReindexing(false);
         fReindex = false;
         nSizeReindexed = 0;
@@ -800,15 +809,8 @@ void ThreadImport(std::vector<fs::path> vImportFiles, const CChainParams& chainp
     }
 
     // -loadblock=
-    for (const fs::path& path : vImportFiles) {
-        FILE *file = fsbridge::fopen(path, "rb");
-        if (file) {
-            LogPrintf("Importing blocks file %s...\n", path.string());
-            LoadExternalBlockFile(chainparams, file);
-        } else {
-            LogPrintf("Warning: Could not open blocks file %s\n", path.string());
-        }
-    }
+    if (!vImportFiles.empty())
+        ImportBlockFiles(chainparams, vImportFiles, false, nImportThreads);
 
     // scan for better chains in the block chain database, that are not yet connected in the active best chain
     CValidationState state;
@@ -1229,6 +1231,22 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     fAlerts = GetBoolArg("-alerts", DEFAULT_ALERTS);
 
+    int64_t nBatchSize = GetArg("-mainchainrpcbatchsize", DEFAULT_MAINCHAIN_RPC_BATCH_SIZE);
+    if (nBatchSize < 1 || nBatchSize > std::numeric_limits<int>::max()) {
+        return InitError(strprintf(_("Invalid value for -mainchainrpcbatchsize=<n>: %d"), nBatchSize));
+    }
+    nMainchainRPCBatchSize = nBatchSize;
+
+    if (GetArg("-mainchainpollinterval", DEFAULT_MAINCHAIN_POLL_INTERVAL) < 1) {
+        return InitError(_("-mainchainpollinterval must be at least 1 second."));
+    }
+
+    int64_t nMainchainPort = GetArg("-mainchainrpcport", DEFAULT_MAINCHAIN_RPC_PORT);
+    if (nMainchainPort < 1 || nMainchainPort > 65535) {
+        return InitError(strprintf(_("Invalid port in -mainchainrpcport=<port>: %d"), nMainchainPort));
+    }
+    SetMainchainRPCEndpoint(GetArg("-mainchainrpchost", DEFAULT_MAINCHAIN_RPC_HOST), nMainchainPort);
+
     // Option to startup with mocktime set (used for regression testing);
     // a mocktime of 0 (the default) selects the system clock.
     int64_t nMockTime = GetArg("-mocktime", 0);
@@ -1446,9 +1464,16 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (nMaxCacheSize <= 0) {
         return InitError(strprintf(_("-maxsigcachesize must be at least 1")));
     }
-    InitSignatureCache(nMaxCacheSize / 2);
+    InitSignatureCache(nMaxCacheSize * 3 / 8);
+    InitJoinSplitCache(nMaxCacheSize / 8);
     bundlecache::init(nMaxCacheSize / 4);
 
+    int64_t nBMMCacheSize = GetArg("-bmmcachesize", DEFAULT_BMM_CACHE_SIZE);
+    if (nBMMCacheSize < 1) {
+        return InitError(_("-bmmcachesize must be at least 1"));
+    }
+    InitBMMCache(nBMMCacheSize * ((size_t) 1 << 20));
+
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
@@ -1661,6 +1686,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     // ********************************************************* Step 7: load block chain
 
+    // Load the mainchain block and BMM caches before any block is validated,
+    // and append new entries to them periodically.
+    ReadMainBlockCache();
+    ReadBMMCache();
+    scheduler.scheduleEvery(&FlushDrivechainCaches, DRIVECHAIN_CACHE_FLUSH_INTERVAL);
+
     fReindex = GetBoolArg("-reindex", false);
     bool fReindexChainState = GetBoolArg("-reindex-chainstate", false);
 
@@ -1683,11 +1714,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         nBlockTreeDBCache = nTotalCache * 3 / 4;
     }
     nTotalCache -= nBlockTreeDBCache;
+    int64_t nDepositDBCache = std::min(nTotalCache / 8, (int64_t)1 << 20); // deposit db is small, 1 MiB is plenty
+    nTotalCache -= nDepositDBCache;
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1fMiB for drivechain deposit database\n", nDepositDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
 
@@ -1708,8 +1742,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
+                delete pdepositdb;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
+                pdepositdb = new CDepositDB(nDepositDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
@@ -1799,6 +1835,11 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                if (!ReconcileDrivechainDeposits(chainparams)) {
+                    strLoadError = _("Error reconciling the drivechain deposit database with the chainstate");
+                    break;
+                }
+
                 if (fExperimentalLightWalletd) {
                     LOCK(cs_main);
 
@@ -2068,5 +2109,13 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     	LogPrintf("Failed to connect to bitcoin-patched!");
 	}
 
+    // Follow the mainchain tip in the background so that block validation
+    // and mining only ever read the local mainchain block cache, and keep the
+    // deposits to pay out in the next block ready for the miner.
+    RegisterDepositPayoutRefresher(scheduler);
+    threadGroup.create_thread(
+        boost::bind(&TraceThread<void (*)()>, "mainchain", &ThreadMainchainFollower)
+    );
+
     return !fRequestShutdown;
 }
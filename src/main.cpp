@@ -11,7 +11,7 @@
 #include "arith_uint256.h"
 #include "chainparams.h"
 #include "checkpoints.h"
-#include "checkqueue.h"
+#include "checkpool.h"
 #include "consensus/consensus.h"
 #include "consensus/funding.h"
 #include "consensus/merkle.h"
@@ -22,6 +22,7 @@
 #include "experimental_features.h"
 #include "init.h"
 #include "key_io.h"
+#include "memusage.h"
 #include "merkleblock.h"
 #include "metrics.h"
 #include "net.h"
@@ -42,6 +43,8 @@
 
 #include <algorithm>
 #include <atomic>
+#include <deque>
+#include <future>
 #include <sstream>
 #include <variant>
 
@@ -79,6 +82,7 @@ using namespace std;
 RecursiveMutex cs_main;
 
 BlockMap mapBlockIndex;
+static CBlockIndexPool blockIndexPool;
 CChain chainActive;
 CBlockIndex *pindexBestHeader = NULL;
 static std::atomic<int64_t> nTimeBestReceived(0); // Used only to inform the wallet of when we last received a block
@@ -87,6 +91,8 @@ std::condition_variable g_best_block_cv;
 uint256 g_best_block;
 int g_best_block_height;
 int nScriptCheckThreads = 0;
+/** Runs script checks, Sprout proof checks and pre-checks of relayed transactions. */
+static CCheckPool checkpool(MAX_SCRIPTCHECK_THREADS);
 std::atomic_bool fImporting(false);
 std::atomic_bool fReindex(false);
 bool fTxIndex = false;
@@ -656,6 +662,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewDB *pcoinsdbview = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1408,6 +1415,62 @@ bool CheckTransaction(const CTransaction& tx, CValidationState &state,
     }
 }
 
+namespace {
+
+/**
+ * Closure representing the verification of one Sprout JoinSplit proof
+ * Note that this stores references to the transaction
+ */
+class CSproutProofCheck
+{
+private:
+    const JSDescription *pjsdesc;
+    const ed25519::VerificationKey *pJoinSplitPubKey;
+    bool cacheStore;
+
+public:
+    CSproutProofCheck(): pjsdesc(nullptr), pJoinSplitPubKey(nullptr), cacheStore(false) {}
+    CSproutProofCheck(const JSDescription& jsdescIn, const ed25519::VerificationKey& joinSplitPubKeyIn, bool cacheStoreIn) :
+        pjsdesc(&jsdescIn), pJoinSplitPubKey(&joinSplitPubKeyIn), cacheStore(cacheStoreIn) {}
+
+    bool operator()()
+    {
+        auto verifier = ProofVerifier::Strict(cacheStore);
+        return verifier.VerifySprout(*pjsdesc, *pJoinSplitPubKey);
+    }
+
+    void swap(CSproutProofCheck& check)
+    {
+        std::swap(pjsdesc, check.pjsdesc);
+        std::swap(pJoinSplitPubKey, check.pJoinSplitPubKey);
+        std::swap(cacheStore, check.cacheStore);
+    }
+};
+
+} // anon namespace
+
+bool VerifySproutProofs(const std::vector<CTransaction>& vtx, bool cacheStore)
+{
+    std::vector<CSproutProofCheck> vChecks;
+    for (const CTransaction& tx : vtx) {
+        for (const JSDescription& jsdesc : tx.vJoinSplit)
+            vChecks.emplace_back(jsdesc, tx.joinSplitPubKey, cacheStore);
+    }
+    if (vChecks.empty())
+        return true;
+
+    if (nScriptCheckThreads && vChecks.size() > 1) {
+        CCheckPoolControl control(&checkpool);
+        control.Add(vChecks);
+        return control.Wait();
+    }
+    for (CSproutProofCheck& check : vChecks) {
+        if (!check())
+            return false;
+    }
+    return true;
+}
+
 /**
  * Basic checks that don't depend on any context.
  *
@@ -1744,6 +1807,49 @@ std::string FormatStateMessage(const CValidationState &state)
         state.GetRejectCode());
 }
 
+/**
+ * The fee checks AcceptToMemoryPool makes of a transaction it is about to
+ * accept as entry: the minimum relay fee, unless fLimitFree is false, and the
+ * ZIP 317 unpaid action limit. nModifiedFees includes any fee delta from
+ * PrioritiseTransaction.
+ */
+static bool CheckRelayFees(const CTxMemPoolEntry& entry, CAmount nModifiedFees, bool fLimitFree, CValidationState& state)
+{
+    const CTransaction& tx = entry.GetTx();
+    const CAmount nFees = entry.GetFee();
+    const unsigned int nSize = entry.GetTxSize();
+
+    // No transactions are allowed with modified fee below the minimum relay fee,
+    // except from disconnected blocks. The minimum relay fee will never be more
+    // than LEGACY_DEFAULT_FEE zatoshis.
+    CAmount minRelayFee = ::minRelayTxFee.GetFeeForRelay(nSize);
+    if (fLimitFree && nModifiedFees < minRelayFee) {
+        LogPrint("mempool",
+                "Not accepting transaction with txid %s, size %d bytes, effective fee %d " + MINOR_CURRENCY_UNIT +
+                ", and fee delta %d " + MINOR_CURRENCY_UNIT + " to the mempool due to insufficient fee. " +
+                " The minimum acceptance/relay fee for this transaction is %d " + MINOR_CURRENCY_UNIT,
+                tx.GetHash().ToString(), nSize, nModifiedFees, nModifiedFees - nFees, minRelayFee);
+        return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "min relay fee not met");
+    }
+
+    // Transactions with more than `-txunpaidactionlimit` unpaid actions (calculated
+    // using the modified fee) are not accepted to the mempool or relayed.
+    // <https://zips.z.cash/zip-0317#transaction-relaying>
+    size_t nUnpaidActionCount = entry.GetUnpaidActionCount();
+    if (nUnpaidActionCount > nTxUnpaidActionLimit) {
+        LogPrint("mempool",
+                "Not accepting transaction with txid %s, size %d bytes, effective fee %d " + MINOR_CURRENCY_UNIT +
+                ", and fee delta %d " + MINOR_CURRENCY_UNIT + " to the mempool because it has %d unpaid actions"
+                ", which is over the limit of %d. The conventional fee for this transaction is %d " + MINOR_CURRENCY_UNIT,
+                tx.GetHash().ToString(), nSize, nModifiedFees, nModifiedFees - nFees, nUnpaidActionCount,
+                nTxUnpaidActionLimit, tx.GetConventionalFee());
+        return state.DoS(0, false, REJECT_INSUFFICIENTFEE,
+                         strprintf("tx unpaid action limit exceeded: %d action(s) exceeds limit of %d", nUnpaidActionCount, nTxUnpaidActionLimit));
+    }
+
+    return true;
+}
+
 bool AcceptToMemoryPool(
         const CChainParams& chainparams,
         CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
@@ -1765,7 +1871,7 @@ bool AcceptToMemoryPool(
         return false;
     }
 
-    auto verifier = ProofVerifier::Strict();
+    auto verifier = ProofVerifier::Strict(true);
     if (!CheckTransaction(tx, state, verifier))
         return false;
 
@@ -1896,35 +2002,9 @@ bool AcceptToMemoryPool(
         // to consensusBranchId, but if the entry gets added to the mempool, then
         // it has passed ContextualCheckInputs and therefore this is correct.
         CTxMemPoolEntry entry(tx, nFees, GetTime(), chainActive.Height(), pool.HasNoInputsOf(tx), fSpendsCoinbase, nSigOps, consensusBranchId);
-        unsigned int nSize = entry.GetTxSize();
-
-        // No transactions are allowed with modified fee below the minimum relay fee,
-        // except from disconnected blocks. The minimum relay fee will never be more
-        // than LEGACY_DEFAULT_FEE zatoshis.
-        CAmount minRelayFee = ::minRelayTxFee.GetFeeForRelay(nSize);
-        if (fLimitFree && nModifiedFees < minRelayFee) {
-            LogPrint("mempool",
-                    "Not accepting transaction with txid %s, size %d bytes, effective fee %d " + MINOR_CURRENCY_UNIT +
-                    ", and fee delta %d " + MINOR_CURRENCY_UNIT + " to the mempool due to insufficient fee. " +
-                    " The minimum acceptance/relay fee for this transaction is %d " + MINOR_CURRENCY_UNIT,
-                    tx.GetHash().ToString(), nSize, nModifiedFees, nModifiedFees - nFees, minRelayFee);
-            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "min relay fee not met");
-        }
-
-        // Transactions with more than `-txunpaidactionlimit` unpaid actions (calculated
-        // using the modified fee) are not accepted to the mempool or relayed.
-        // <https://zips.z.cash/zip-0317#transaction-relaying>
-        size_t nUnpaidActionCount = entry.GetUnpaidActionCount();
-        if (nUnpaidActionCount > nTxUnpaidActionLimit) {
-            LogPrint("mempool",
-                    "Not accepting transaction with txid %s, size %d bytes, effective fee %d " + MINOR_CURRENCY_UNIT +
-                    ", and fee delta %d " + MINOR_CURRENCY_UNIT + " to the mempool because it has %d unpaid actions"
-                    ", which is over the limit of %d. The conventional fee for this transaction is %d " + MINOR_CURRENCY_UNIT,
-                    tx.GetHash().ToString(), nSize, nModifiedFees, nModifiedFees - nFees, nUnpaidActionCount,
-                    nTxUnpaidActionLimit, tx.GetConventionalFee());
-            return state.DoS(0, false, REJECT_INSUFFICIENTFEE,
-                             strprintf("tx unpaid action limit exceeded: %d action(s) exceeds limit of %d", nUnpaidActionCount, nTxUnpaidActionLimit));
-        }
+
+        if (!CheckRelayFees(entry, nModifiedFees, fLimitFree, state))
+            return false;
 
         if (fRejectAbsurdFee && nFees > maxTxFee) {
             return state.Invalid(false,
@@ -2033,6 +2113,152 @@ bool AcceptToMemoryPool(
     return true;
 }
 
+namespace {
+
+/**
+ * Closure verifying the transparent signatures, the Sprout JoinSplit proofs and
+ * the Sapling and Orchard bundle authorizations of one transaction, storing
+ * what is valid in the signature, JoinSplit and bundle validity caches.
+ */
+class CTxPreCheck
+{
+private:
+    const CTransaction *ptx;
+    std::vector<CTxOut> vPrevOut;
+    uint32_t consensusBranchId;
+    const std::atomic<bool> *pfStop;
+
+public:
+    CTxPreCheck(): ptx(nullptr), consensusBranchId(0), pfStop(nullptr) {}
+    CTxPreCheck(const CTransaction& txIn, std::vector<CTxOut>&& vPrevOutIn, uint32_t consensusBranchIdIn, const std::atomic<bool>* pfStopIn) :
+        ptx(&txIn), vPrevOut(std::move(vPrevOutIn)), consensusBranchId(consensusBranchIdIn), pfStop(pfStopIn) {}
+
+    bool operator()()
+    {
+        if (pfStop && *pfStop)
+            return true;
+
+        const CTransaction& tx = *ptx;
+        PrecomputedTransactionData txdata(tx, vPrevOut);
+
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
+            CachingTransactionSignatureChecker checker(ptx, txdata, i, vPrevOut[i].nValue, true);
+            if (!VerifyScript(tx.vin[i].scriptSig, vPrevOut[i].scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, checker, consensusBranchId))
+                return false;
+        }
+
+        auto verifier = ProofVerifier::Strict(true);
+        for (const JSDescription& jsdesc : tx.vJoinSplit) {
+            if (!verifier.VerifySprout(jsdesc, tx.joinSplitPubKey))
+                return false;
+        }
+
+        if (!tx.GetSaplingBundle().IsPresent() && !tx.GetOrchardBundle().IsPresent())
+            return true;
+
+        uint256 dataToBeSigned;
+        try {
+            dataToBeSigned = SignatureHash(CScript(), tx, NOT_AN_INPUT, SIGHASH_ALL, 0, consensusBranchId, txdata);
+        } catch (std::logic_error ex) {
+            return false;
+        }
+
+        if (tx.GetSaplingBundle().IsPresent()) {
+            auto saplingAuth = sapling::init_batch_validator(true);
+            if (!tx.GetSaplingBundle().QueueAuthValidation(*saplingAuth, dataToBeSigned) || !saplingAuth->validate())
+                return false;
+        }
+        if (tx.GetOrchardBundle().IsPresent()) {
+            auto orchardAuth = orchard::init_batch_validator(true);
+            tx.GetOrchardBundle().QueueAuthValidation(*orchardAuth, dataToBeSigned);
+            if (!orchardAuth->validate())
+                return false;
+        }
+        return true;
+    }
+
+    void swap(CTxPreCheck& check)
+    {
+        std::swap(ptx, check.ptx);
+        vPrevOut.swap(check.vPrevOut);
+        std::swap(consensusBranchId, check.consensusBranchId);
+        std::swap(pfStop, check.pfStop);
+    }
+};
+
+} // anon namespace
+
+void PreCheckTransactions(const CChainParams& chainparams, CTxMemPool& pool, const std::vector<CTransaction>& vtx,
+                          const std::atomic<bool>* pfStop)
+{
+    AssertLockNotHeld(cs_main);
+
+    // Only transactions that pass the checks AcceptToMemoryPool makes before
+    // verifying anything are worth verifying ahead of it. Anything else would
+    // let a peer have us verify signatures and proofs for free.
+    std::vector<const CTransaction*> vCandidate;
+    for (const CTransaction& tx : vtx) {
+        CValidationState state;
+        auto verifier = ProofVerifier::Disabled();
+        if (!tx.IsCoinBase() && CheckTransaction(tx, state, verifier))
+            vCandidate.push_back(&tx);
+    }
+
+    // Collect the outputs spent by each transaction. Only this needs the
+    // locks; transactions spending outputs that aren't available yet are
+    // left to AcceptToMemoryPool.
+    std::vector<CTxPreCheck> vChecks;
+    {
+        LOCK2(cs_main, pool.cs);
+        int nextBlockHeight = chainActive.Height() + 1;
+        auto consensusBranchId = CurrentEpochBranchId(nextBlockHeight, chainparams.GetConsensus());
+
+        CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
+        CCoinsViewCache view(&viewMemPool);
+        for (const CTransaction* ptx : vCandidate) {
+            const CTransaction& tx = *ptx;
+            if (pool.exists(tx.GetHash()) || pool.IsRecentlyEvicted(tx.GetHash()))
+                continue;
+
+            std::string reason;
+            if (IsExpiringSoonTx(tx, nextBlockHeight) ||
+                (chainparams.RequireStandard() && !IsStandardTx(tx, reason, chainparams, nextBlockHeight)))
+                continue;
+
+            std::vector<CTxOut> vPrevOut;
+            for (const CTxIn& txin : tx.vin) {
+                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
+                if (!coins || !coins->IsAvailable(txin.prevout.n))
+                    break;
+                vPrevOut.push_back(coins->vout[txin.prevout.n]);
+            }
+            if (vPrevOut.size() != tx.vin.size())
+                continue;
+
+            // The fee checks only read the transaction and fee of the entry
+            CAmount nFees = view.GetValueIn(tx) - tx.GetValueOut();
+            CAmount nModifiedFees = nFees;
+            pool.ApplyDelta(tx.GetHash(), nModifiedFees);
+            CTxMemPoolEntry entry(tx, nFees, 0, nextBlockHeight - 1, false, false, 0, consensusBranchId);
+            CValidationState state;
+            if (!CheckRelayFees(entry, nModifiedFees, true, state))
+                continue;
+
+            vChecks.emplace_back(tx, std::move(vPrevOut), consensusBranchId, pfStop);
+        }
+    }
+
+    // The result doesn't matter, only what ended up in the caches.
+    if (nScriptCheckThreads && vChecks.size() > 1) {
+        CCheckPoolControl control(&checkpool);
+        control.Add(vChecks);
+        control.Wait();
+    } else {
+        for (CTxPreCheck& check : vChecks)
+            check();
+    }
+}
+
 bool GetTimestampIndex(unsigned int high, unsigned int low, bool fActiveOnly,
     std::vector<std::pair<uint256, unsigned int> > &hashes)
 {
@@ -2966,6 +3192,10 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
             return DISCONNECT_FAILED;
         }
     }
+    if (updateIndices && !DisconnectDrivechainDeposits(block.vtx[0], block.hashPrevBlock)) {
+        AbortNode(state, "Failed to write drivechain deposit index");
+        return DISCONNECT_FAILED;
+    }
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
@@ -2994,11 +3224,9 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
-
 void ThreadScriptCheck() {
     RenameThread("zc-scriptcheck");
-    scriptcheckqueue.Thread();
+    checkpool.Thread();
 }
 
 static int64_t nTimeVerify = 0;
@@ -3022,6 +3250,76 @@ static bool ShouldCheckTransactions(const CChainParams& chainparams, const CBloc
              && Checkpoints::IsAncestorOfLastCheckpoint(chainparams.Checkpoints(), pindex));
 }
 
+/** Number of bundles validated as one batch in the background by ConnectBlock */
+static const size_t BUNDLE_VALIDATION_CHUNK_SIZE = 16;
+
+namespace {
+
+/** A batch of Sapling or Orchard bundles to validate on the check pool */
+template <typename BatchValidator>
+class CBundleBatchCheck
+{
+private:
+    std::optional<rust::Box<BatchValidator>> batch;
+
+public:
+    CBundleBatchCheck() {}
+    explicit CBundleBatchCheck(rust::Box<BatchValidator> batchIn) : batch(std::move(batchIn)) {}
+
+    bool operator()() { return batch.value()->validate(); }
+
+    void swap(CBundleBatchCheck& check) { batch.swap(check.batch); }
+};
+
+/**
+ * Validates the Sapling or Orchard bundles of a block while ConnectBlock goes
+ * on with the rest of the block. Bundles are queued into the batch validator
+ * as usual; every BUNDLE_VALIDATION_CHUNK_SIZE bundles, the batch is handed to
+ * the check pool and a fresh batch validator takes its place. Without a pool,
+ * the bundles are validated as one batch at the end.
+ */
+template <typename BatchValidator>
+class CBundleValidationPipeline
+{
+private:
+    std::optional<rust::Box<BatchValidator>>& auth;
+    rust::Box<BatchValidator> (*initBatchValidator)(bool);
+    bool fCacheResults;
+    const bool fParallel;
+    CCheckPoolControl control;
+    size_t nQueued = 0;
+
+public:
+    CBundleValidationPipeline(
+        std::optional<rust::Box<BatchValidator>>& authIn,
+        rust::Box<BatchValidator> (*initBatchValidatorIn)(bool),
+        bool fCacheResultsIn,
+        CCheckPool* pool) :
+        auth(authIn), initBatchValidator(initBatchValidatorIn), fCacheResults(fCacheResultsIn),
+        fParallel(pool != NULL), control(pool) {}
+
+    /** Call after a bundle was queued into the batch validator. */
+    void Queued()
+    {
+        if (!fParallel || !auth.has_value() || ++nQueued % BUNDLE_VALIDATION_CHUNK_SIZE != 0)
+            return;
+
+        std::vector<CBundleBatchCheck<BatchValidator>> vChecks;
+        vChecks.emplace_back(std::move(auth.value()));
+        control.Add(vChecks);
+        auth.emplace(initBatchValidator(fCacheResults));
+    }
+
+    /** Validate the last bundles, and wait for the batches on the pool. */
+    bool Validate()
+    {
+        bool fValid = !auth.has_value() || auth.value()->validate();
+        return control.Wait() && fValid;
+    }
+};
+
+} // anon namespace
+
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
                   CCoinsViewCache& view, const CChainParams& chainparams,
                   bool fJustCheck, CheckAs blockChecks)
@@ -3060,13 +3358,16 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     bool fCacheResults = fJustCheck && (blockChecks != CheckAs::SlowBenchmark);
 
     // proof verification is expensive, disable if possible
-    auto verifier = fExpensiveChecks ? ProofVerifier::Strict() : ProofVerifier::Disabled();
+    auto verifier = fExpensiveChecks ? ProofVerifier::Strict(fCacheResults) : ProofVerifier::Disabled();
 
     // Disable Sapling and Orchard batch validation if possible.
     std::optional<rust::Box<sapling::BatchValidator>> saplingAuth = fExpensiveChecks ?
         std::optional(sapling::init_batch_validator(fCacheResults)) : std::nullopt;
     std::optional<rust::Box<orchard::BatchValidator>> orchardAuth = fExpensiveChecks ?
         std::optional(orchard::init_batch_validator(fCacheResults)) : std::nullopt;
+    CCheckPool* pbundlepool = fExpensiveChecks && nScriptCheckThreads ? &checkpool : NULL;
+    CBundleValidationPipeline<sapling::BatchValidator> saplingPipeline(saplingAuth, sapling::init_batch_validator, fCacheResults, pbundlepool);
+    CBundleValidationPipeline<orchard::BatchValidator> orchardPipeline(orchardAuth, orchard::init_batch_validator, fCacheResults, pbundlepool);
 
     // If in initial block download, and this block is an ancestor of a checkpoint,
     // and -ibdskiptxverification is set, disable all transaction checks.
@@ -3155,7 +3456,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     CBlockUndo blockundo;
 
-    CCheckQueueControl<CScriptCheck> control(fExpensiveChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    CCheckPoolControl control(fExpensiveChecks && nScriptCheckThreads ? &checkpool : NULL);
 
     int64_t nTimeStart = GetTimeMicros();
     std::vector<uint256> vOrphanErase;
@@ -3375,6 +3676,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 tx.GetHash().ToString(),
                 FormatStateMessage(state));
         }
+        if (tx.GetSaplingBundle().IsPresent())
+            saplingPipeline.Queued();
+        if (tx.GetOrchardBundle().IsPresent())
+            orchardPipeline.Queued();
 
         // insightexplorer
         // https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-7ec3c68a81efff79b6ca22ac1f1eabbaR2656
@@ -3656,14 +3961,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     }
 
     // Ensure Sapling authorizations are valid (if we are checking them)
-    if (saplingAuth.has_value() && !saplingAuth.value()->validate()) {
+    if (!saplingPipeline.Validate()) {
         return state.DoS(100,
             error("%s: a Sapling bundle within the block is invalid", __func__),
             REJECT_INVALID, "bad-sapling-bundle-authorization");
     }
 
     // Ensure Orchard signatures are valid (if we are checking them)
-    if (orchardAuth.has_value() && !orchardAuth.value()->validate()) {
+    if (!orchardPipeline.Validate()) {
         return state.DoS(100,
             error("%s: an Orchard bundle within the block is invalid", __func__),
             REJECT_INVALID, "bad-orchard-bundle-authorization");
@@ -3711,6 +4016,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->WriteTxIndex(vPos))
             return AbortNode(state, "Failed to write transaction index");
 
+    if (!ConnectDrivechainDeposits(block.vtx[0], pindex->GetBlockHash()))
+        return AbortNode(state, "Failed to write drivechain deposit index");
+
     // START insightexplorer
     if (fAddressIndex) {
         if (!pblocktree->WriteAddressIndex(addressIndex)) {
@@ -4281,11 +4589,102 @@ static void PruneBlockIndexCandidates() {
     assert(!setBlockIndexCandidates.empty());
 }
 
+namespace {
+
+/**
+ * Reads the next block to be connected from disk on a helper thread while
+ * the current one is being connected. The helper thread also looks up the
+ * coins, anchors and nullifiers that the block will need in the coins
+ * database, so that they are in the database caches by the time ConnectBlock
+ * asks pcoinsTip for them.
+ */
+class CBlockPrefetch
+{
+private:
+    const CBlockIndex* pindex = nullptr;
+    std::future<std::shared_ptr<const CBlock>> result;
+
+    static void WarmCoinsDB(const CCoinsView* pdb, const CBlock& block)
+    {
+        std::set<uint256> setSproutAnchors, setSaplingAnchors;
+        for (const CTransaction& tx : block.vtx) {
+            if (!tx.IsCoinBase()) {
+                for (const CTxIn& txin : tx.vin)
+                    pdb->HaveCoins(txin.prevout.hash);
+            }
+            for (const JSDescription& jsdesc : tx.vJoinSplit) {
+                for (const uint256& nf : jsdesc.nullifiers)
+                    pdb->GetNullifier(nf, SPROUT);
+                setSproutAnchors.insert(jsdesc.anchor);
+            }
+            for (const auto& spend : tx.GetSaplingSpends()) {
+                pdb->GetNullifier(uint256::FromRawBytes(spend.nullifier()), SAPLING);
+                setSaplingAnchors.insert(uint256::FromRawBytes(spend.anchor()));
+            }
+            for (const uint256& nf : tx.GetOrchardBundle().GetNullifiers())
+                pdb->GetNullifier(nf, ORCHARD);
+        }
+
+        // Anchors created by earlier JoinSplits of the block aren't in the
+        // database, and aren't looked up there either.
+        for (const uint256& rt : setSproutAnchors) {
+            SproutMerkleTree tree;
+            pdb->GetSproutAnchorAt(rt, tree);
+        }
+        for (const uint256& rt : setSaplingAnchors) {
+            SaplingMerkleTree tree;
+            pdb->GetSaplingAnchorAt(rt, tree);
+        }
+    }
+
+public:
+    /** Start reading the block of pindexIn, unless it's already being read. */
+    void Start(const CBlockIndex* pindexIn, const Consensus::Params& consensusParams)
+    {
+        AssertLockHeld(cs_main);
+        if (pindexIn == pindex || !(pindexIn->nStatus & BLOCK_HAVE_DATA))
+            return;
+
+        if (result.valid())
+            result.wait();
+        pindex = pindexIn;
+        const CDiskBlockPos pos = pindexIn->GetBlockPos();
+        const uint256 hash = pindexIn->GetBlockHash();
+        const CCoinsView* pdb = pcoinsdbview;
+        result = std::async(std::launch::async, [pos, hash, pdb, &consensusParams]() -> std::shared_ptr<const CBlock> {
+            auto pblock = std::make_shared<CBlock>();
+            if (!ReadBlockFromDisk(*pblock, pos, consensusParams) || pblock->GetHash() != hash)
+                return nullptr;
+            // Warming the caches is only an optimization; ConnectBlock
+            // reports any database error itself.
+            if (pdb) {
+                try {
+                    WarmCoinsDB(pdb, *pblock);
+                } catch (const std::exception& e) {
+                    LogPrint("coindb", "CBlockPrefetch: failed to warm the coins database cache: %s\n", e.what());
+                }
+            }
+            return pblock;
+        });
+    }
+
+    /** Returns the block read for pindexIn, or null if it wasn't read. */
+    std::shared_ptr<const CBlock> Take(const CBlockIndex* pindexIn)
+    {
+        if (pindexIn != pindex || !result.valid())
+            return nullptr;
+        pindex = nullptr;
+        return result.get();
+    }
+};
+
+} // anon namespace
+
 /**
  * Try to make some progress towards making pindexMostWork the active block.
  * pblock is either NULL or a pointer to a CBlock corresponding to pindexMostWork.
  */
-static bool ActivateBestChainStep(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexMostWork, const CBlock* pblock, bool& fInvalidFound)
+static bool ActivateBestChainStep(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexMostWork, const CBlock* pblock, bool& fInvalidFound, CBlockPrefetch& prefetch)
 {
     AssertLockHeld(cs_main);
     const CBlockIndex *pindexOldTip = chainActive.Tip();
@@ -4345,9 +4744,12 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
         for (CBlockIndex *pindexConnect : reverse_iterate(vpindexToConnect)) {
             int64_t nTime1 = GetTimeMicros();
             const CBlock* pconnectBlock;
+            std::shared_ptr<const CBlock> pprefetched;
             CBlock block;
             if (pblock && pindexConnect == pindexMostWork) {
                 pconnectBlock = pblock;
+            } else if ((pprefetched = prefetch.Take(pindexConnect))) {
+                pconnectBlock = pprefetched.get();
             } else {
                 // read the block to be connected from disk
                 if (!ReadBlockFromDisk(block, pindexConnect, chainparams.GetConsensus()))
@@ -4357,6 +4759,13 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
             int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
             LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
 
+            // Read the next block while this one is connected
+            if (pindexConnect->nHeight < pindexMostWork->nHeight) {
+                const CBlockIndex* pindexNext = pindexMostWork->GetAncestor(pindexConnect->nHeight + 1);
+                if (!(pblock && pindexNext == pindexMostWork))
+                    prefetch.Start(pindexNext, chainparams.GetConsensus());
+            }
+
             if (!ConnectTip(state, chainparams, pindexConnect, pconnectBlock)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
@@ -4432,6 +4841,7 @@ bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams,
 {
     CBlockIndex *pindexMostWork = NULL;
     CBlockIndex *pindexNewTip = NULL;
+    CBlockPrefetch prefetch;
     do {
         // Sleep briefly to allow other threads a chance at grabbing cs_main if
         // we are connecting a long chain of blocks and would otherwise hold the
@@ -4458,7 +4868,7 @@ bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams,
                 return true;
 
             bool fInvalidFound = false;
-            if (!ActivateBestChainStep(state, chainparams, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : NULL, fInvalidFound))
+            if (!ActivateBestChainStep(state, chainparams, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : NULL, fInvalidFound, prefetch))
                 return false;
 
             if (fInvalidFound) {
@@ -4583,8 +4993,8 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const Consensus::Params&
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockIndexPool.Allocate();
+    *pindexNew = CBlockIndex(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -5018,13 +5428,20 @@ bool CheckBlock(const CBlock& block,
     // skip all transaction checks if this flag is not set
     if (!fCheckTransactions) return true;
 
-    // Check transactions
+    // Check transactions. The JoinSplit proofs of all transactions are
+    // verified together afterwards, so that they can be spread across the
+    // check pool.
+    auto noProofs = ProofVerifier::Disabled();
     for (const CTransaction& tx : block.vtx)
-        if (!CheckTransaction(tx, state, verifier))
+        if (!CheckTransaction(tx, state, noProofs))
             return error("CheckBlock(): CheckTransaction of %s failed with %s",
                 tx.GetHash().ToString(),
                 FormatStateMessage(state));
 
+    if (verifier.PerformsVerification() && !VerifySproutProofs(block.vtx, verifier.CacheStore()))
+        return state.DoS(100, error("CheckBlock(): a joinsplit within the block does not verify"),
+                         REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+
     unsigned int nSigOps = 0;
     for (const CTransaction& tx : block.vtx)
     {
@@ -5559,19 +5976,25 @@ CBlockIndex * InsertBlockIndex(const uint256& hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex(): new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexPool.Allocate();
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
     return pindexNew;
 }
 
+size_t BlockIndexDynamicUsage()
+{
+    AssertLockHeld(cs_main);
+    return memusage::DynamicUsage(mapBlockIndex) + blockIndexPool.DynamicMemoryUsage();
+}
+
 bool static LoadBlockIndexDB(const CChainParams& chainparams)
 {
     if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex, chainparams))
         return false;
+    LogPrintf("%s: %u block index entries, %.1f MiB\n", __func__,
+        mapBlockIndex.size(), BlockIndexDynamicUsage() / 1048576.0);
 
     // Calculate nChainWork
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
@@ -6248,7 +6671,7 @@ bool RewindBlockIndex(const CChainParams& chainparams, bool& clearWitnessCaches)
         auto ret = mapBlockIndex.find(*pindex->phashBlock);
         if (ret != mapBlockIndex.end()) {
             mapBlockIndex.erase(ret);
-            delete pindex;
+            blockIndexPool.Free(pindex);
         }
     }
 
@@ -6271,6 +6694,85 @@ bool RewindBlockIndex(const CChainParams& chainparams, bool& clearWitnessCaches)
     return true;
 }
 
+// Point a deposit database that can't be reconciled at pindex, leaving the
+// payouts of the blocks up to it as they are
+static bool StartDrivechainDepositsAt(const CBlockIndex* pindex)
+{
+    if (!pdepositdb->WritePaid({}, pindex->GetBlockHash()))
+        return error("%s: failed to write deposit database", __func__);
+    SetDrivechainDepositTip(pindex->GetBlockHash());
+    return true;
+}
+
+bool ReconcileDrivechainDeposits(const CChainParams& chainparams)
+{
+    LOCK(cs_main);
+
+    if (!pdepositdb || chainActive.Tip() == NULL)
+        return true;
+
+    uint256 hashBest;
+    if (!pdepositdb->ReadBestBlock(hashBest))
+        return false;
+    if (hashBest == chainActive.Tip()->GetBlockHash()) {
+        SetDrivechainDepositTip(hashBest);
+        return true;
+    }
+
+    // A new deposit database has nothing to reconcile: ConnectBlock indexes
+    // the payouts of the blocks connected from now on, and those of older
+    // blocks are only indexed by -reindex. Scanning the whole chain for
+    // them here would hold up startup, and fail on a pruned node.
+    if (hashBest.IsNull()) {
+        LogPrintf("%s: new deposit database, starting it at block %s; use -reindex to index earlier deposit payouts\n",
+            __func__, chainActive.Tip()->GetBlockHash().ToString());
+        return StartDrivechainDepositsAt(chainActive.Tip());
+    }
+
+    BlockMap::iterator it = mapBlockIndex.find(hashBest);
+    if (it == mapBlockIndex.end())
+        return error("%s: deposit database is at unknown block %s", __func__, hashBest.ToString());
+
+    // Undo the payouts of blocks that are not in the active chain
+    const CBlockIndex* pindexFork = chainActive.FindFork(it->second);
+    int nDisconnected = 0;
+    for (const CBlockIndex* pindex = it->second; pindex != pindexFork; pindex = pindex->pprev) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
+            return error("%s: failed to read block %s", __func__, pindex->GetBlockHash().ToString());
+        if (!DisconnectDrivechainDeposits(block.vtx[0], block.hashPrevBlock))
+            return error("%s: failed to write deposit database", __func__);
+        nDisconnected++;
+    }
+
+    // The blocks undone above were connected after the last chainstate flush,
+    // too recently to be pruned, but those to apply may be long gone
+    if (fHavePruned) {
+        for (const CBlockIndex* pindex = chainActive.Next(pindexFork); pindex; pindex = chainActive.Next(pindex)) {
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA)) {
+                LogPrintf("%s: block %s was pruned, can't index the deposit payouts after block %s; use -reindex to index them\n",
+                    __func__, pindex->GetBlockHash().ToString(), pindexFork->GetBlockHash().ToString());
+                return StartDrivechainDepositsAt(chainActive.Tip());
+            }
+        }
+    }
+
+    // Apply the payouts of the active chain blocks it is missing
+    int nConnected = 0;
+    for (const CBlockIndex* pindex = chainActive.Next(pindexFork); pindex; pindex = chainActive.Next(pindex)) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
+            return error("%s: failed to read block %s", __func__, pindex->GetBlockHash().ToString());
+        if (!ConnectDrivechainDeposits(block.vtx[0], pindex->GetBlockHash()))
+            return error("%s: failed to write deposit database", __func__);
+        nConnected++;
+    }
+
+    LogPrintf("%s: undid the deposit payouts of %d blocks and applied those of %d blocks\n",
+        __func__, nDisconnected, nConnected);
+    return true;
+}
+
 void UnloadBlockIndex()
 {
     LOCK(cs_main);
@@ -6295,10 +6797,8 @@ void UnloadBlockIndex()
     mapNodeState.clear();
     recentRejects.reset(NULL);
 
-    for (BlockMap::value_type& entry : mapBlockIndex) {
-        delete entry.second;
-    }
     mapBlockIndex.clear();
+    blockIndexPool.Clear();
     fHavePruned = false;
 }
 
@@ -6372,10 +6872,85 @@ bool InitBlockIndex(const CChainParams& chainparams)
     return true;
 }
 
+// Map of disk positions for blocks with unknown parent (only used for reindex)
+static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+
+/**
+ * Add a block read from a file to the block index, followed by the blocks read
+ * earlier that were waiting for it as their parent. dbp is the position of the
+ * block if the file is one of our block files. Returns false if the import
+ * should stop.
+ */
+static bool ImportBlock(const CChainParams& chainparams, const CBlock& block, CDiskBlockPos* dbp, int& nLoaded)
+{
+    uint256 hash = block.GetHash();
+    bool fGenesis = hash == chainparams.GetConsensus().hashGenesisBlock;
+    {
+        LOCK(cs_main);
+
+        // detect out of order blocks, and store them for later
+        if (!fGenesis && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+            LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                    block.hashPrevBlock.ToString());
+            if (dbp)
+                mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+            return true;
+        }
+
+        // process in case the block isn't known yet
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
+        if (mi == mapBlockIndex.end() || (mi->second->nStatus & BLOCK_HAVE_DATA) == 0) {
+            CValidationState state;
+            if (AcceptBlock(block, state, chainparams, NULL, true, dbp))
+                nLoaded++;
+            if (state.IsError())
+                return false;
+        } else if (!fGenesis && mi->second->nHeight % 1000 == 0) {
+            LogPrint("reindex", "Block Import: already had block %s at height %d\n", hash.ToString(), mi->second->nHeight);
+        }
+    }
+
+    // Activate the genesis block so normal node progress can continue
+    if (fGenesis) {
+        CValidationState state;
+        if (!ActivateBestChain(state, chainparams)) {
+            return false;
+        }
+    }
+
+    NotifyHeaderTip(chainparams.GetConsensus());
+
+    // Recursively process earlier encountered successors of this block
+    deque<uint256> queue;
+    queue.push_back(hash);
+    while (!queue.empty()) {
+        uint256 head = queue.front();
+        queue.pop_front();
+        std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+        while (range.first != range.second) {
+            CBlock blockChild;
+            if (ReadBlockFromDisk(blockChild, range.first->second, chainparams.GetConsensus()))
+            {
+                LogPrint("reindex", "%s: Processing out of order child %s of %s\n", __func__, blockChild.GetHash().ToString(),
+                        head.ToString());
+                LOCK(cs_main);
+                CValidationState dummy;
+                if (AcceptBlock(blockChild, dummy, chainparams, NULL, true, &(range.first->second)))
+                {
+                    nLoaded++;
+                    queue.push_back(blockChild.GetHash());
+                }
+            }
+            range.first = mapBlocksUnknownParent.erase(range.first);
+            NotifyHeaderTip(chainparams.GetConsensus());
+        }
+    }
+
+    return true;
+}
+
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
 
     int nLoaded = 0;
@@ -6421,72 +6996,261 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 blkdat >> block;
                 nRewind = blkdat.GetPos();
 
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+                if (!ImportBlock(chainparams, block, dbp, nLoaded))
+                    break;
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+        }
+    } catch (const std::runtime_error& e) {
+        AbortNode(std::string("System error: ") + e.what());
+    }
+    if (nLoaded > 0)
+        LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    return nLoaded > 0;
+}
+
+/** Bytes of blocks that may be read ahead of the import from any one file */
+static const size_t MAX_IMPORT_QUEUE_BYTES = 16 * 1024 * 1024;
+
+namespace {
+
+/** A block read from a file, waiting to be added to the block index */
+struct CImportedBlock
+{
+    std::shared_ptr<const CBlock> pblock;
+    CDiskBlockPos pos;
+    unsigned int nSize = 0;
+};
+
+/** Blocks read ahead from one of the files of ImportBlockFiles */
+struct CImportFile
+{
+    Mutex cs;
+    std::condition_variable cv;
+    std::deque<CImportedBlock> queue GUARDED_BY(cs);
+    size_t nQueuedBytes GUARDED_BY(cs) = 0;
+    //! Position after the last block read, once the file has been read
+    uint64_t nEndPos GUARDED_BY(cs) = 0;
+    bool fDone GUARDED_BY(cs) = false;
+};
+
+}
+
+static void FinishImportFile(CImportFile& file, uint64_t nEndPos)
+{
+    LOCK(file.cs);
+    file.nEndPos = nEndPos;
+    file.fDone = true;
+    file.cv.notify_all();
+}
+
+/**
+ * Read, deserialize and check the blocks of a file, and queue them for
+ * ImportBlockFiles. nFile is the number of the block file, or -1 if the
+ * file is not one of our block files.
+ */
+static void ReadImportFile(const CChainParams& chainparams, const fs::path& path, int nFile, CImportFile& file, const std::atomic<bool>& fStop)
+{
+    // Blocks that are ancestors of the last checkpoint may skip transaction
+    // checks in AcceptBlock, so only the blocks that won't are checked here.
+    bool fCheckTransactions = !(fIBDSkipTxVerification && fCheckpointsEnabled);
+
+    uint64_t nRewind = 0;
+    FILE* fileIn = fsbridge::fopen(path, "rb");
+    if (!fileIn) {
+        LogPrintf("Warning: Could not open blocks file %s\n", path.string());
+        FinishImportFile(file, nRewind);
+        return;
+    }
+    try {
+        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+        while (!blkdat.eof() && !fStop) {
+            blkdat.SetPos(nRewind);
+            nRewind++; // start one byte further next time, in case of failure
+            blkdat.SetLimit(); // remove former limit
+            unsigned int nSize = 0;
+            try {
+                // locate a header
+                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+                blkdat.FindByte(chainparams.MessageStart()[0]);
+                nRewind = blkdat.GetPos()+1;
+                blkdat >> FLATDATA(buf);
+                if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
                     continue;
-                }
+                // read size
+                blkdat >> nSize;
+                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+                    continue;
+            } catch (const std::exception&) {
+                // no valid block header found; don't complain
+                break;
+            }
+            try {
+                // read block
+                uint64_t nBlockPos = blkdat.GetPos();
+                blkdat.SetLimit(nBlockPos + nSize);
+                blkdat.SetPos(nBlockPos);
+                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+                blkdat >> *pblock;
+                nRewind = blkdat.GetPos();
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    LOCK(cs_main);
+                // Context-free checks, which mark the block as checked for
+                // AcceptBlock. A block that fails is left for AcceptBlock to
+                // reject.
+                if (fCheckTransactions) {
                     CValidationState state;
-                    if (AcceptBlock(block, state, chainparams, NULL, true, dbp))
-                        nLoaded++;
-                    if (state.IsError())
+                    auto verifier = ProofVerifier::Disabled();
+                    CheckBlock(*pblock, state, chainparams, verifier, true, true, true);
+                }
+
+                CImportedBlock imported;
+                imported.pblock = pblock;
+                imported.pos = CDiskBlockPos(nFile, nBlockPos);
+                imported.nSize = nSize;
+
+                WAIT_LOCK(file.cs, lock);
+                file.cv.wait(lock, [&] { return file.nQueuedBytes < MAX_IMPORT_QUEUE_BYTES || fStop; });
+                file.nQueuedBytes += nSize;
+                file.queue.push_back(std::move(imported));
+                file.cv.notify_all();
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+        }
+    } catch (const std::runtime_error& e) {
+        AbortNode(std::string("System error: ") + e.what());
+    }
+
+    FinishImportFile(file, nRewind);
+}
+
+void ImportBlockFiles(const CChainParams& chainparams, const std::vector<fs::path>& vPath, bool fBlockFiles, int nThreads)
+{
+    int64_t nStart = GetTimeMillis();
+
+    std::vector<CImportFile> vFile(vPath.size());
+    std::atomic<size_t> nNextFile{0};
+    std::atomic<bool> fStop{false};
+
+    // Read and check the files ahead of the import, each on a single thread
+    std::vector<std::thread> vThread;
+    for (int i = 0; i < nThreads; i++) {
+        vThread.emplace_back([&] {
+            RenameThread("zcash-loadblkfile");
+            size_t n;
+            while (!fStop && (n = nNextFile++) < vPath.size())
+                ReadImportFile(chainparams, vPath[n], fBlockFiles ? (int)n : -1, vFile[n], fStop);
+        });
+    }
+
+    // Connect the blocks added so far after each file, while the next files
+    // are being imported. This runs on a boost::thread so that it can be
+    // interrupted between the steps of ActivateBestChain, rather than making
+    // shutdown wait for all the blocks imported so far to be connected.
+    Mutex cs_connect;
+    std::condition_variable cvConnect;
+    size_t nFilesImported = 0;
+    boost::thread connectThread([&] {
+        RenameThread("zcash-loadblkconnect");
+        size_t nFilesConnected = 0;
+        try {
+            while (true) {
+                {
+                    WAIT_LOCK(cs_connect, lock);
+                    cvConnect.wait(lock, [&] { return nFilesImported > nFilesConnected || fStop; });
+                    if (fStop)
                         break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrint("reindex", "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+                    nFilesConnected = nFilesImported;
                 }
+                CValidationState state;
+                if (!ActivateBestChain(state, chainparams)) {
+                    LogPrintf("%s: Failed to connect best block\n", __func__);
+                    break;
+                }
+            }
+        } catch (const boost::thread_interrupted&) {
+            LogPrintf("%s: Stopped connecting imported blocks\n", __func__);
+        }
+    });
 
-                // Activate the genesis block so normal node progress can continue
-                if (hash == chainparams.GetConsensus().hashGenesisBlock) {
-                    CValidationState state;
-                    if (!ActivateBestChain(state, chainparams)) {
+    // When the import itself was interrupted, stop connecting blocks too.
+    // The threads use our locals, so they must be joined even if we are
+    // interrupted again meanwhile.
+    auto stopThreads = [&](bool fInterrupt) {
+        boost::this_thread::disable_interruption noInterruption;
+        fStop = true;
+        for (CImportFile& file : vFile) {
+            LOCK(file.cs);
+            file.cv.notify_all();
+        }
+        {
+            LOCK(cs_connect);
+            cvConnect.notify_all();
+        }
+        if (fInterrupt)
+            connectThread.interrupt();
+        while (!connectThread.try_join_for(boost::chrono::milliseconds(100))) {
+            if (boost::this_thread::interruption_requested())
+                connectThread.interrupt();
+        }
+        for (std::thread& thread : vThread)
+            thread.join();
+    };
+
+    // Add the blocks to the block index in file order
+    int nLoaded = 0;
+    size_t initialSize = nSizeReindexed;
+    try {
+        bool fContinue = true;
+        for (size_t n = 0; n < vPath.size() && fContinue; n++) {
+            if (fBlockFiles)
+                LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)n);
+            else
+                LogPrintf("Importing blocks file %s...\n", vPath[n].string());
+
+            CImportFile& file = vFile[n];
+            while (fContinue) {
+                boost::this_thread::interruption_point();
+
+                CImportedBlock imported;
+                {
+                    WAIT_LOCK(file.cs, lock);
+                    file.cv.wait(lock, [&] { return !file.queue.empty() || file.fDone; });
+                    if (file.queue.empty()) {
+                        initialSize += file.nEndPos;
                         break;
                     }
+                    imported = std::move(file.queue.front());
+                    file.queue.pop_front();
+                    file.nQueuedBytes -= imported.nSize;
+                    file.cv.notify_all();
                 }
 
-                NotifyHeaderTip(chainparams.GetConsensus());
-
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        if (ReadBlockFromDisk(block, range.first->second, chainparams.GetConsensus()))
-                        {
-                            LogPrint("reindex", "%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                    head.ToString());
-                            LOCK(cs_main);
-                            CValidationState dummy;
-                            if (AcceptBlock(block, dummy, chainparams, NULL, true, &(range.first->second)))
-                            {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
-                            }
-                        }
-                        range.first = mapBlocksUnknownParent.erase(range.first);
-                        NotifyHeaderTip(chainparams.GetConsensus());
-                    }
+                if (fReindex)
+                    nSizeReindexed = initialSize + imported.pos.nPos;
+
+                try {
+                    fContinue = ImportBlock(chainparams, *imported.pblock, fBlockFiles ? &imported.pos : nullptr, nLoaded);
+                } catch (const std::exception& e) {
+                    LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
                 }
-            } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+
+            {
+                LOCK(cs_connect);
+                nFilesImported = n + 1;
+                cvConnect.notify_all();
             }
         }
-    } catch (const std::runtime_error& e) {
-        AbortNode(std::string("System error: ") + e.what());
+    } catch (...) {
+        stopThreads(true);
+        throw;
     }
-    if (nLoaded > 0)
-        LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
-    return nLoaded > 0;
+    stopThreads(false);
+
+    LogPrintf("Loaded %i blocks from %u files in %dms\n", nLoaded, vPath.size(), GetTimeMillis() - nStart);
 }
 
 void static CheckBlockIndex(const Consensus::Params& consensusParams)
@@ -7614,6 +8378,10 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Verify BMM for the whole batch before taking cs_main, so that the
+        // BMM check in CheckBlockHeader only has to look in the cache.
+        VerifyBMMBatch(headers, chainparams.GetConsensus());
+
         {
         LOCK(cs_main);
 
@@ -7963,6 +8731,60 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
     return true;
 }
 
+/** Maximum number of received transactions to pre-check as one batch */
+static const size_t MAX_TX_PRECHECK_BATCH = 100;
+
+/**
+ * Pre-check the transactions of the complete "tx" messages waiting to be
+ * processed from pfrom as one batch, so that their signatures and proofs are
+ * verified in parallel and outside cs_main before ProcessMessage() hands them
+ * to AcceptToMemoryPool() one at a time. Transactions we already have or
+ * recently rejected are skipped, and so is the whole batch of a peer that is
+ * about to be disconnected. Requires LOCK(cs_vRecvMsg).
+ */
+static void PreCheckReceivedTransactions(const CChainParams& chainparams, CNode* pfrom)
+{
+    if (GetBoolArg("-blocksonly", DEFAULT_BLOCKSONLY) || IsInitialBlockDownload(chainparams.GetConsensus()))
+        return;
+
+    std::vector<CTransaction> vtx;
+    for (CNetMessage& msg : pfrom->vRecvMsg) {
+        if (pfrom->fDisconnect || !msg.complete() || vtx.size() == MAX_TX_PRECHECK_BATCH)
+            break;
+        if (msg.fPreChecked || msg.hdr.GetCommand() != "tx")
+            continue;
+        msg.fPreChecked = true;
+
+        try {
+            CDataStream vRecv(msg.vRecv);
+            CTransaction tx;
+            vRecv >> tx;
+            vtx.push_back(std::move(tx));
+        } catch (const std::exception&) {
+            // ProcessMessage() rejects the message
+        }
+    }
+    if (vtx.empty())
+        return;
+
+    {
+        LOCK(cs_main);
+        if (State(pfrom->GetId())->fShouldBan)
+            return;
+
+        // The same AlreadyHave() check as ProcessMessage() makes
+        std::vector<CTransaction> vNew;
+        for (CTransaction& tx : vtx) {
+            if (!AlreadyHave(CInv(MSG_WTX, tx.GetHash(), tx.GetWTxId().authDigest)))
+                vNew.push_back(std::move(tx));
+        }
+        vtx.swap(vNew);
+    }
+
+    if (!vtx.empty())
+        PreCheckTransactions(chainparams, mempool, vtx, &pfrom->fDisconnect);
+}
+
 // requires LOCK(cs_vRecvMsg)
 bool ProcessMessages(const CChainParams& chainparams, CNode* pfrom)
 {
@@ -7991,6 +8813,8 @@ bool ProcessMessages(const CChainParams& chainparams, CNode* pfrom)
     if (!pfrom->vRecvGetData.empty()) return fOk;
     if (!pfrom->orphan_work_set.empty()) return true;
 
+    PreCheckReceivedTransactions(chainparams, pfrom);
+
     std::deque<CNetMessage>::iterator it = pfrom->vRecvMsg.begin();
     while (!pfrom->fDisconnect && it != pfrom->vRecvMsg.end()) {
         // Don't bother if send buffer is too full to respond anyway
@@ -8462,10 +9286,8 @@ public:
     CMainCleanup() {}
     ~CMainCleanup() {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
+        blockIndexPool.Clear();
 
         // orphan transactions
         mapOrphanTransactions.clear();
@@ -34,6 +34,7 @@
 #include "timestampindex.h"
 
 #include <algorithm>
+#include <atomic>
 #include <exception>
 #include <map>
 #include <optional>
@@ -50,6 +51,7 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CCoinsViewDB;
 class CBloomFilter;
 class CChainParams;
 class CInv;
@@ -108,6 +110,10 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of threads reading block files during -reindex and -loadblock */
+static const int MAX_IMPORT_THREADS = 16;
+/** -importthreads default (number of threads reading block files, 0 = auto) */
+static const int DEFAULT_IMPORT_THREADS = 0;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -287,6 +293,14 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 fs::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = NULL);
+/**
+ * Import blocks from several files at once. nThreads threads read, deserialize
+ * and check the files ahead of the import, one file per thread at a time. The
+ * blocks are added to the block index in file order on the calling thread,
+ * and connected on another thread after each file. If fBlockFiles, vPath are
+ * our blk?????.dat files in order, and their blocks are indexed in place.
+ */
+void ImportBlockFiles(const CChainParams& chainparams, const std::vector<fs::path>& vPath, bool fBlockFiles, int nThreads);
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk */
@@ -340,6 +354,8 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune);
 
 /** Create a new block index entry for a given block hash */
 CBlockIndex * InsertBlockIndex(const uint256& hash);
+/** Memory used by mapBlockIndex and its entries. Requires cs_main. */
+size_t BlockIndexDynamicUsage();
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 /** Increase a node's misbehavior score. */
@@ -355,6 +371,21 @@ bool AcceptToMemoryPool(
         CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
         bool* pfMissingInputs, bool fRejectAbsurdFee=false);
 
+/**
+ * Verify the transparent signatures and the Sapling and Orchard bundles of
+ * transactions that are about to be passed to AcceptToMemoryPool, on the
+ * transaction pre-check threads and without holding cs_main or pool.cs.
+ * Nothing is decided here: valid signatures and bundles are stored in the
+ * signature and bundle validity caches, where AcceptToMemoryPool, which still
+ * makes every check under the locks, finds them instead of verifying them.
+ *
+ * Transactions that would fail the cheap checks AcceptToMemoryPool makes
+ * first (CheckTransaction, standardness, relay fee and unpaid actions) are
+ * skipped. Once *pfStop is set, no further transaction is verified.
+ */
+void PreCheckTransactions(const CChainParams& chainparams, CTxMemPool& pool, const std::vector<CTransaction>& vtx,
+                          const std::atomic<bool>* pfStop = nullptr);
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -440,6 +471,14 @@ bool CheckTransaction(const CTransaction& tx, CValidationState& state,
                       ProofVerifier& verifier);
 bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidationState &state);
 
+/**
+ * Verify the Sprout JoinSplit proofs of transactions, on the check pool if
+ * there are script check threads. Returns false if any proof is invalid.
+ * With cacheStore, verified proofs are added to the JoinSplit cache; see
+ * ProofVerifier::Strict.
+ */
+bool VerifySproutProofs(const std::vector<CTransaction>& vtx, bool cacheStore);
+
 namespace Consensus {
 
 /**
@@ -510,7 +549,7 @@ private:
     uint32_t consensusBranchId;
     ScriptError error;
     // We store a pointer instead of a reference here, to allow it to be null for
-    // performance reasons (enabling fast swaps in CCheckQueue::Loop).
+    // performance reasons (enabling fast swaps in CCheckPoolControl::Add).
     PrecomputedTransactionData *txdata;
 
 public:
@@ -625,6 +664,15 @@ bool RegenerateSubtrees(ShieldedType type, const Consensus::Params& consensusPar
  */
 bool RewindBlockIndex(const CChainParams& chainparams, bool& clearWitnessCaches);
 
+/**
+ * The deposit database marks deposits paid as blocks are connected, while the
+ * chainstate is flushed later. After a crash the two can disagree about the
+ * tip; bring the paid index back to chainActive by undoing the payouts of the
+ * blocks it has that the active chain doesn't, and applying those it misses.
+ * Either way the deposit payout snapshot then starts out at the active tip.
+ */
+bool ReconcileDrivechainDeposits(const CChainParams& chainparams);
+
 /** RAII wrapper for VerifyDB: Verify consistency of the block and coin databases */
 class CVerifyDB {
 public:
@@ -648,6 +696,9 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** Global variable that points to the coins database behind pcoinsTip */
+extern CCoinsViewDB *pcoinsdbview;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
@@ -5,9 +5,6 @@
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
 #include "miner.h"
-#ifdef ENABLE_MINING
-#include "pow/tromp/equi_miner.h"
-#endif
 
 #include "amount.h"
 #include "chainparams.h"
@@ -16,9 +13,6 @@
 #include "consensus/merkle.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
-#ifdef ENABLE_MINING
-#include "crypto/equihash.h"
-#endif
 #include "drivechain.h"
 #include "hash.h"
 #include "key_io.h"
@@ -32,7 +26,6 @@
 #include "random.h"
 #include "timedata.h"
 #include "transaction_builder.h"
-#include "ui_interface.h"
 #include "util/system.h"
 #include "util/match.h"
 #include "util/moneystr.h"
@@ -44,10 +37,7 @@
 
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
-#ifdef ENABLE_MINING
-#include <functional>
-#endif
-#include <mutex>
+#include <optional>
 #include <queue>
 
 using namespace std;
@@ -99,13 +89,15 @@ private:
     const CChainParams &chainparams;
     const int nHeight;
     const CAmount nFees;
+    const std::vector<DrivechainDeposit> &vDeposit;
 
 public:
     AddOutputsToCoinbaseTxAndSign(
         CMutableTransaction &mtx,
         const CChainParams &chainparams,
         const int nHeight,
-        const CAmount nFees) : mtx(mtx), chainparams(chainparams), nHeight(nHeight), nFees(nFees) {}
+        const CAmount nFees,
+        const std::vector<DrivechainDeposit> &vDeposit) : mtx(mtx), chainparams(chainparams), nHeight(nHeight), nFees(nFees), vDeposit(vDeposit) {}
 
     const libzcash::Zip212Enabled GetZip212Flag() const {
         if (chainparams.GetConsensus().NetworkUpgradeActive(nHeight, Consensus::UPGRADE_CANOPY)) {
@@ -162,6 +154,14 @@ public:
         return miner_reward + nFees;
     }
 
+    // Add drivechain deposit payout outputs. They are transparent, so they
+    // can go into shielded coinbase transactions too.
+    void AddDepositPayouts() const {
+        // TODO collect deposit fees for miner
+        for (const DrivechainDeposit& d : vDeposit)
+            mtx.vout.push_back(CTxOut(d.amount, GetDepositPayoutScript(d)));
+    }
+
     void ComputeBindingSig(rust::Box<sapling::Builder> saplingBuilder, std::optional<orchard::UnauthorizedBundle> orchardBundle) const {
         auto consensusBranchId = CurrentEpochBranchId(nHeight, chainparams.GetConsensus());
         auto saplingBundle = sapling::build_bundle(std::move(saplingBuilder));
@@ -236,6 +236,8 @@ public:
             throw new std::runtime_error("Failed to create shielded output for miner");
         }
 
+        AddDepositPayouts();
+
         ComputeBindingSig(std::move(saplingBuilder), std::move(bundle));
     }
 
@@ -252,6 +254,8 @@ public:
             miner_reward,
             libzcash::Memo::ToBytes(std::nullopt));
 
+        AddDepositPayouts();
+
         ComputeBindingSig(std::move(saplingBuilder), std::nullopt);
     }
 
@@ -269,20 +273,7 @@ public:
         // Now fill in the miner's output.
         mtx.vout[0] = CTxOut(value, coinbaseScript->reserveScript);
 
-        // TODO collect deposit fees for miner
-    
-        // Add drivechain deposit payout outputs
-        std::vector<DrivechainDeposit> vDeposit;
-        if (!GetUnpaidDrivechainDeposits(vDeposit)) 
-            LogPrint("%s: Failed to collect drivechain deposits for new block!", __func__);
-
-        for (const DrivechainDeposit& d : vDeposit) {
-            // Testing deposit payout script
-            CScript scriptPubKey;
-            scriptPubKey.resize(1);
-            scriptPubKey[0] = 0xDC;
-            mtx.vout.push_back(CTxOut(d.amount, scriptPubKey));
-        }
+        AddDepositPayouts();
 
         // Add drivechain withdrawal refund outputs
         // TODO
@@ -291,7 +282,7 @@ public:
     }
 };
 
-CMutableTransaction CreateCoinbaseTransaction(const CChainParams& chainparams, CAmount nFees, const MinerAddress& minerAddress, int nHeight)
+CMutableTransaction CreateCoinbaseTransaction(const CChainParams& chainparams, CAmount nFees, const MinerAddress& minerAddress, int nHeight, const std::vector<DrivechainDeposit>& vDeposit)
 {
         CMutableTransaction mtx = CreateNewContextualCMutableTransaction(
                 chainparams.GetConsensus(), nHeight,
@@ -309,13 +300,34 @@ CMutableTransaction CreateCoinbaseTransaction(const CChainParams& chainparams, C
 
         // Add outputs and sign
         std::visit(
-            AddOutputsToCoinbaseTxAndSign(mtx, chainparams, nHeight, nFees),
+            AddOutputsToCoinbaseTxAndSign(mtx, chainparams, nHeight, nFees, vDeposit),
             minerAddress);
 
         mtx.vin[0].scriptSig = CScript() << nHeight << OP_0;
         return mtx;
 }
 
+/**
+ * The transactions selected for the last block template, so that the next
+ * template on the same tip only has to select from the transactions added to
+ * the mempool since.
+ */
+struct TemplateSelection
+{
+    uint256 hashPrevBlock;
+    // Index of the miner address type, which sets the coinbase reservation
+    size_t nAddressType;
+    unsigned int nBlockMaxSize;
+    size_t nBlockUnpaidActionLimit;
+    uint64_t nRecentlyAddedSequence;
+    uint64_t nPrioritisedSequence;
+    // Selected transactions, in block order
+    std::vector<uint256> vTxid;
+};
+
+// Only accessed by CreateNewBlock while holding cs_main and mempool.cs
+static std::optional<TemplateSelection> lastSelection;
+
 BlockAssembler::BlockAssembler(const CChainParams& _chainparams)
     : chainparams(_chainparams)
 {
@@ -326,6 +338,8 @@ BlockAssembler::BlockAssembler(const CChainParams& _chainparams)
 
     // Number of unpaid actions allowed in a block:
     nBlockUnpaidActionLimit = (size_t) GetArg("-blockunpaidactionlimit", DEFAULT_BLOCK_UNPAID_ACTION_LIMIT);
+
+    fIncrementalTemplates = GetBoolArg("-incrementaltemplates", DEFAULT_INCREMENTAL_TEMPLATES);
 }
 
 void BlockAssembler::resetBlock(const MinerAddress& minerAddress)
@@ -352,6 +366,7 @@ void BlockAssembler::resetBlock(const MinerAddress& minerAddress)
 
     lastFewTxs = 0;
     blockFinished = false;
+    nBlockUnpaidActions = 0;
 }
 
 CBlockTemplate* BlockAssembler::CreateNewBlock(
@@ -424,8 +439,17 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(
         }
     }
 
-    // This is where transactions from the mempool get added to the block
-    constructZIP317BlockTemplate();
+    // This is where transactions from the mempool get added to the block.
+    // A precomputed coinbase means an empty block, which says nothing about
+    // the selection for the next template.
+    const bool fSaveSelection = fIncrementalTemplates && !next_cb_mtx;
+    const uint64_t nRecentlyAddedSequence = mempool.GetRecentlyAddedSequence();
+    size_t nNewTx;
+    if (fSaveSelection && updateZIP317BlockTemplate(minerAddress, pindexPrev->GetBlockHash(), nNewTx)) {
+        LogPrint("mempool", "%s: reused previous selection, %u new txs\n", __func__, nNewTx);
+    } else {
+        constructZIP317BlockTemplate();
+    }
 
     last_block_num_txs = nBlockTx;
     last_block_size = nBlockSize;
@@ -433,11 +457,11 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(
 
     // Create coinbase tx
     if (next_cb_mtx) {
-        // TODO for drivechain maybe disable pre-computed coinbase
+        // The caller checked that it pays out the deposits unpaid after pindexPrev
         pblock->vtx[0] = *next_cb_mtx;
     } else {
-        pblock->vtx[0] = CreateCoinbaseTransaction(chainparams, nFees, minerAddress, nHeight);
-        // TODO for drivechain maybe disable pre-computed coinbase
+        pblocktemplate->pDepositPayouts = GetDepositPayouts(pindexPrev->GetBlockHash());
+        pblock->vtx[0] = CreateCoinbaseTransaction(chainparams, nFees, minerAddress, nHeight, pblocktemplate->pDepositPayouts->vDeposit);
     }
     pblocktemplate->vTxFees[0] = -nFees;
 
@@ -499,11 +523,36 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(
     pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
     pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
 
+    const int64_t nTimeCheckStart = GetTimeMicros();
+
     CValidationState state;
     if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, true)) {
+        lastSelection = std::nullopt;
         throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
     }
 
+    LogPrint("bench", "%s: TestBlockValidity %.2fms\n", __func__, 0.001 * (GetTimeMicros() - nTimeCheckStart));
+
+    if (fSaveSelection) {
+        TemplateSelection selection;
+        selection.hashPrevBlock = pindexPrev->GetBlockHash();
+        selection.nAddressType = minerAddress.index();
+        selection.nBlockMaxSize = nBlockMaxSize;
+        selection.nBlockUnpaidActionLimit = nBlockUnpaidActionLimit;
+        selection.nRecentlyAddedSequence = nRecentlyAddedSequence;
+        selection.nPrioritisedSequence = mempool.GetPrioritisedSequence();
+        // A full block can only take new transactions by dropping old ones,
+        // which needs a selection from scratch
+        if (!blockFinished) {
+            selection.vTxid.reserve(pblock->vtx.size() - 1);
+            for (size_t i = 1; i < pblock->vtx.size(); i++)
+                selection.vTxid.push_back(pblock->vtx[i].GetHash());
+            lastSelection = std::move(selection);
+        } else {
+            lastSelection = std::nullopt;
+        }
+    }
+
     return pblocktemplate.release();
 }
 
@@ -634,6 +683,19 @@ void BlockAssembler::AddToBlock(CTxMemPool::txiter iter)
     }
 }
 
+static void AddZIP317Candidate(
+    CTxMemPool::txiter mi,
+    CTxMemPool::weightedCandidates& candidatesPayingConventionalFee,
+    CTxMemPool::weightedCandidates& candidatesNotPayingConventionalFee)
+{
+    int128_t weightRatio = mi->GetWeightRatio();
+    if (weightRatio >= WEIGHT_RATIO_SCALE) {
+        candidatesPayingConventionalFee.add(mi->GetTx().GetHash(), mi, weightRatio);
+    } else {
+        candidatesNotPayingConventionalFee.add(mi->GetTx().GetHash(), mi, weightRatio);
+    }
+}
+
 void BlockAssembler::constructZIP317BlockTemplate()
 {
     CTxMemPool::weightedCandidates candidatesPayingConventionalFee;
@@ -641,11 +703,61 @@ void BlockAssembler::constructZIP317BlockTemplate()
 
     for (auto mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
     {
-        int128_t weightRatio = mi->GetWeightRatio();
-        if (weightRatio >= WEIGHT_RATIO_SCALE) {
-            candidatesPayingConventionalFee.add(mi->GetTx().GetHash(), mi, weightRatio);
-        } else {
-            candidatesNotPayingConventionalFee.add(mi->GetTx().GetHash(), mi, weightRatio);
+        AddZIP317Candidate(mi, candidatesPayingConventionalFee, candidatesNotPayingConventionalFee);
+    }
+
+    CTxMemPool::queueEntries waiting;
+    CTxMemPool::queueEntries cleared;
+    addTransactions(candidatesPayingConventionalFee, waiting, cleared);
+    addTransactions(candidatesNotPayingConventionalFee, waiting, cleared);
+}
+
+bool BlockAssembler::updateZIP317BlockTemplate(
+    const MinerAddress& minerAddress,
+    const uint256& hashPrevBlock,
+    size_t& nNewTx)
+{
+    if (!lastSelection ||
+        lastSelection->hashPrevBlock != hashPrevBlock ||
+        lastSelection->nAddressType != minerAddress.index() ||
+        lastSelection->nBlockMaxSize != nBlockMaxSize ||
+        lastSelection->nBlockUnpaidActionLimit != nBlockUnpaidActionLimit ||
+        lastSelection->nPrioritisedSequence != mempool.GetPrioritisedSequence()) {
+        return false;
+    }
+
+    // Transactions that left the mempool may have made room for ones the
+    // previous selection skipped, so start from scratch.
+    std::vector<CTxMemPool::txiter> vSelected;
+    vSelected.reserve(lastSelection->vTxid.size());
+    for (const uint256& txid : lastSelection->vTxid) {
+        auto mi = mempool.mapTx.find(txid);
+        if (mi == mempool.mapTx.end()) {
+            return false;
+        }
+        vSelected.push_back(mi);
+    }
+
+    std::vector<CTxMemPool::txiter> vAdded;
+    if (!mempool.GetAddedSince(lastSelection->nRecentlyAddedSequence, vAdded)) {
+        return false;
+    }
+
+    // The previous selection passed these checks in the same order and from
+    // the same state, so this only rebuilds the block state.
+    for (CTxMemPool::txiter iter : vSelected) {
+        if (!isStillDependent(iter) && TestForBlock(iter)) {
+            AddToBlock(iter);
+            nBlockUnpaidActions += iter->GetUnpaidActionCount();
+        }
+    }
+    const uint64_t nKeptTx = nBlockTx;
+
+    CTxMemPool::weightedCandidates candidatesPayingConventionalFee;
+    CTxMemPool::weightedCandidates candidatesNotPayingConventionalFee;
+    for (CTxMemPool::txiter mi : vAdded) {
+        if (!inBlock.count(mi)) {
+            AddZIP317Candidate(mi, candidatesPayingConventionalFee, candidatesNotPayingConventionalFee);
         }
     }
 
@@ -653,6 +765,9 @@ void BlockAssembler::constructZIP317BlockTemplate()
     CTxMemPool::queueEntries cleared;
     addTransactions(candidatesPayingConventionalFee, waiting, cleared);
     addTransactions(candidatesNotPayingConventionalFee, waiting, cleared);
+
+    nNewTx = nBlockTx - nKeptTx;
+    return true;
 }
 
 void BlockAssembler::addTransactions(
@@ -660,8 +775,6 @@ void BlockAssembler::addTransactions(
     CTxMemPool::queueEntries& waiting,
     CTxMemPool::queueEntries& cleared)
 {
-    size_t nBlockUnpaidActions = 0;
-
     while (!blockFinished && !(candidates.empty() && cleared.empty()))
     {
         CTxMemPool::txiter iter;
@@ -843,6 +956,38 @@ static bool ProcessBlockFound(const CBlock* pblock, const CChainParams& chainpar
     return true;
 }
 
+bool MineBlockBMM(CBlock& block, const CChainParams& chainparams, int64_t nTimeout)
+{
+    // The target is always powLimit, so a nonce takes a few hashes to find.
+    // The work behind a block is done by the mainchain, through BMM.
+    arith_uint256 hashTarget = arith_uint256().SetCompact(block.nBits);
+    while (true) {
+        solutionTargetChecks.increment();
+        if (UintToArith256(block.GetHash()) <= hashTarget)
+            break;
+        block.nNonce = ArithToUint256(UintToArith256(block.nNonce) + 1);
+        if ((UintToArith256(block.nNonce) & 0xffff) == 0)
+            boost::this_thread::interruption_point();
+    }
+
+    // On regtest blocks are mined on demand, without a mainchain to commit
+    // to them unless a test installed a BMM request handler
+    if (chainparams.MineBlocksOnDemand() && !HaveBMMRequestHandler()) {
+        LogPrint("pow", "%s: No mainchain on this network, not requesting BMM for h* %s\n", __func__,
+                 block.hashMerkleRoot.ToString());
+        return true;
+    }
+
+    uint256 hashMainBlock;
+    if (!DrivechainRequestBMM(block.hashMerkleRoot, hashMainBlock, nTimeout)) {
+        LogPrint("pow", "%s: BMM commitment %s was not confirmed\n", __func__, block.hashMerkleRoot.ToString());
+        return false;
+    }
+    LogPrint("pow", "%s: BMM commitment %s confirmed in mainchain block %s\n", __func__,
+             block.hashMerkleRoot.ToString(), hashMainBlock.ToString());
+    return true;
+}
+
 void static BitcoinMiner(const CChainParams& chainparams)
 {
     LogPrintf("ZcashMiner started\n");
@@ -852,24 +997,12 @@ void static BitcoinMiner(const CChainParams& chainparams)
     // Each thread has its own counter
     unsigned int nExtraNonce = 0;
 
+    // Wait before retrying a failed BMM request, longer each time it fails
+    int64_t nBMMBackoff = 0;
+
     std::optional<MinerAddress> maybeMinerAddress;
     GetMainSignals().AddressForMining(maybeMinerAddress);
 
-    unsigned int n = chainparams.GetConsensus().nEquihashN;
-    unsigned int k = chainparams.GetConsensus().nEquihashK;
-
-    std::string solver = GetArg("-equihashsolver", "default");
-    assert(solver == "tromp" || solver == "default");
-    LogPrint("pow", "Using Equihash solver \"%s\" with n = %u, k = %u\n", solver, n, k);
-
-    std::mutex m_cs;
-    bool cancelSolver = false;
-    boost::signals2::connection c = uiInterface.NotifyBlockTip.connect(
-        [&m_cs, &cancelSolver](bool, const CBlockIndex *) mutable {
-            std::lock_guard<std::mutex> lock{m_cs};
-            cancelSolver = true;
-        }
-    );
     miningTimer.start();
 
     try {
@@ -878,6 +1011,9 @@ void static BitcoinMiner(const CChainParams& chainparams)
             throw std::runtime_error("No miner address available (mining requires a wallet or -mineraddress)");
         }
         auto minerAddress = maybeMinerAddress.value();
+        if (!chainparams.MineBlocksOnDemand() && !HaveBMMRequestHandler()) {
+            throw std::runtime_error("Mining requires sending BMM requests to the mainchain, which this node can't do yet");
+        }
 
         while (true) {
             if (chainparams.MiningRequiresPeers()) {
@@ -900,7 +1036,6 @@ void static BitcoinMiner(const CChainParams& chainparams)
             //
             // Create new block
             //
-            unsigned int nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
             CBlockIndex* pindexPrev;
             {
                 LOCK(cs_main);
@@ -931,133 +1066,50 @@ void static BitcoinMiner(const CChainParams& chainparams)
                 ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
 
             //
-            // Search
+            // Search, then wait for the mainchain to commit to the block.
+            // Rebuild the template if that takes more than a minute, to pick
+            // up new transactions.
             //
-            int64_t nStart = GetTime();
-            arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
-
-            while (true) {
-                // Hash state
-                eh_HashState state = EhInitialiseState(n, k);
-
-                // I = the block header minus nonce and solution.
-                CEquihashInput I{*pblock};
-                CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                ss << I;
-
-                // H(I||...
-                state.Update((unsigned char*)&ss[0], ss.size());
-
-                // H(I||V||...
-                eh_HashState curr_state = state;
-                curr_state.Update(pblock->nNonce.begin(), pblock->nNonce.size());
-
-                // (x_1, x_2, ...) = A(I, V, n, k)
-                LogPrint("pow", "Running Equihash solver \"%s\" with nNonce = %s\n",
-                         solver, pblock->nNonce.ToString());
-
-                std::function<bool(std::vector<unsigned char>)> validBlock =
-                        [&pblock, &hashTarget, &chainparams, &m_cs, &cancelSolver, &minerAddress]
-                        (std::vector<unsigned char> soln) {
-                    // Write the solution to the hash and compute the result.
-                    LogPrint("pow", "- Checking solution against target\n");
-                    pblock->nSolution = soln;
-                    solutionTargetChecks.increment();
-
-                    if (UintToArith256(pblock->GetHash()) > hashTarget) {
-                        return false;
-                    }
-
-                    // Found a solution
-                    SetThreadPriority(THREAD_PRIORITY_NORMAL);
-                    LogPrintf("ZcashMiner:\n");
-                    LogPrintf("proof-of-work found  \n  hash: %s  \ntarget: %s\n", pblock->GetHash().GetHex(), hashTarget.GetHex());
-                    if (ProcessBlockFound(pblock, chainparams)) {
-                        // Ignore chain updates caused by us
-                        std::lock_guard<std::mutex> lock{m_cs};
-                        cancelSolver = false;
-                    }
-                    SetThreadPriority(THREAD_PRIORITY_LOWEST);
-                    std::visit(KeepMinerAddress(), minerAddress);
-
-                    // In regression test mode, stop mining after a block is found.
-                    if (chainparams.MineBlocksOnDemand()) {
-                        // Increment here because throwing skips the call below
-                        ehSolverRuns.increment();
-                        throw boost::thread_interrupted();
-                    }
+            if (!MineBlockBMM(*pblock, chainparams, 60)) {
+                nBMMBackoff = std::min<int64_t>(std::max<int64_t>(nBMMBackoff * 2, 1000), 60 * 1000);
+                LogPrint("pow", "ZcashMiner: BMM request failed, retrying in %d ms\n", nBMMBackoff);
+                MilliSleep(nBMMBackoff);
+                continue;
+            }
+            nBMMBackoff = 0;
 
-                    return true;
-                };
-                std::function<bool(EhSolverCancelCheck)> cancelled = [&m_cs, &cancelSolver](EhSolverCancelCheck pos) {
-                    std::lock_guard<std::mutex> lock{m_cs};
-                    return cancelSolver;
-                };
-
-                // TODO: factor this out into a function with the same API for each solver.
-                if (solver == "tromp") {
-                    std::function<void()> incrementRuns = [&]() { ehSolverRuns.increment(); };
-                    std::function<bool(size_t s, const std::vector<uint32_t>&)> checkSolution = [&](size_t s, const std::vector<uint32_t>& index_vector) {
-                        LogPrint("pow", "Checking solution %d\n", s+1);
-                        return validBlock(GetMinimalFromIndices(index_vector, DIGITBITS));
-                    };
-                    equihash_solve(curr_state.inner, incrementRuns, checkSolution);
-                } else {
-                    try {
-                        // If we find a valid block, we rebuild
-                        bool found = EhOptimisedSolve(n, k, curr_state, validBlock, cancelled);
-                        ehSolverRuns.increment();
-                        if (found) {
-                            break;
-                        }
-                    } catch (EhSolverCancelledException&) {
-                        LogPrint("pow", "Equihash solver cancelled\n");
-                        std::lock_guard<std::mutex> lock{m_cs};
-                        cancelSolver = false;
-                    }
-                }
+            // Check for stop or if the block went stale while we waited
+            boost::this_thread::interruption_point();
+            if (pindexPrev != chainActive.Tip())
+                continue;
 
-                // Check for stop or if block needs to be rebuilt
-                boost::this_thread::interruption_point();
-                // Regtest mode doesn't require peers
-                if (vNodes.empty() && chainparams.MiningRequiresPeers())
-                    break;
-                if ((UintToArith256(pblock->nNonce) & 0xffff) == 0xffff)
-                    break;
-                if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60)
-                    break;
-                if (pindexPrev != chainActive.Tip())
-                    break;
-
-                // Update nNonce and nTime
-                pblock->nNonce = ArithToUint256(UintToArith256(pblock->nNonce) + 1);
-                if (UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev) < 0)
-                    break; // Recreate the block if the clock has run backwards,
-                           // so that we can use the correct time.
-                if (chainparams.GetConsensus().nPowAllowMinDifficultyBlocksAfterHeight != std::nullopt)
-                {
-                    // Changing pblock->nTime can change work required on testnet:
-                    hashTarget.SetCompact(pblock->nBits);
-                }
+            // Found a block
+            SetThreadPriority(THREAD_PRIORITY_NORMAL);
+            LogPrintf("ZcashMiner:\n");
+            LogPrintf("BMM commitment confirmed\n  hash: %s  \n    h*: %s\n", pblock->GetHash().GetHex(), pblock->hashMerkleRoot.GetHex());
+            ProcessBlockFound(pblock, chainparams);
+            SetThreadPriority(THREAD_PRIORITY_LOWEST);
+            std::visit(KeepMinerAddress(), minerAddress);
+
+            // In regression test mode, stop mining after a block is found.
+            if (chainparams.MineBlocksOnDemand()) {
+                throw boost::thread_interrupted();
             }
         }
     }
     catch (const boost::thread_interrupted&)
     {
         miningTimer.stop();
-        c.disconnect();
         LogPrintf("ZcashMiner terminated\n");
         throw;
     }
     catch (const std::runtime_error &e)
     {
         miningTimer.stop();
-        c.disconnect();
         LogPrintf("ZcashMiner runtime error: %s\n", e.what());
         return;
     }
     miningTimer.stop();
-    c.disconnect();
 }
 
 void GenerateBitcoins(bool fGenerate, int nThreads, const CChainParams& chainparams)
@@ -20,6 +20,8 @@
 class CBlockIndex;
 class CChainParams;
 class CScript;
+struct CDepositPayoutSnapshot;
+struct DrivechainDeposit;
 
 namespace Consensus { struct Params; };
 
@@ -28,6 +30,8 @@ static const int DEFAULT_GENERATE_THREADS = 1;
 
 static const bool DEFAULT_PRINTPRIORITY = false;
 
+static const bool DEFAULT_INCREMENTAL_TEMPLATES = true;
+
 typedef std::variant<
     libzcash::OrchardRawAddress,
     libzcash::SaplingPaymentAddress,
@@ -94,9 +98,11 @@ struct CBlockTemplate
     uint256 hashAuthDataRoot;
     std::vector<CAmount> vTxFees;
     std::vector<int64_t> vTxSigOps;
+    // Drivechain deposits paid out by the coinbase transaction
+    std::shared_ptr<const CDepositPayoutSnapshot> pDepositPayouts;
 };
 
-CMutableTransaction CreateCoinbaseTransaction(const CChainParams& chainparams, CAmount nFees, const MinerAddress& minerAddress, int nHeight);
+CMutableTransaction CreateCoinbaseTransaction(const CChainParams& chainparams, CAmount nFees, const MinerAddress& minerAddress, int nHeight, const std::vector<DrivechainDeposit>& vDeposit);
 
 /** Generate a new block, without valid proof-of-work */
 class BlockAssembler
@@ -132,6 +138,10 @@ private:
     // Variables used for addScoreTxs and addPriorityTxs
     int lastFewTxs;
     bool blockFinished;
+    size_t nBlockUnpaidActions;
+
+    // Whether to start from the previous template's selection on the same tip
+    bool fIncrementalTemplates;
 
 public:
     BlockAssembler(const CChainParams& chainparams);
@@ -142,6 +152,13 @@ public:
 
 private:
     void constructZIP317BlockTemplate();
+    /**
+     * Select the transactions of the previous template on the same tip that
+     * are still in the mempool, then the ones added to the mempool since.
+     * Returns false, without selecting anything, if the previous selection
+     * can't be reused.
+     */
+    bool updateZIP317BlockTemplate(const MinerAddress& minerAddress, const uint256& hashPrevBlock, size_t& nNewTx);
     void addTransactions(
         CTxMemPool::weightedCandidates& candidates,
         CTxMemPool::queueEntries& waiting,
@@ -173,6 +190,14 @@ void IncrementExtraNonce(
     const CBlockIndex* pindexPrev,
     unsigned int& nExtraNonce,
     const Consensus::Params& consensusParams);
+/**
+ * Find a nonce that meets the block's target, then have the mainchain commit
+ * to the block and wait up to nTimeout seconds for it to confirm. On networks
+ * that mine blocks on demand, the commitment is only requested if a BMM
+ * request handler is installed. Returns false if the commitment wasn't
+ * confirmed, in which case the block needs a new template.
+ */
+bool MineBlockBMM(CBlock& block, const CChainParams& chainparams, int64_t nTimeout);
 /** Run the miner threads */
 void GenerateBitcoins(bool fGenerate, int nThreads, const CChainParams& chainparams);
 #endif
@@ -231,6 +231,7 @@ public:
     unsigned int nDataPos;
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
+    bool fPreChecked;               // transaction already passed to PreCheckTransactions()
 
     CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         hdrbuf.resize(24);
@@ -238,6 +239,7 @@ public:
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
+        fPreChecked = false;
     }
 
     bool complete() const
@@ -0,0 +1,155 @@
+// Copyright (c) 2025 L2L
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef L2L_NULLIFIER_MAP_H
+#define L2L_NULLIFIER_MAP_H
+
+#include "hash.h"
+#include "memusage.h"
+#include "random.h"
+#include "uint256.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <limits>
+#include <vector>
+
+class CTransaction;
+
+// A NullifierMap maps the nullifiers revealed by mempool transactions to
+// those transactions. Lookups with random 32-byte keys are the common case,
+// so instead of a tree the map is a flat open-addressing table with linear
+// probing, keyed by a SipHash of the nullifier salted per map (like
+// SaltedTxidHasher) so that peers can't choose nullifiers that collide.
+//
+// Empty slots have a null transaction pointer, so null can't be stored.
+// Erasing shifts the following entries of the probe sequence back, so that
+// no tombstones are needed.
+class NullifierMap
+{
+private:
+    struct Slot {
+        uint256 nullifier;
+        const CTransaction* ptx = nullptr;
+    };
+
+    // The table is grown when more than 3/4 of it is in use, and shrunk
+    // when less than 1/16 is.
+    static constexpr size_t MIN_CAPACITY = 16;
+
+    const uint64_t k0, k1;
+    std::vector<Slot> vSlot;
+    size_t nSize = 0;
+
+    size_t Mask() const { return vSlot.size() - 1; }
+
+    size_t Bucket(const uint256& nullifier) const
+    {
+        return SipHashUint256(k0, k1, nullifier) & Mask();
+    }
+
+    // Position of nullifier in vSlot, or of the empty slot it would go in
+    size_t Position(const uint256& nullifier) const
+    {
+        size_t i = Bucket(nullifier);
+        while (vSlot[i].ptx && vSlot[i].nullifier != nullifier)
+            i = (i + 1) & Mask();
+        return i;
+    }
+
+    void Resize(size_t nCapacity)
+    {
+        std::vector<Slot> vOld(nCapacity);
+        vOld.swap(vSlot);
+        for (const Slot& slot : vOld) {
+            if (slot.ptx)
+                vSlot[Position(slot.nullifier)] = slot;
+        }
+    }
+
+public:
+    NullifierMap() :
+        k0(GetRand(std::numeric_limits<uint64_t>::max())),
+        k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    // Returns the transaction that reveals nullifier, or null if none does.
+    const CTransaction* find(const uint256& nullifier) const
+    {
+        if (nSize == 0)
+            return nullptr;
+        return vSlot[Position(nullifier)].ptx;
+    }
+
+    bool count(const uint256& nullifier) const
+    {
+        return find(nullifier) != nullptr;
+    }
+
+    // Map nullifier to ptx, replacing any transaction it was mapped to.
+    void set(const uint256& nullifier, const CTransaction* ptx)
+    {
+        assert(ptx);
+        if ((nSize + 1) * 4 > vSlot.size() * 3)
+            Resize(std::max(MIN_CAPACITY, vSlot.size() * 2));
+
+        Slot& slot = vSlot[Position(nullifier)];
+        if (!slot.ptx) {
+            slot.nullifier = nullifier;
+            nSize++;
+        }
+        slot.ptx = ptx;
+    }
+
+    bool erase(const uint256& nullifier)
+    {
+        if (nSize == 0)
+            return false;
+
+        size_t i = Position(nullifier);
+        if (!vSlot[i].ptx)
+            return false;
+
+        // Move back the entries after i whose probe sequence passes i
+        for (size_t j = (i + 1) & Mask(); vSlot[j].ptx; j = (j + 1) & Mask()) {
+            size_t k = Bucket(vSlot[j].nullifier);
+            bool fInPlace = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+            if (!fInPlace) {
+                vSlot[i] = vSlot[j];
+                i = j;
+            }
+        }
+        vSlot[i] = Slot();
+        nSize--;
+
+        if (vSlot.size() > MIN_CAPACITY && nSize * 16 < vSlot.size())
+            Resize(vSlot.size() / 2);
+        return true;
+    }
+
+    void clear()
+    {
+        std::vector<Slot>().swap(vSlot);
+        nSize = 0;
+    }
+
+    // Call f(nullifier, ptx) for every entry, in no particular order.
+    template <typename F>
+    void ForEach(F f) const
+    {
+        for (const Slot& slot : vSlot) {
+            if (slot.ptx)
+                f(slot.nullifier, slot.ptx);
+        }
+    }
+
+    size_t DynamicMemoryUsage() const
+    {
+        return memusage::DynamicUsage(vSlot);
+    }
+};
+
+#endif // L2L_NULLIFIER_MAP_H
@@ -4,12 +4,111 @@
 
 #include <proof_verifier.h>
 
+#include <crypto/sha256.h>
+#include <cuckoocache.h>
+#include <random.h>
+#include <script/sigcache.h>
+#include <util/system.h>
 #include <zcash/JoinSplit.hpp>
 
+#include <atomic>
 #include <variant>
 
+#include <boost/thread.hpp>
+
+#include <rust/metrics.h>
 #include <rust/sprout.h>
 
+namespace {
+/**
+ * Valid JoinSplit cache, to avoid verifying the proof of a Sprout JoinSplit
+ * twice (once when accepted into the memory pool, and again when accepted
+ * into the block chain)
+ */
+class CJoinSplitCache
+{
+private:
+    //! Entries are SHA256(nonce || proof || public inputs of the proof)
+    uint256 nonce;
+    typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
+    map_type setValid;
+    bool fSetup = false;
+    boost::shared_mutex cs_joinsplitcache;
+    std::atomic<uint64_t> nHits{0};
+    std::atomic<uint64_t> nMisses{0};
+
+public:
+    CJoinSplitCache()
+    {
+        GetRandBytes(nonce.begin(), 32);
+    }
+
+    void
+    ComputeEntry(uint256& entry, const libzcash::GrothProof& proof, const JSDescription& jsdesc, const uint256& h_sig)
+    {
+        CSHA256 hasher;
+        hasher.Write(nonce.begin(), 32).Write(proof.data(), proof.size());
+        hasher.Write(jsdesc.anchor.begin(), 32).Write(h_sig.begin(), 32);
+        for (const uint256& mac : jsdesc.macs)
+            hasher.Write(mac.begin(), 32);
+        for (const uint256& nf : jsdesc.nullifiers)
+            hasher.Write(nf.begin(), 32);
+        for (const uint256& cm : jsdesc.commitments)
+            hasher.Write(cm.begin(), 32);
+        hasher.Write((const unsigned char*)&jsdesc.vpub_old, sizeof(jsdesc.vpub_old));
+        hasher.Write((const unsigned char*)&jsdesc.vpub_new, sizeof(jsdesc.vpub_new));
+        hasher.Finalize(entry.begin());
+    }
+
+    bool
+    Get(const uint256& entry, const bool erase)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_joinsplitcache);
+        bool fHit = fSetup && setValid.contains(entry, erase);
+        (fHit ? nHits : nMisses)++;
+        MetricsIncrementCounter("zcash.joinsplit.cache.lookups", "result", fHit ? "hit" : "miss");
+        return fHit;
+    }
+
+    void Set(uint256& entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_joinsplitcache);
+        if (fSetup)
+            setValid.insert(entry);
+    }
+
+    uint32_t setup_bytes(size_t n)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_joinsplitcache);
+        fSetup = true;
+        return setValid.setup_bytes(n);
+    }
+
+    libzcash::BundleCacheStats GetStats() const
+    {
+        libzcash::BundleCacheStats stats;
+        stats.nHits = nHits;
+        stats.nMisses = nMisses;
+        return stats;
+    }
+};
+
+static CJoinSplitCache joinSplitCache;
+}
+
+void InitJoinSplitCache(size_t nMaxCacheSize)
+{
+    if (nMaxCacheSize <= 0) return;
+    size_t nElems = joinSplitCache.setup_bytes(nMaxCacheSize);
+    LogPrintf("Using %zu MiB out of %zu requested for JoinSplit cache, able to store %zu elements\n",
+            (nElems*sizeof(uint256)) >>20, nMaxCacheSize>>20, nElems);
+}
+
+libzcash::BundleCacheStats GetJoinSplitCacheStats()
+{
+    return joinSplitCache.GetStats();
+}
+
 class SproutProofVerifier
 {
     ProofVerifier& verifier;
@@ -34,7 +133,12 @@ public:
     {
         uint256 h_sig = ZCJoinSplit::h_sig(jsdesc.randomSeed, jsdesc.nullifiers, joinSplitPubKey);
 
-        return sprout::verify(
+        uint256 entry;
+        joinSplitCache.ComputeEntry(entry, proof, jsdesc, h_sig);
+        if (joinSplitCache.Get(entry, !verifier.CacheStore()))
+            return true;
+
+        bool fValid = sprout::verify(
             proof,
             jsdesc.anchor.GetRawBytes(),
             h_sig.GetRawBytes(),
@@ -47,15 +151,18 @@ public:
             jsdesc.vpub_old,
             jsdesc.vpub_new
         );
+        if (fValid && verifier.CacheStore())
+            joinSplitCache.Set(entry);
+        return fValid;
     }
 };
 
-ProofVerifier ProofVerifier::Strict() {
-    return ProofVerifier(true);
+ProofVerifier ProofVerifier::Strict(bool cacheStore) {
+    return ProofVerifier(true, cacheStore);
 }
 
 ProofVerifier ProofVerifier::Disabled() {
-    return ProofVerifier(false);
+    return ProofVerifier(false, false);
 }
 
 bool ProofVerifier::VerifySprout(
@@ -7,14 +7,17 @@
 
 #include <primitives/transaction.h>
 #include <uint256.h>
+#include <zcash/cache.h>
 
 #include <rust/ed25519.h>
 
 class ProofVerifier {
 private:
     bool perform_verification;
+    bool cache_store;
 
-    ProofVerifier(bool perform_verification) : perform_verification(perform_verification) { }
+    ProofVerifier(bool perform_verification, bool cache_store) :
+        perform_verification(perform_verification), cache_store(cache_store) { }
 
 public:
     // ProofVerifier should never be copied
@@ -24,14 +27,24 @@ public:
     ProofVerifier& operator=(ProofVerifier&&);
 
     // Creates a verification context that strictly verifies
-    // all proofs.
-    static ProofVerifier Strict();
+    // all proofs. With cacheStore, proofs that verify are added
+    // to the JoinSplit cache, for transactions entering the
+    // mempool; otherwise a proof found in the cache is removed
+    // from it when the cache needs the space, as a block's
+    // proofs won't be looked up again.
+    static ProofVerifier Strict(bool cacheStore = false);
 
     // Creates a verification context that performs no
     // verification, used when avoiding duplicate effort
     // such as during reindexing.
     static ProofVerifier Disabled();
 
+    // Returns false if this context skips verification.
+    bool PerformsVerification() const { return perform_verification; }
+
+    // Returns true if verified proofs are added to the JoinSplit cache.
+    bool CacheStore() const { return cache_store; }
+
     // Verifies that the JoinSplit proof is correct.
     bool VerifySprout(
         const JSDescription& jsdesc,
@@ -39,4 +52,12 @@ public:
     );
 };
 
+// Sets up the cache of JoinSplit proofs known to be valid, which strict
+// ProofVerifiers consult before verifying a proof, and add to afterwards
+// if they were created with cacheStore.
+void InitJoinSplitCache(size_t nMaxCacheSize);
+
+// Returns the number of lookups in the JoinSplit cache, by outcome.
+libzcash::BundleCacheStats GetJoinSplitCacheStats();
+
 #endif // ZCASH_PROOF_VERIFIER_H
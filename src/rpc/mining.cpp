@@ -15,6 +15,7 @@
 #include "crypto/equihash.h"
 #endif
 #include "deprecation.h"
+#include "drivechain.h"
 #include "init.h"
 #include "key_io.h"
 #include "main.h"
@@ -224,12 +225,8 @@ UniValue generate(const UniValue& params, bool fHelp)
     }
     unsigned int nExtraNonce = 0;
     UniValue blockHashes(UniValue::VARR);
-    unsigned int n = Params().GetConsensus().nEquihashN;
-    unsigned int k = Params().GetConsensus().nEquihashK;
     while (nHeight < nHeightEnd)
     {
-    	unsigned int nAttempts = 100; // Limit the PoW grind while loop
-		
     	if (DEBUG_RPC_MINING)
     	    LogPrintf("%s: Working on new block", __func__);
 
@@ -242,18 +239,8 @@ UniValue generate(const UniValue& params, bool fHelp)
             IncrementExtraNonce(pblocktemplate.get(), chainActive.Tip(), nExtraNonce, Params().GetConsensus());
         }
 
-        while (true) {
-            pblock->nNonce = ArithToUint256(UintToArith256(pblock->nNonce) + 1);
-            if (CheckProofOfWork(pblock->GetHash(), pblock->nBits, Params().GetConsensus()))
-                break;
-	    
-	    if (nAttempts == 0) {
-    	    	if (DEBUG_RPC_MINING)
-    	            LogPrintf("%s: Failed to find PoW", __func__);
-                break;
-	    }
-	    nAttempts--;
-	}
+        if (!MineBlockBMM(*pblock, Params(), 60))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Couldn't get the block's BMM commitment confirmed");
 
     	if (DEBUG_RPC_MINING)
     	    LogPrintf("%s: Found block!", __func__);
@@ -494,6 +481,7 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
             "  \"sizelimit\" : n,                   (numeric) limit of block size\n"
             "  \"curtime\" : ttt,                   (numeric) current timestamp in seconds since epoch (Jan 1 1970 GMT)\n"
             "  \"bits\" : \"xxx\",                    (string) compressed target of next block\n"
+            "  \"depositsnapshotage\" : n,           (numeric, optional) seconds since the drivechain deposits paid out by the coinbase were read\n"
             "  \"height\" : n                       (numeric) The height of the next block\n"
             "}\n"
 
@@ -585,7 +573,10 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
 
     static unsigned int nTransactionsUpdatedLast;
     static std::optional<CMutableTransaction> cached_next_cb_mtx;
+    // Deposits paid out by cached_next_cb_mtx
+    static std::vector<DrivechainDeposit> cached_next_cb_deposits;
     static int cached_next_cb_height;
+    static CBlockTemplate* pblocktemplate;
 
     // Use the cached shielded coinbase only if the height hasn't changed.
     const int nHeight = chainActive.Tip()->nHeight;
@@ -617,6 +608,11 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
             nTransactionsUpdatedLastLP = nTransactionsUpdatedLast;
         }
 
+        // Deposits paid out by the template for the block on hashWatchedChain
+        std::shared_ptr<const CDepositPayoutSnapshot> pTemplateDeposits;
+        if (pblocktemplate && pblocktemplate->block.hashPrevBlock == hashWatchedChain)
+            pTemplateDeposits = pblocktemplate->pDepositPayouts;
+
         // Release the main lock while waiting
         // Don't call chainActive->Tip() without holding cs_main
         LEAVE_CRITICAL_SECTION(cs_main);
@@ -633,9 +629,16 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
                 // but instead is included in, the 10 second delay, since we're waiting
                 // until an absolute time is reached.
                 if (!cached_next_cb_mtx && IsShieldedMinerAddress(minerAddress)) {
+                    // Pay out the deposits we expect to still be unpaid after
+                    // the next block, assuming it pays out the same deposits
+                    // as our template for it. The guess is checked once the
+                    // next block arrives.
+                    std::shared_ptr<const CDepositPayoutSnapshot> pUnpaid = GetDepositPayouts(hashWatchedChain);
                     cached_next_cb_height = nHeight + 2;
+                    cached_next_cb_deposits = GetExpectedDepositPayouts(pUnpaid->vDeposit,
+                            pTemplateDeposits ? pTemplateDeposits->vDeposit : pUnpaid->vDeposit);
                     cached_next_cb_mtx = CreateCoinbaseTransaction(
-                        Params(), CAmount{0}, minerAddress, cached_next_cb_height);
+                        Params(), CAmount{0}, minerAddress, cached_next_cb_height, cached_next_cb_deposits);
                     next_cb_mtx = cached_next_cb_mtx;
                 }
                 bool timedout = g_best_block_cv.wait_until(lock, checktxtime) == std::cv_status::timeout;
@@ -664,10 +667,20 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         // TODO: Maybe recheck connections/IBD and (if something wrong) send an expires-immediately template to stop miners?
     }
 
+    // Only use the precomputed coinbase if it pays out exactly the deposits
+    // that are unpaid after the new tip
+    std::shared_ptr<const CDepositPayoutSnapshot> pNextDeposits;
+    if (next_cb_mtx) {
+        pNextDeposits = GetDepositPayouts(chainActive.Tip()->GetBlockHash());
+        if (!SameDepositPayouts(pNextDeposits->vDeposit, cached_next_cb_deposits)) {
+            LogPrint("rpc", "%s: precomputed coinbase pays out other deposits than expected\n", __func__);
+            next_cb_mtx = nullopt;
+        }
+    }
+
     // Update block
     static CBlockIndex* pindexPrev;
     static int64_t nStart;
-    static CBlockTemplate* pblocktemplate;
     if (!lpval.isNull() || pindexPrev != chainActive.Tip() ||
         (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
     {
@@ -697,14 +710,13 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
             throw JSONRPCError(RPC_INTERNAL_ERROR, "No miner address available (mining requires a wallet or -mineraddress)");
         }
 
-        // TODO 
-        // For drivechain pre-computed coinbases might need to be disabled.
-        // Or figure out how to add drivechain outputs to the pre-computed 
-        // coinbase next_cb_mtx
         pblocktemplate = BlockAssembler(Params()).CreateNewBlock(minerAddress, next_cb_mtx);
         if (!pblocktemplate)
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
+        if (next_cb_mtx)
+            pblocktemplate->pDepositPayouts = pNextDeposits;
+
         // Mark script as important because it was used at least for one coinbase output
         std::visit(KeepMinerAddress(), minerAddress);
 
@@ -819,6 +831,8 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     result.pushKV("sizelimit", (int64_t)MAX_BLOCK_SIZE);
     result.pushKV("curtime", pblock->GetBlockTime());
     result.pushKV("bits", strprintf("%08x", pblock->nBits));
+    if (pblocktemplate->pDepositPayouts && pblocktemplate->pDepositPayouts->nTime)
+        result.pushKV("depositsnapshotage", GetTime() - pblocktemplate->pDepositPayouts->nTime);
     result.pushKV("height", (int64_t)(pindexPrev->nHeight+1));
 
     return result;
@@ -6,12 +6,14 @@
 
 #include "clientversion.h"
 #include "deprecation.h"
+#include "drivechain.h"
 #include "init.h"
 #include "key_io.h"
 #include "experimental_features.h"
 #include "main.h"
 #include "net.h"
 #include "netbase.h"
+#include "proof_verifier.h"
 #include "rpc/server.h"
 #include "txmempool.h"
 #include "util/system.h"
@@ -1230,6 +1232,16 @@ UniValue getmemoryinfo(const UniValue& params, bool fHelp)
             "    \"locked\": xxxxxx,       (numeric) Amount of bytes that succeeded locking. If this number is smaller than total, locking pages failed at some point and key data could be swapped to disk.\n"
             "    \"chunks_used\": xxxxx,   (numeric) Number allocated chunks\n"
             "    \"chunks_free\": xxxxx,   (numeric) Number unused chunks\n"
+            "  },\n"
+            "  \"mainchain\": {            (json object) Information about the mainchain block hash cache\n"
+            "    \"blocks\": xxxxx,        (numeric) Number of cached mainchain block hashes\n"
+            "    \"usage\": xxxxx,         (numeric) Number of bytes used by the cache\n"
+            "  },\n"
+            "  \"validitycaches\": {       (json object) Lookups in the caches of verified proofs, by cache\n"
+            "    \"joinsplit\"|\"sapling\"|\"orchard\": {\n"
+            "      \"hits\": xxxxx,        (numeric) Number of lookups that found the entry\n"
+            "      \"misses\": xxxxx,      (numeric) Number of lookups that didn't\n"
+            "    }\n"
             "  }\n"
             "}\n"
             "\nExamples:\n"
@@ -1238,6 +1250,24 @@ UniValue getmemoryinfo(const UniValue& params, bool fHelp)
         );
     UniValue obj(UniValue::VOBJ);
     obj.pushKV("locked", RPCLockedMemoryInfo());
+
+    std::shared_ptr<const CMainBlockCacheSnapshot> pCache = GetMainBlockCacheSnapshot();
+    UniValue mainchain(UniValue::VOBJ);
+    mainchain.pushKV("blocks", (uint64_t)pCache->Hashes().size());
+    mainchain.pushKV("usage", (uint64_t)pCache->index.DynamicMemoryUsage());
+    obj.pushKV("mainchain", mainchain);
+
+    auto cacheStats = [](const libzcash::BundleCacheStats& stats) {
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("hits", stats.nHits);
+        entry.pushKV("misses", stats.nMisses);
+        return entry;
+    };
+    UniValue validitycaches(UniValue::VOBJ);
+    validitycaches.pushKV("joinsplit", cacheStats(GetJoinSplitCacheStats()));
+    validitycaches.pushKV("sapling", cacheStats(libzcash::GetBundleCacheStats("Sapling")));
+    validitycaches.pushKV("orchard", cacheStats(libzcash::GetBundleCacheStats("Orchard")));
+    obj.pushKV("validitycaches", validitycaches);
     return obj;
 }
 
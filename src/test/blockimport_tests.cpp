@@ -0,0 +1,98 @@
+// Copyright (c) 2025 L2L
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "streams.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockimport_tests)
+
+#ifdef ENABLE_MINING
+
+// The blocks after genesis of a 100 block regtest chain
+static std::vector<CBlock> MakeChain()
+{
+    TestChain100Setup setup;
+    LOCK(cs_main);
+    std::vector<CBlock> vBlock;
+    for (int nHeight = 1; nHeight <= chainActive.Height(); nHeight++) {
+        CBlock block;
+        BOOST_REQUIRE(ReadBlockFromDisk(block, chainActive[nHeight], Params().GetConsensus()));
+        vBlock.push_back(block);
+    }
+    return vBlock;
+}
+
+// Write the blocks to nFiles files in the format of the block files, and
+// return their paths
+static std::vector<fs::path> WriteImportFiles(const fs::path& dir, const std::vector<CBlock>& vBlock, size_t nFiles)
+{
+    std::vector<fs::path> vPath;
+    for (size_t n = 0; n < nFiles; n++) {
+        vPath.push_back(dir / strprintf("import%u.dat", n));
+        CAutoFile fileout(fsbridge::fopen(vPath.back(), "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!fileout.IsNull());
+        for (size_t i = n * vBlock.size() / nFiles; i < (n + 1) * vBlock.size() / nFiles; i++) {
+            unsigned int nSize = GetSerializeSize(fileout, vBlock[i]);
+            fileout << FLATDATA(Params().MessageStart()) << nSize << vBlock[i];
+        }
+    }
+    return vPath;
+}
+
+BOOST_AUTO_TEST_CASE(import_block_files)
+{
+    const std::vector<CBlock> vBlock = MakeChain();
+    BOOST_REQUIRE_EQUAL(vBlock.size(), 100);
+
+    for (int nThreads : {1, 3}) {
+        TestingSetup setup(CBaseChainParams::REGTEST);
+        std::vector<fs::path> vPath = WriteImportFiles(setup.pathTemp, vBlock, 4);
+
+        ImportBlockFiles(Params(), vPath, false, nThreads);
+
+        // Blocks are connected while the files are imported, the rest of the
+        // way by the next ActivateBestChain
+        CValidationState state;
+        BOOST_CHECK(ActivateBestChain(state, Params()));
+        LOCK(cs_main);
+        BOOST_CHECK_EQUAL(chainActive.Height(), 100);
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == vBlock.back().GetHash());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(import_block_files_interrupted)
+{
+    const std::vector<CBlock> vBlock = MakeChain();
+
+    TestingSetup setup(CBaseChainParams::REGTEST);
+    std::vector<fs::path> vPath = WriteImportFiles(setup.pathTemp, vBlock, 4);
+
+    // Interrupting the import stops all of its threads, which join returning shows
+    bool fInterrupted = false;
+    boost::thread thread([&] {
+        try {
+            ImportBlockFiles(Params(), vPath, false, 2);
+        } catch (const boost::thread_interrupted&) {
+            fInterrupted = true;
+        }
+    });
+    thread.interrupt();
+    thread.join();
+
+    // The import may have finished before it saw the interruption
+    LOCK(cs_main);
+    BOOST_CHECK(fInterrupted || mapBlockIndex.size() == vBlock.size() + 1);
+    BOOST_CHECK(chainActive.Height() <= 100);
+}
+
+#endif // ENABLE_MINING
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,331 @@
+// Copyright (c) 2025 L2L
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "util/time.h"
+
+#include "test/test_bitcoin.h"
+#include "checkpool.h"
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+#include <atomic>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+static const int nCheckPoolThreads = 8;
+
+BOOST_FIXTURE_TEST_SUITE(checkpool_tests, BasicTestingSetup)
+
+struct CountingCheck {
+    static std::atomic<size_t> n_calls;
+    bool operator()()
+    {
+        ++n_calls;
+        return true;
+    }
+    void swap(CountingCheck& x){};
+};
+
+struct SlowCheck {
+    static std::atomic<size_t> n_calls;
+    bool operator()()
+    {
+        ++n_calls;
+        MilliSleep(1);
+        return true;
+    }
+    void swap(SlowCheck& x){};
+};
+
+struct FailingCheck {
+    bool fails;
+    FailingCheck(bool fails) : fails(fails){};
+    FailingCheck() : fails(true){};
+    bool operator()()
+    {
+        return !fails;
+    }
+    void swap(FailingCheck& x)
+    {
+        std::swap(fails, x.fails);
+    };
+};
+
+struct UniqueCheck {
+    static std::mutex m;
+    static std::unordered_multiset<size_t> results;
+    size_t check_id;
+    UniqueCheck(size_t check_id_in) : check_id(check_id_in){};
+    UniqueCheck() : check_id(0){};
+    bool operator()()
+    {
+        std::lock_guard<std::mutex> l(m);
+        results.insert(check_id);
+        return true;
+    }
+    void swap(UniqueCheck& x) { std::swap(x.check_id, check_id); };
+};
+
+struct MemoryCheck {
+    static std::atomic<size_t> fake_allocated_memory;
+    bool b {false};
+    bool operator()()
+    {
+        return true;
+    }
+    MemoryCheck(){};
+    MemoryCheck(const MemoryCheck& x) : b(x.b)
+    {
+        fake_allocated_memory += b;
+    };
+    MemoryCheck(bool b_) : b(b_)
+    {
+        fake_allocated_memory += b;
+    };
+    ~MemoryCheck(){
+        fake_allocated_memory -= b;
+    };
+    void swap(MemoryCheck& x) { std::swap(b, x.b); };
+};
+
+struct OwnerCheck {
+    static std::mutex m;
+    static std::vector<std::pair<int, boost::thread::id>> runs;
+    int control;
+    OwnerCheck(int control_in) : control(control_in){};
+    OwnerCheck() : control(-1){};
+    bool operator()()
+    {
+        std::lock_guard<std::mutex> l(m);
+        runs.emplace_back(control, boost::this_thread::get_id());
+        return true;
+    }
+    void swap(OwnerCheck& x) { std::swap(x.control, control); };
+};
+
+std::atomic<size_t> CountingCheck::n_calls{0};
+std::atomic<size_t> SlowCheck::n_calls{0};
+std::mutex UniqueCheck::m;
+std::unordered_multiset<size_t> UniqueCheck::results;
+std::atomic<size_t> MemoryCheck::fake_allocated_memory{0};
+std::mutex OwnerCheck::m;
+std::vector<std::pair<int, boost::thread::id>> OwnerCheck::runs;
+
+static void StartPool(CCheckPool& pool, boost::thread_group& tg)
+{
+    for (auto x = 0; x < nCheckPoolThreads; ++x) {
+        tg.create_thread([&]{pool.Thread();});
+    }
+}
+
+/** Test that every check is run exactly as often as it was added */
+BOOST_AUTO_TEST_CASE(test_CheckPool_Correct)
+{
+    CCheckPool pool(nCheckPoolThreads);
+    boost::thread_group tg;
+    StartPool(pool, tg);
+
+    std::vector<CountingCheck> vChecks;
+    for (size_t i : {0, 1, 2, 15, 16, 17, 1000, 100000}) {
+        size_t total = i;
+        CountingCheck::n_calls = 0;
+        CCheckPoolControl control(&pool);
+        while (total) {
+            vChecks.resize(std::min(total, (size_t) InsecureRandRange(10)));
+            total -= vChecks.size();
+            control.Add(vChecks);
+        }
+        BOOST_REQUIRE(control.Wait());
+        BOOST_REQUIRE_EQUAL(CountingCheck::n_calls, i);
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+/** Test that failing checks are caught, and don't affect the next control */
+BOOST_AUTO_TEST_CASE(test_CheckPool_Catches_Failure)
+{
+    CCheckPool pool(nCheckPoolThreads);
+    boost::thread_group tg;
+    StartPool(pool, tg);
+
+    for (size_t i = 0; i < 1001; ++i) {
+        CCheckPoolControl control(&pool);
+        size_t remaining = i;
+        while (remaining) {
+            size_t r = InsecureRandRange(10);
+
+            std::vector<FailingCheck> vChecks;
+            vChecks.reserve(r);
+            for (size_t k = 0; k < r && remaining; k++, remaining--)
+                vChecks.emplace_back(remaining == 1);
+            control.Add(vChecks);
+        }
+        BOOST_REQUIRE_EQUAL(control.Wait(), i == 0);
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+/** Test that checks are all called, and called only once */
+BOOST_AUTO_TEST_CASE(test_CheckPool_UniqueCheck)
+{
+    CCheckPool pool(nCheckPoolThreads);
+    boost::thread_group tg;
+    StartPool(pool, tg);
+
+    size_t COUNT = 100000;
+    size_t total = COUNT;
+    UniqueCheck::results.clear();
+    {
+        CCheckPoolControl control(&pool);
+        while (total) {
+            size_t r = InsecureRandRange(10);
+            std::vector<UniqueCheck> vChecks;
+            for (size_t k = 0; k < r && total; k++)
+                vChecks.emplace_back(--total);
+            control.Add(vChecks);
+        }
+    }
+    BOOST_REQUIRE_EQUAL(UniqueCheck::results.size(), COUNT);
+    bool r = true;
+    for (size_t i = 0; i < COUNT; ++i)
+        r = r && UniqueCheck::results.count(i) == 1;
+    BOOST_REQUIRE(r);
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+/** Test that checks are freed by the time the control is done */
+BOOST_AUTO_TEST_CASE(test_CheckPool_Memory)
+{
+    CCheckPool pool(nCheckPoolThreads);
+    boost::thread_group tg;
+    StartPool(pool, tg);
+
+    for (size_t i = 0; i < 1000; ++i) {
+        size_t total = i;
+        {
+            CCheckPoolControl control(&pool);
+            while (total) {
+                size_t r = InsecureRandRange(10);
+                std::vector<MemoryCheck> vChecks;
+                for (size_t k = 0; k < r && total; k++) {
+                    total--;
+                    vChecks.emplace_back(total == 0 || total == i || total == i/2);
+                }
+                control.Add(vChecks);
+            }
+        }
+        BOOST_REQUIRE_EQUAL(MemoryCheck::fake_allocated_memory, 0);
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+/** Test that one control can mix check types, and several controls can run at once */
+BOOST_AUTO_TEST_CASE(test_CheckPool_Heterogeneous)
+{
+    CCheckPool pool(nCheckPoolThreads);
+    boost::thread_group tg;
+    StartPool(pool, tg);
+
+    CountingCheck::n_calls = 0;
+    SlowCheck::n_calls = 0;
+    std::atomic<int> fails {0};
+    boost::thread_group masters;
+    for (int m = 0; m < 4; ++m) {
+        masters.create_thread([&]{
+            CCheckPoolControl control(&pool);
+            for (int i = 0; i < 50; ++i) {
+                std::vector<CountingCheck> vCounting(20);
+                std::vector<SlowCheck> vSlow(1);
+                std::vector<FailingCheck> vFailing(2, false);
+                control.Add(vCounting);
+                control.Add(vSlow);
+                control.Add(vFailing);
+            }
+            fails += !control.Wait();
+        });
+    }
+    masters.join_all();
+    BOOST_CHECK_EQUAL(fails, 0);
+    BOOST_CHECK_EQUAL(CountingCheck::n_calls, 4 * 50 * 20);
+    BOOST_CHECK_EQUAL(SlowCheck::n_calls, 4 * 50);
+
+    // A failure of one type fails the whole control.
+    {
+        CCheckPoolControl control(&pool);
+        std::vector<CountingCheck> vCounting(100);
+        std::vector<FailingCheck> vFailing(1, true);
+        control.Add(vCounting);
+        control.Add(vFailing);
+        BOOST_CHECK(!control.Wait());
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+/** Test that a master only runs the checks of its own control */
+BOOST_AUTO_TEST_CASE(test_CheckPool_MastersRunOwnChecks)
+{
+    CCheckPool pool(nCheckPoolThreads);
+    boost::thread_group tg;
+    StartPool(pool, tg);
+
+    const int nMasters = 4;
+    std::vector<boost::thread::id> vMaster(nMasters);
+    OwnerCheck::runs.clear();
+    std::atomic<int> fails {0};
+    boost::thread_group masters;
+    for (int m = 0; m < nMasters; ++m) {
+        masters.create_thread([&, m]{
+            vMaster[m] = boost::this_thread::get_id();
+            CCheckPoolControl control(&pool);
+            for (int i = 0; i < 200; ++i) {
+                std::vector<OwnerCheck> vChecks(10, OwnerCheck(m));
+                control.Add(vChecks);
+            }
+            fails += !control.Wait();
+        });
+    }
+    masters.join_all();
+
+    BOOST_CHECK_EQUAL(fails, 0);
+    BOOST_REQUIRE_EQUAL(OwnerCheck::runs.size(), nMasters * 200 * 10);
+    for (const auto& run : OwnerCheck::runs) {
+        for (int m = 0; m < nMasters; ++m) {
+            if (run.second == vMaster[m])
+                BOOST_REQUIRE_EQUAL(run.first, m);
+        }
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+/** Test that controls still complete without workers, or beyond the control limit */
+BOOST_AUTO_TEST_CASE(test_CheckPool_NoWorkers)
+{
+    CCheckPool pool(nCheckPoolThreads, 1);
+    CountingCheck::n_calls = 0;
+    {
+        CCheckPoolControl control(&pool);
+        CCheckPoolControl inline_control(&pool);
+        CCheckPoolControl null_control(nullptr);
+        std::vector<CountingCheck> vChecks(100);
+        control.Add(vChecks);
+        vChecks.resize(100);
+        inline_control.Add(vChecks);
+        vChecks.resize(100);
+        null_control.Add(vChecks);
+        // Checks added to a control without a deque have run already.
+        BOOST_CHECK_EQUAL(CountingCheck::n_calls, 200);
+        BOOST_CHECK(control.Wait());
+        BOOST_CHECK(inline_control.Wait());
+        BOOST_CHECK(null_control.Wait());
+    }
+    BOOST_CHECK_EQUAL(CountingCheck::n_calls, 300);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
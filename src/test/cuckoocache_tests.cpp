@@ -6,6 +6,7 @@
 #include "script/sigcache.h"
 #include "test/test_bitcoin.h"
 #include "random.h"
+#include "zcash/cache.h"
 #include <thread>
 #include <boost/thread.hpp>
 
@@ -379,4 +380,25 @@ BOOST_AUTO_TEST_CASE(cuckoocache_generations)
     test_cache_generations<CuckooCache::cache<uint256, SignatureCacheHasher>>();
 }
 
+BOOST_AUTO_TEST_CASE(bundle_cache_stats)
+{
+    local_rand_ctx = FastRandomContext(true);
+    libzcash::BundleValidityCache cc{};
+    cc.setup_bytes(1 << 20);
+
+    libzcash::BundleCacheEntry e1, e2;
+    for (size_t i = 0; i < e1.size(); i++) {
+        e1[i] = local_rand_ctx.rand32();
+        e2[i] = local_rand_ctx.rand32();
+    }
+    cc.insert(e1);
+
+    BOOST_CHECK(cc.contains(e1, false));
+    BOOST_CHECK(!cc.contains(e2, false));
+    BOOST_CHECK(cc.contains(e1, false));
+    libzcash::BundleCacheStats stats = cc.GetStats();
+    BOOST_CHECK_EQUAL(stats.nHits, 2);
+    BOOST_CHECK_EQUAL(stats.nMisses, 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END();
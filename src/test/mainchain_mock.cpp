@@ -0,0 +1,291 @@
+// Copyright (c) 2025 L2L
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "test/mainchain_mock.h"
+
+#include "hash.h"
+#include "rpc/protocol.h"
+#include "tinyformat.h"
+#include "util/strencodings.h"
+
+#include <chrono>
+#include <istream>
+
+using boost::asio::ip::tcp;
+
+CMainchainMock::CMainchainMock(int nBlocks) :
+    acceptor(io, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0))
+{
+    Mine(nBlocks);
+    threadAccept = std::thread([this] { AcceptLoop(); });
+}
+
+CMainchainMock::~CMainchainMock()
+{
+    Uninstall();
+
+    fStop = true;
+
+    // Wake up the blocking accept
+    {
+        boost::asio::io_context ioWake;
+        tcp::socket wake(ioWake);
+        boost::system::error_code error;
+        wake.connect(acceptor.local_endpoint(), error);
+    }
+    threadAccept.join();
+
+    // Unblock the connections waiting for another request
+    std::vector<std::thread> vJoin;
+    {
+        LOCK(cs);
+        for (const auto& socket : vSocket) {
+            boost::system::error_code error;
+            socket->shutdown(tcp::socket::shutdown_both, error);
+        }
+        vJoin.swap(vThread);
+    }
+    for (std::thread& thread : vJoin)
+        thread.join();
+}
+
+void CMainchainMock::Install()
+{
+    SetMainchainRPCEndpoint("127.0.0.1", GetPort());
+    SetDrivechainDepositSource([this](const uint256& hashBlock, std::vector<DrivechainDeposit>& vDepositOut) {
+        LOCK(cs);
+        vDepositOut.clear();
+        for (const DrivechainDeposit& deposit : vDeposit) {
+            if (deposit.hashMainchainBlock == hashBlock)
+                vDepositOut.push_back(deposit);
+        }
+        return true;
+    });
+    SetBMMRequestHandler([this](const uint256& hashHStar, uint256& hashMainBlock, int64_t nTimeout) {
+        Mine(1);
+        LOCK(cs);
+        hashMainBlock = vBlockHash.back();
+        vBMMCommit.emplace_back(hashMainBlock, hashHStar);
+        return true;
+    });
+    fInstalled = true;
+}
+
+void CMainchainMock::Uninstall()
+{
+    if (!fInstalled)
+        return;
+
+    SetMainchainRPCEndpoint(DEFAULT_MAINCHAIN_RPC_HOST, DEFAULT_MAINCHAIN_RPC_PORT);
+    SetDrivechainDepositSource(nullptr);
+    SetBMMRequestHandler(nullptr);
+    fInstalled = false;
+}
+
+int CMainchainMock::GetPort() const
+{
+    return acceptor.local_endpoint().port();
+}
+
+void CMainchainMock::Mine(int nBlocks)
+{
+    LOCK(cs);
+    for (int i = 0; i < nBlocks; i++)
+        vBlockHash.push_back(SerializeHash(nNextBlock++));
+}
+
+void CMainchainMock::Reorg(int nDepth, int nBlocks)
+{
+    {
+        LOCK(cs);
+        assert(nDepth >= 0 && nDepth < (int)vBlockHash.size());
+        vBlockHash.resize(vBlockHash.size() - nDepth);
+    }
+    Mine(nBlocks);
+}
+
+std::vector<uint256> CMainchainMock::GetBlockHashes() const
+{
+    LOCK(cs);
+    return vBlockHash;
+}
+
+void CMainchainMock::AddDeposits(int nDeposits, CAmount amount)
+{
+    Mine(1);
+
+    LOCK(cs);
+    for (int i = 0; i < nDeposits; i++) {
+        DrivechainDeposit deposit;
+        deposit.strDest = strprintf("Deposit%d", vDeposit.size());
+        deposit.amount = amount;
+        deposit.nBurnIndex = 0;
+        deposit.nTx = i + 1;
+        deposit.hashMainchainBlock = vBlockHash.back();
+        vDeposit.push_back(deposit);
+    }
+}
+
+std::vector<std::pair<uint256, uint256>> CMainchainMock::GetBMMCommits() const
+{
+    LOCK(cs);
+    return vBMMCommit;
+}
+
+void CMainchainMock::SetMethod(const std::string& strMethod, Method method)
+{
+    LOCK(cs);
+    mapMethod[strMethod] = method;
+}
+
+void CMainchainMock::SetHTTPHandler(HTTPHandler handler)
+{
+    LOCK(cs);
+    httpHandler = handler;
+}
+
+void CMainchainMock::AcceptLoop()
+{
+    while (!fStop) {
+        auto socket = std::make_shared<tcp::socket>(io);
+        boost::system::error_code error;
+        acceptor.accept(*socket, error);
+        if (error || fStop)
+            break;
+
+        nConnections++;
+        LOCK(cs);
+        vSocket.push_back(socket);
+        vThread.emplace_back([this, socket] { Serve(socket); });
+    }
+}
+
+void CMainchainMock::Serve(std::shared_ptr<tcp::socket> socket)
+{
+    boost::asio::streambuf buf;
+    for (;;) {
+        boost::system::error_code error;
+        boost::asio::read_until(*socket, buf, "\r\n\r\n", error);
+        if (error)
+            return;
+
+        std::istream is(&buf);
+        std::string strLine;
+        size_t nContentLength = 0;
+        while (std::getline(is, strLine) && strLine != "\r") {
+            if (strLine.rfind("Content-Length:", 0) == 0)
+                nContentLength = atoi(strLine.substr(15));
+        }
+        if (buf.size() < nContentLength)
+            boost::asio::read(*socket, buf, boost::asio::transfer_exactly(nContentLength - buf.size()), error);
+        if (error)
+            return;
+
+        auto begin = boost::asio::buffers_begin(buf.data());
+        std::string strRequest(begin, begin + nContentLength);
+        buf.consume(nContentLength);
+        nRequests++;
+
+        HTTPHandler handler;
+        {
+            LOCK(cs);
+            handler = httpHandler;
+        }
+        std::pair<int, std::string> reply = handler ? handler(strRequest) : std::make_pair(200, HandleRequest(strRequest));
+
+        if (nLatency > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(nLatency));
+
+        const CloseMode modeNow = mode;
+        std::string strReply = strprintf("HTTP/1.1 %d OK\r\n", reply.first);
+        strReply += "Content-Type: application/json\r\n";
+        if (modeNow == CloseMode::CLOSE_HEADER)
+            strReply += "Connection: close\r\n";
+        if (fChunked) {
+            // Use small chunks so that they straddle the client's reads
+            strReply += "Transfer-Encoding: chunked\r\n\r\n";
+            for (size_t i = 0; i < reply.second.size(); i += 7) {
+                std::string strChunk = reply.second.substr(i, 7);
+                strReply += strprintf("%x\r\n%s\r\n", strChunk.size(), strChunk);
+            }
+            strReply += "0\r\n\r\n";
+        } else {
+            strReply += strprintf("Content-Length: %u\r\n\r\n", reply.second.size());
+            strReply += reply.second;
+        }
+        boost::asio::write(*socket, boost::asio::buffer(strReply), error);
+        if (error)
+            return;
+
+        if (modeNow != CloseMode::KEEP_ALIVE) {
+            LOCK(cs);
+            socket->close(error);
+            return;
+        }
+    }
+}
+
+std::string CMainchainMock::HandleRequest(const std::string& strRequest)
+{
+    UniValue request;
+    if (!request.read(strRequest))
+        return JSONRPCReply(NullUniValue, JSONRPCError(RPC_PARSE_ERROR, "Parse error"), NullUniValue);
+
+    if (!request.isArray())
+        return HandleCall(request).write() + "\n";
+
+    UniValue reply(UniValue::VARR);
+    for (size_t i = 0; i < request.size(); i++)
+        reply.push_back(HandleCall(request[i]));
+    return reply.write() + "\n";
+}
+
+UniValue CMainchainMock::HandleCall(const UniValue& call)
+{
+    const UniValue& id = find_value(call, "id");
+    const UniValue& method = find_value(call, "method");
+    if (!method.isStr())
+        return JSONRPCReplyObj(NullUniValue, JSONRPCError(RPC_INVALID_REQUEST, "Method must be a string"), id);
+
+    const UniValue& params = find_value(call, "params");
+
+    Method handler;
+    {
+        LOCK(cs);
+        auto it = mapMethod.find(method.get_str());
+        if (it != mapMethod.end())
+            handler = it->second;
+    }
+
+    try {
+        if (handler)
+            return JSONRPCReplyObj(handler(params), NullUniValue, id);
+        return JSONRPCReplyObj(CallBuiltin(method.get_str(), params), NullUniValue, id);
+    } catch (const UniValue& error) {
+        return JSONRPCReplyObj(NullUniValue, error, id);
+    }
+}
+
+UniValue CMainchainMock::CallBuiltin(const std::string& strMethod, const UniValue& params)
+{
+    LOCK(cs);
+
+    if (strMethod == "getblockcount") {
+        // Like bitcoin core, the genesis block is not counted
+        return (int64_t)vBlockHash.size() - 1;
+    }
+
+    if (strMethod == "getblockhash") {
+        if (!params.isArray() || params.size() != 1 || !params[0].isNum())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Expected block height");
+
+        int64_t nHeight = params[0].get_int64();
+        if (nHeight < 0 || nHeight >= (int64_t)vBlockHash.size())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+
+        return vBlockHash[nHeight].GetHex();
+    }
+
+    throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found");
+}
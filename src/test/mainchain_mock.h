@@ -0,0 +1,125 @@
+// Copyright (c) 2025 L2L
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef L2L_TEST_MAINCHAIN_MOCK_H
+#define L2L_TEST_MAINCHAIN_MOCK_H
+
+#include "amount.h"
+#include "drivechain.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <univalue.h>
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+/**
+ * Local stand-in for the patched bitcoin node and the enforcer, for tests and
+ * benchmarks of the drivechain code.
+ *
+ * Serves the mainchain JSON-RPC calls made by drivechain.cpp, including
+ * batches, from a scripted mainchain on a loopback port. Every connection is
+ * served on its own thread, with an optional delay before each reply. How
+ * replies are framed and whether connections are kept open can be changed to
+ * exercise the HTTP client. While
+ * installed, the mock also replaces the deposits the enforcer reports for
+ * each mainchain block, and confirms each BMM request by mining a mainchain
+ * block with the commitment.
+ */
+class CMainchainMock
+{
+public:
+    /** Handler for a JSON-RPC method, may throw a JSONRPCError object */
+    typedef std::function<UniValue(const UniValue& params)> Method;
+
+    /** Handler for a raw HTTP request body, returns the status and body of the reply */
+    typedef std::function<std::pair<int, std::string>(const std::string& strRequest)> HTTPHandler;
+
+    enum class CloseMode {
+        KEEP_ALIVE,   //!< Keep connections open
+        CLOSE_HEADER, //!< Send "Connection: close" and close after each reply
+        DROP_SILENTLY //!< Close after each reply without telling the client
+    };
+
+    /** Start serving a mainchain with nBlocks blocks, genesis included */
+    explicit CMainchainMock(int nBlocks = 1);
+    ~CMainchainMock();
+
+    /** Send mainchain requests, deposit queries and BMM requests to this mock */
+    void Install();
+
+    /** Restore the default mainchain endpoint, deposit source and BMM handler */
+    void Uninstall();
+
+    int GetPort() const;
+    int GetConnectionCount() const { return nConnections; }
+    int GetRequestCount() const { return nRequests; }
+
+    /** Wait nMillis milliseconds before sending each reply */
+    void SetLatency(int64_t nMillis) { nLatency = nMillis; }
+
+    void SetCloseMode(CloseMode modeIn) { mode = modeIn; }
+
+    /** Send replies with chunked transfer encoding, in small chunks */
+    void SetChunked(bool fChunkedIn) { fChunked = fChunkedIn; }
+
+    /** Add nBlocks blocks to the mainchain tip */
+    void Mine(int nBlocks);
+
+    /** Replace the last nDepth blocks with nBlocks new ones */
+    void Reorg(int nDepth, int nBlocks);
+
+    std::vector<uint256> GetBlockHashes() const;
+
+    /** Mine a block with nDeposits deposits of amount each */
+    void AddDeposits(int nDeposits, CAmount amount);
+
+    /** Get the (mainchain block, h*) pairs of the BMM requests confirmed so far */
+    std::vector<std::pair<uint256, uint256>> GetBMMCommits() const;
+
+    /** Serve strMethod with method instead of the built-in handler */
+    void SetMethod(const std::string& strMethod, Method method);
+
+    /** Answer every request with handler instead of JSON-RPC, or restore JSON-RPC with nullptr */
+    void SetHTTPHandler(HTTPHandler handler);
+
+private:
+    boost::asio::io_context io;
+    boost::asio::ip::tcp::acceptor acceptor;
+    std::thread threadAccept;
+    std::atomic<bool> fStop{false};
+    std::atomic<int> nConnections{0};
+    std::atomic<int> nRequests{0};
+    std::atomic<int64_t> nLatency{0};
+    std::atomic<CloseMode> mode{CloseMode::KEEP_ALIVE};
+    std::atomic<bool> fChunked{false};
+    bool fInstalled = false;
+
+    mutable Mutex cs;
+    std::vector<uint256> vBlockHash GUARDED_BY(cs);
+    uint64_t nNextBlock GUARDED_BY(cs) = 0;
+    std::vector<DrivechainDeposit> vDeposit GUARDED_BY(cs);
+    std::vector<std::pair<uint256, uint256>> vBMMCommit GUARDED_BY(cs);
+    std::map<std::string, Method> mapMethod GUARDED_BY(cs);
+    HTTPHandler httpHandler GUARDED_BY(cs);
+    std::vector<std::shared_ptr<boost::asio::ip::tcp::socket>> vSocket GUARDED_BY(cs);
+    std::vector<std::thread> vThread GUARDED_BY(cs);
+
+    void AcceptLoop();
+    void Serve(std::shared_ptr<boost::asio::ip::tcp::socket> socket);
+    std::string HandleRequest(const std::string& strRequest);
+    UniValue HandleCall(const UniValue& call);
+    UniValue CallBuiltin(const std::string& strMethod, const UniValue& params);
+};
+
+#endif // L2L_TEST_MAINCHAIN_MOCK_H
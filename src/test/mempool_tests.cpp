@@ -384,4 +384,49 @@ BOOST_AUTO_TEST_CASE(SetSanityCheck) {
     BOOST_CHECK_EQUAL(pool.GetCheckFrequency(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(GetAddedSince) {
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    std::list<CTransaction> removed;
+
+    std::vector<CMutableTransaction> vtx(3);
+    for (size_t i = 0; i < vtx.size(); i++) {
+        vtx[i].vin.resize(1);
+        vtx[i].vin[0].scriptSig = CScript() << OP_11;
+        vtx[i].vin[0].prevout.n = i;
+        vtx[i].vout.resize(1);
+        vtx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        vtx[i].vout[0].nValue = 10000LL;
+    }
+
+    pool.addUnchecked(vtx[0].GetHash(), entry.FromTx(vtx[0]));
+    uint64_t nSequence = pool.GetRecentlyAddedSequence();
+    pool.addUnchecked(vtx[1].GetHash(), entry.FromTx(vtx[1]));
+    pool.addUnchecked(vtx[2].GetHash(), entry.FromTx(vtx[2]));
+
+    std::vector<CTxMemPool::txiter> vAdded;
+    BOOST_CHECK(pool.GetAddedSince(nSequence, vAdded));
+    BOOST_CHECK_EQUAL(vAdded.size(), 2);
+    BOOST_CHECK(vAdded[0]->GetTx().GetHash() == vtx[1].GetHash());
+    BOOST_CHECK(vAdded[1]->GetTx().GetHash() == vtx[2].GetHash());
+
+    // Removed transactions are left out, and ones added again only show once
+    pool.remove(vtx[1], removed, true);
+    pool.remove(vtx[2], removed, true);
+    pool.addUnchecked(vtx[2].GetHash(), entry.FromTx(vtx[2]));
+    vAdded.clear();
+    BOOST_CHECK(pool.GetAddedSince(nSequence, vAdded));
+    BOOST_CHECK_EQUAL(vAdded.size(), 1);
+    BOOST_CHECK(vAdded[0]->GetTx().GetHash() == vtx[2].GetHash());
+
+    vAdded.clear();
+    BOOST_CHECK(pool.GetAddedSince(pool.GetRecentlyAddedSequence(), vAdded));
+    BOOST_CHECK(vAdded.empty());
+
+    // Clearing the mempool forgets what was added before
+    pool.clear();
+    BOOST_CHECK(!pool.GetAddedSince(nSequence, vAdded));
+    BOOST_CHECK(pool.GetAddedSince(pool.GetRecentlyAddedSequence(), vAdded));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -18,6 +18,7 @@
 #include "key.h"
 #include "main.h"
 #include "miner.h"
+#include "proof_verifier.h"
 #include "pubkey.h"
 #include "random.h"
 #include "txdb.h"
@@ -54,6 +55,7 @@ BasicTestingSetup::BasicTestingSetup(const std::string& chainName)
     SetupEnvironment();
     SetupNetworking();
     InitSignatureCache(DEFAULT_MAX_SIG_CACHE_SIZE * ((size_t) 1 << 20));
+    InitJoinSplitCache(DEFAULT_MAX_SIG_CACHE_SIZE * ((size_t) 1 << 20));
     bundlecache::init(DEFAULT_MAX_SIG_CACHE_SIZE * ((size_t) 1 << 20));
 
     // Uncomment this to log all errors to stdout so we see them in test output.
@@ -56,6 +56,14 @@ static const char DB_SPENTINDEX = 'p';
 static const char DB_TIMESTAMPINDEX = 'T';
 static const char DB_BLOCKHASHINDEX = 'h';
 
+// drivechain deposits
+static const char DB_DEPOSIT = 'd';
+static const char DB_DEPOSIT_UNPAID = 'u';
+static const char DB_DEPOSIT_PAID = 'p';
+static const char DB_DEPOSIT_MAINBLOCK = 'h';
+static const char DB_DEPOSIT_BEST_MAINBLOCK = 'B';
+static const char DB_DEPOSIT_BEST_BLOCK = 'b';
+
 CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe) {
 }
 
@@ -708,7 +716,8 @@ bool CBlockTreeDB::LoadBlockIndexGuts(
                 pindexNew->nTime          = diskindex.nTime;
                 pindexNew->nBits          = diskindex.nBits;
                 pindexNew->nNonce         = diskindex.nNonce;
-                // the Equihash solution will be loaded lazily from the dbindex entry
+                // a solution other than the placeholder will be loaded lazily from the dbindex entry
+                pindexNew->SetDiskSolution(diskindex.nSolution);
                 pindexNew->nStatus        = diskindex.nStatus;
                 pindexNew->nCachedBranchId = diskindex.nCachedBranchId;
                 pindexNew->nTx            = diskindex.nTx;
@@ -779,3 +788,104 @@ bool CBlockTreeDB::LoadBlockIndexGuts(
 
     return true;
 }
+
+CDepositDB::CDepositDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "deposits", nCacheSize, fMemory, fWipe) {
+}
+
+bool CDepositDB::ReadBestMainBlock(int& nHeight) const {
+    if (!Read(DB_DEPOSIT_BEST_MAINBLOCK, nHeight))
+        nHeight = -1;
+    return true;
+}
+
+bool CDepositDB::ReadMainBlockHash(int nHeight, uint256& hash) const {
+    return Read(make_pair(DB_DEPOSIT_MAINBLOCK, nHeight), hash);
+}
+
+bool CDepositDB::WriteMainBlocks(int nFork, const std::vector<uint256>& vHash, const std::vector<DrivechainDeposit>& vDeposit) {
+    int nBest;
+    if (!ReadBestMainBlock(nBest))
+        return false;
+
+    CDBBatch batch(*this);
+
+    // Forget the deposits above the fork. They stay in the paid index if a
+    // connected block paid them out.
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(make_pair(DB_DEPOSIT, DrivechainDepositKey(nFork + 1, 0, 0)));
+    while (pcursor->Valid()) {
+        std::pair<char, DrivechainDepositKey> key;
+        if (!(pcursor->GetKey(key) && key.first == DB_DEPOSIT))
+            break;
+        batch.Erase(key);
+        batch.Erase(make_pair(DB_DEPOSIT_UNPAID, key.second));
+        pcursor->Next();
+    }
+    for (int nHeight = nFork + 1; nHeight <= nBest; nHeight++)
+        batch.Erase(make_pair(DB_DEPOSIT_MAINBLOCK, nHeight));
+
+    for (size_t i = 0; i < vHash.size(); i++)
+        batch.Write(make_pair(DB_DEPOSIT_MAINBLOCK, nFork + 1 + (int)i), vHash[i]);
+    for (const DrivechainDeposit& deposit : vDeposit) {
+        DrivechainDepositKey key(deposit);
+        batch.Write(make_pair(DB_DEPOSIT, key), deposit);
+        if (!Exists(make_pair(DB_DEPOSIT_PAID, key)))
+            batch.Write(make_pair(DB_DEPOSIT_UNPAID, key), '1');
+    }
+    batch.Write(DB_DEPOSIT_BEST_MAINBLOCK, nFork + (int)vHash.size());
+
+    return WriteBatch(batch);
+}
+
+bool CDepositDB::ReadDeposit(const DrivechainDepositKey& key, DrivechainDeposit& deposit) const {
+    return Read(make_pair(DB_DEPOSIT, key), deposit);
+}
+
+bool CDepositDB::ReadUnpaidDeposits(std::vector<DrivechainDeposit>& vDeposit) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(make_pair(DB_DEPOSIT_UNPAID, DrivechainDepositKey()));
+
+    while (pcursor->Valid()) {
+        std::pair<char, DrivechainDepositKey> key;
+        if (!(pcursor->GetKey(key) && key.first == DB_DEPOSIT_UNPAID))
+            break;
+        DrivechainDeposit deposit;
+        if (!ReadDeposit(key.second, deposit))
+            return error("%s: unpaid deposit missing from deposit database", __func__);
+        vDeposit.push_back(deposit);
+        pcursor->Next();
+    }
+    return true;
+}
+
+bool CDepositDB::ReadPaid(const DrivechainDepositKey& key, uint256& hashBlock) const {
+    return Read(make_pair(DB_DEPOSIT_PAID, key), hashBlock);
+}
+
+bool CDepositDB::ReadBestBlock(uint256& hashBlock) const {
+    if (!Read(DB_DEPOSIT_BEST_BLOCK, hashBlock))
+        hashBlock.SetNull();
+    return true;
+}
+
+bool CDepositDB::WritePaid(const std::vector<DrivechainDepositKey>& vKey, const uint256& hashBlock) {
+    CDBBatch batch(*this);
+    for (const DrivechainDepositKey& key : vKey) {
+        batch.Write(make_pair(DB_DEPOSIT_PAID, key), hashBlock);
+        batch.Erase(make_pair(DB_DEPOSIT_UNPAID, key));
+    }
+    batch.Write(DB_DEPOSIT_BEST_BLOCK, hashBlock);
+    return WriteBatch(batch);
+}
+
+bool CDepositDB::ErasePaid(const std::vector<DrivechainDepositKey>& vKey, const uint256& hashPrevBlock) {
+    CDBBatch batch(*this);
+    for (const DrivechainDepositKey& key : vKey) {
+        batch.Erase(make_pair(DB_DEPOSIT_PAID, key));
+        if (Exists(make_pair(DB_DEPOSIT, key)))
+            batch.Write(make_pair(DB_DEPOSIT_UNPAID, key), '1');
+    }
+    batch.Write(DB_DEPOSIT_BEST_BLOCK, hashPrevBlock);
+    return WriteBatch(batch);
+}
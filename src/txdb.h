@@ -10,6 +10,7 @@
 #include "coins.h"
 #include "dbwrapper.h"
 #include "chain.h"
+#include "drivechain.h"
 
 #include <map>
 #include <string>
@@ -157,4 +158,50 @@ public:
         const CChainParams& chainParams);
 };
 
+/**
+ * Access to the drivechain deposit database (deposits/). Holds the deposits
+ * of every followed mainchain block keyed by their position on the mainchain,
+ * the hashes of those blocks, and an index of the deposits that were paid out
+ * by connected blocks and of those that are still unpaid.
+ *
+ * The paid index is written as blocks are connected, ahead of the lazily
+ * flushed chainstate, so it also records the sidechain block it is at. See
+ * ReconcileDrivechainDeposits.
+ */
+class CDepositDB : public CDBWrapper
+{
+public:
+    CDepositDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CDepositDB(const CDepositDB&);
+    void operator=(const CDepositDB&);
+public:
+    /** Height of the last stored mainchain block, -1 if there is none */
+    bool ReadBestMainBlock(int& nHeight) const;
+    bool ReadMainBlockHash(int nHeight, uint256& hash) const;
+
+    /**
+     * Forget the mainchain blocks above nFork with their deposits, then
+     * store the blocks vHash from height nFork + 1 on with their deposits.
+     * Deposits that were already paid out are not marked unpaid.
+     */
+    bool WriteMainBlocks(int nFork, const std::vector<uint256>& vHash, const std::vector<DrivechainDeposit>& vDeposit);
+
+    bool ReadDeposit(const DrivechainDepositKey& key, DrivechainDeposit& deposit) const;
+
+    /** Unpaid deposits in mainchain order, visits only the unpaid index */
+    bool ReadUnpaidDeposits(std::vector<DrivechainDeposit>& vDeposit);
+
+    /** Sidechain block that paid out the deposit at key */
+    bool ReadPaid(const DrivechainDepositKey& key, uint256& hashBlock) const;
+
+    /** Last sidechain block applied to the paid index, null if there is none */
+    bool ReadBestBlock(uint256& hashBlock) const;
+
+    /** Mark the deposits at vKey paid by the connected block hashBlock */
+    bool WritePaid(const std::vector<DrivechainDepositKey>& vKey, const uint256& hashBlock);
+    /** Mark the deposits at vKey unpaid again, leaving the paid index at hashPrevBlock */
+    bool ErasePaid(const std::vector<DrivechainDepositKey>& vKey, const uint256& hashPrevBlock);
+};
+
 #endif // BITCOIN_TXDB_H
@@ -21,10 +21,14 @@
 
 #include <rust/metrics.h>
 
+#include <algorithm>
 #include <optional>
 
 using namespace std;
 
+/** Number of additions kept for GetAddedSince */
+static const size_t MAX_ADDED_LOG_SIZE = 100000;
+
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
                                  int64_t _nTime, unsigned int _nHeight,
                                  bool poolHasNoInputsOf,
@@ -407,6 +411,11 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     const CTransaction& tx = newit->GetTx();
     mapRecentlyAddedTx[tx.GetHash()] = &tx;
     nRecentlyAddedSequence += 1;
+    addedLog.emplace_back(nRecentlyAddedSequence, tx.GetHash());
+    if (addedLog.size() > MAX_ADDED_LOG_SIZE) {
+        nAddedLogBegin = addedLog.front().first;
+        addedLog.pop_front();
+    }
     std::set<uint256> setParentTransactions;
     for (unsigned int i = 0; i < tx.vin.size(); i++) {
         mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
@@ -430,14 +439,14 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
 
     for (const JSDescription &joinsplit : tx.vJoinSplit) {
         for (const uint256 &nf : joinsplit.nullifiers) {
-            mapSproutNullifiers[nf] = &tx;
+            mapSproutNullifiers.set(nf, &tx);
         }
     }
     for (const auto& spendDescription : tx.GetSaplingSpends()) {
-        mapSaplingNullifiers[spendDescription.nullifier()] = &tx;
+        mapSaplingNullifiers.set(uint256::FromRawBytes(spendDescription.nullifier()), &tx);
     }
     for (const uint256 &orchardNullifier : tx.GetOrchardBundle().GetNullifiers()) {
-        mapOrchardNullifiers[orchardNullifier] = &tx;
+        mapOrchardNullifiers.set(orchardNullifier, &tx);
     }
 
     nTransactionsUpdated++;
@@ -565,7 +574,7 @@ void CTxMemPool::removeUnchecked(txiter it)
         }
     }
     for (const auto& spendDescription : it->GetTx().GetSaplingSpends()) {
-        mapSaplingNullifiers.erase(spendDescription.nullifier());
+        mapSaplingNullifiers.erase(uint256::FromRawBytes(spendDescription.nullifier()));
     }
     for (const uint256 &orchardNullifier : it->GetTx().GetOrchardBundle().GetNullifiers()) {
         mapOrchardNullifiers.erase(orchardNullifier);
@@ -751,31 +760,22 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
 
     for (const JSDescription &joinsplit : tx.vJoinSplit) {
         for (const uint256 &nf : joinsplit.nullifiers) {
-            std::map<uint256, const CTransaction*>::iterator it = mapSproutNullifiers.find(nf);
-            if (it != mapSproutNullifiers.end()) {
-                const CTransaction &txConflict = *it->second;
-                if (txConflict != tx) {
-                    remove(txConflict, removed, true);
-                }
+            const CTransaction* ptxConflict = mapSproutNullifiers.find(nf);
+            if (ptxConflict && *ptxConflict != tx) {
+                remove(*ptxConflict, removed, true);
             }
         }
     }
     for (const auto& spendDescription : tx.GetSaplingSpends()) {
-        auto it = mapSaplingNullifiers.find(spendDescription.nullifier());
-        if (it != mapSaplingNullifiers.end()) {
-            const CTransaction &txConflict = *it->second;
-            if (txConflict != tx) {
-                remove(txConflict, removed, true);
-            }
+        const CTransaction* ptxConflict = mapSaplingNullifiers.find(uint256::FromRawBytes(spendDescription.nullifier()));
+        if (ptxConflict && *ptxConflict != tx) {
+            remove(*ptxConflict, removed, true);
         }
     }
     for (const uint256 &orchardNullifier : tx.GetOrchardBundle().GetNullifiers()) {
-        std::map<uint256, const CTransaction*>::iterator it = mapOrchardNullifiers.find(orchardNullifier);
-        if (it != mapOrchardNullifiers.end()) {
-            const CTransaction &txConflict = *it->second;
-            if (txConflict != tx) {
-                remove(txConflict, removed, true);
-            }
+        const CTransaction* ptxConflict = mapOrchardNullifiers.find(orchardNullifier);
+        if (ptxConflict && *ptxConflict != tx) {
+            remove(*ptxConflict, removed, true);
         }
     }
 }
@@ -854,9 +854,14 @@ void CTxMemPool::_clear()
     mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
+    mapSproutNullifiers.clear();
+    mapSaplingNullifiers.clear();
+    mapOrchardNullifiers.clear();
     totalTxSize = 0;
     cachedInnerUsage = 0;
     ++nTransactionsUpdated;
+    addedLog.clear();
+    nAddedLogBegin = nRecentlyAddedSequence;
 }
 
 void CTxMemPool::clear()
@@ -984,16 +989,15 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
     assert(innerUsage == cachedInnerUsage);
 }
 
-template<typename T>
-void CTxMemPool::checkNullifiers(const std::map<T, const CTransaction*>& mapToUse) const
+void CTxMemPool::checkNullifiers(const NullifierMap& mapToUse) const
 {
-    for (const auto& entry : mapToUse) {
-        uint256 hash = entry.second->GetHash();
+    mapToUse.ForEach([&](const uint256& nullifier, const CTransaction* ptx) {
+        uint256 hash = ptx->GetHash();
         CTxMemPool::indexed_transaction_set::const_iterator findTx = mapTx.find(hash);
-        const CTransaction& tx = findTx->GetTx();
         assert(findTx != mapTx.end());
-        assert(&tx == entry.second);
-    }
+        const CTransaction& tx = findTx->GetTx();
+        assert(&tx == ptx);
+    });
 }
 
 bool CTxMemPool::CompareDepthAndScore(const uint256& hasha, const uint256& hashb)
@@ -1094,6 +1098,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const std::string str
         txiter it = mapTx.find(hash);
         if (it != mapTx.end()) {
             mapTx.modify(it, update_fee_delta(delta));
+            nPrioritisedSequence++;
             // Now update all ancestors' modified fees with descendants
             setEntries setAncestors;
             uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -1137,7 +1142,7 @@ bool CTxMemPool::nullifierExists(const uint256& nullifier, ShieldedType type) co
         case SPROUT:
             return mapSproutNullifiers.count(nullifier);
         case SAPLING:
-            return mapSaplingNullifiers.count(nullifier.GetRawBytes());
+            return mapSaplingNullifiers.count(nullifier);
         case ORCHARD:
             return mapOrchardNullifiers.count(nullifier);
         default:
@@ -1167,6 +1172,40 @@ void CTxMemPool::SetNotifiedSequence(uint64_t recentlyAddedSequence) {
     nNotifiedSequence = recentlyAddedSequence;
 }
 
+uint64_t CTxMemPool::GetRecentlyAddedSequence() const
+{
+    LOCK(cs);
+    return nRecentlyAddedSequence;
+}
+
+uint64_t CTxMemPool::GetPrioritisedSequence() const
+{
+    LOCK(cs);
+    return nPrioritisedSequence;
+}
+
+bool CTxMemPool::GetAddedSince(uint64_t recentlyAddedSequence, std::vector<txiter>& vAdded) const
+{
+    LOCK(cs);
+    if (recentlyAddedSequence < nAddedLogBegin)
+        return false;
+
+    // The log is ordered by sequence number
+    auto it = std::upper_bound(addedLog.begin(), addedLog.end(), recentlyAddedSequence,
+        [](uint64_t sequence, const std::pair<uint64_t, uint256>& added) {
+            return sequence < added.first;
+        });
+
+    // A tx that was removed and added again is only reported once
+    std::set<uint256> setSeen;
+    for (; it != addedLog.end(); ++it) {
+        txiter mi = mapTx.find(it->second);
+        if (mi != mapTx.end() && setSeen.insert(it->second).second)
+            vAdded.push_back(mi);
+    }
+    return true;
+}
+
 bool CTxMemPool::IsFullyNotified() {
     assert(Params().NetworkIDString() == "regtest");
     LOCK(cs);
@@ -1213,11 +1252,12 @@ size_t CTxMemPool::DynamicMemoryUsage() const {
 
     // Wallet notification
     total += memusage::DynamicUsage(mapRecentlyAddedTx);
+    total += addedLog.size() * sizeof(std::pair<uint64_t, uint256>);
 
     // Nullifier set tracking
-    total += memusage::DynamicUsage(mapSproutNullifiers) +
-             memusage::DynamicUsage(mapSaplingNullifiers) +
-             memusage::DynamicUsage(mapOrchardNullifiers);
+    total += mapSproutNullifiers.DynamicMemoryUsage() +
+             mapSaplingNullifiers.DynamicMemoryUsage() +
+             mapOrchardNullifiers.DynamicMemoryUsage();
 
     // DoS mitigation
     total += memusage::DynamicUsage(recentlyEvicted) + memusage::DynamicUsage(limitSet);
@@ -7,6 +7,7 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <deque>
 #include <list>
 #include <memory>
 #include <set>
@@ -15,6 +16,7 @@
 #include "amount.h"
 #include "coins.h"
 #include "mempool_limit.h"
+#include "nullifier_map.h"
 #include "primitives/transaction.h"
 #include "sync.h"
 #include "random.h"
@@ -353,14 +355,21 @@ private:
     uint64_t nRecentlyAddedSequence = 0;
     uint64_t nNotifiedSequence = 0;
 
-    std::map<uint256, const CTransaction*> mapSproutNullifiers;
-    std::map<libzcash::nullifier_t, const CTransaction*> mapSaplingNullifiers;
-    std::map<uint256, const CTransaction*> mapOrchardNullifiers;
+    // Txids by the sequence number they were added with, for incremental
+    // block template updates. Only sequence numbers after nAddedLogBegin are
+    // in the log.
+    std::deque<std::pair<uint64_t, uint256>> addedLog;
+    uint64_t nAddedLogBegin = 0;
+    // Incremented whenever a fee delta changes the selection weight of a tx
+    uint64_t nPrioritisedSequence = 0;
+
+    NullifierMap mapSproutNullifiers;
+    NullifierMap mapSaplingNullifiers;
+    NullifierMap mapOrchardNullifiers;
     RecentlyEvictedList* recentlyEvicted = new RecentlyEvictedList(GetNodeClock(), DEFAULT_MEMPOOL_EVICTION_MEMORY_MINUTES * 60);
     MempoolLimitTxSet* limitSet = new MempoolLimitTxSet(DEFAULT_MEMPOOL_TOTAL_COST_LIMIT);
 
-    template<typename T>
-    void checkNullifiers(const std::map<T, const CTransaction*>& mapToUse) const;
+    void checkNullifiers(const NullifierMap& mapToUse) const;
 
     CFeeRate minReasonableRelayFee;
 
@@ -558,6 +567,15 @@ public:
     void SetNotifiedSequence(uint64_t recentlyAddedSequence);
     bool IsFullyNotified();
 
+    uint64_t GetRecentlyAddedSequence() const;
+    uint64_t GetPrioritisedSequence() const;
+    /**
+     * Get the transactions still in the mempool that were added after
+     * recentlyAddedSequence, in the order they were added. Returns false if
+     * that sequence number is too old to tell.
+     */
+    bool GetAddedSince(uint64_t recentlyAddedSequence, std::vector<txiter>& vAdded) const;
+
     unsigned long size() const
     {
         LOCK(cs);
@@ -93,6 +93,7 @@ protected:
     virtual void ResendWalletTransactions(int64_t nBestBlockTime) {}
     virtual void BlockChecked(const CBlock&, const CValidationState&) {}
     virtual void GetAddressForMining(std::optional<MinerAddress>&) {};
+    virtual void UpdatedMainchainTip(const uint256 &hashTip, int nHeight, const std::vector<uint256> &vDisconnected) {}
     friend void ::RegisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterAllValidationInterfaces();
@@ -162,6 +163,12 @@ struct CMainSignals {
     boost::signals2::signal<void (const CBlock&, const CValidationState&)> BlockChecked;
     /** Notifies listeners that an address for mining is required (coinbase) */
     boost::signals2::signal<void (std::optional<MinerAddress>&)> AddressForMining;
+    /**
+     * Notifies listeners of a new mainchain tip in the drivechain mainchain
+     * block cache, along with any cached mainchain blocks that were
+     * disconnected by a mainchain reorg.
+     */
+    boost::signals2::signal<void (const uint256 &, int, const std::vector<uint256> &)> UpdatedMainchainTip;
 };
 
 CMainSignals& GetMainSignals();
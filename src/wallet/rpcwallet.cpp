@@ -3098,7 +3098,12 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
                 sample_times.push_back(std::accumulate(vals.begin(), vals.end(), 0.0) / (nThreads*nThreads));
             }
         } else if (benchmarktype == "verifyjoinsplit") {
-            sample_times.push_back(benchmark_verify_joinsplit(samplejoinsplit));
+            if (params.size() < 4) {
+                sample_times.push_back(benchmark_verify_joinsplit(samplejoinsplit));
+            } else {
+                int nJoinSplits = params[3].get_int();
+                sample_times.push_back(benchmark_verify_joinsplits(samplejoinsplit, nJoinSplits));
+            }
 #ifdef ENABLE_MINING
         } else if (benchmarktype == "solveequihash") {
             if (params.size() < 3) {
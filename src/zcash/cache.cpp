@@ -5,18 +5,38 @@
 #include "zcash/cache.h"
 #include "util/system.h"
 
+#include <map>
+#include <mutex>
+
 namespace libzcash
 {
+// The caches are owned by the Rust side and live until shutdown
+static std::mutex cs_bundlecaches;
+static std::map<std::string, const BundleValidityCache*> mapBundleCaches;
+
 std::unique_ptr<BundleValidityCache> NewBundleValidityCache(rust::Str kind, size_t nMaxCacheSize)
 {
     auto cache = std::unique_ptr<BundleValidityCache>(new BundleValidityCache());
     size_t nElems = cache->setup_bytes(nMaxCacheSize);
     LogPrintf("Using %zu MiB out of %zu requested for %s bundle cache, able to store %zu elements\n",
               (nElems * sizeof(BundleCacheEntry)) >> 20, nMaxCacheSize >> 20, kind, nElems);
+    {
+        std::lock_guard<std::mutex> lock(cs_bundlecaches);
+        mapBundleCaches[std::string(kind)] = cache.get();
+    }
     return cache;
 }
+
+BundleCacheStats GetBundleCacheStats(const std::string& kind)
+{
+    std::lock_guard<std::mutex> lock(cs_bundlecaches);
+    auto it = mapBundleCaches.find(kind);
+    if (it == mapBundleCaches.end())
+        return BundleCacheStats();
+    return it->second->GetStats();
+}
 } // namespace libzcash
 
 // Explicit instantiations for libzcash::BundleValidityCache
-template void libzcash::BundleValidityCache::insert(libzcash::BundleCacheEntry e);
-template bool libzcash::BundleValidityCache::contains(const libzcash::BundleCacheEntry& e, const bool erase) const;
+template void CuckooCache::cache<libzcash::BundleCacheEntry, libzcash::BundleCacheHasher>::insert(libzcash::BundleCacheEntry e);
+template bool CuckooCache::cache<libzcash::BundleCacheEntry, libzcash::BundleCacheHasher>::contains(const libzcash::BundleCacheEntry& e, const bool erase) const;
@@ -10,6 +10,8 @@
 #include <rust/cxx.h>
 
 #include <array>
+#include <atomic>
+#include <string>
 
 namespace libzcash
 {
@@ -36,9 +38,43 @@ public:
     }
 };
 
-typedef CuckooCache::cache<BundleCacheEntry, BundleCacheHasher> BundleValidityCache;
+/** Number of lookups in a bundle validity cache, by outcome */
+struct BundleCacheStats
+{
+    uint64_t nHits = 0;
+    uint64_t nMisses = 0;
+};
+
+class BundleValidityCache : public CuckooCache::cache<BundleCacheEntry, BundleCacheHasher>
+{
+private:
+    mutable std::atomic<uint64_t> nHits{0};
+    mutable std::atomic<uint64_t> nMisses{0};
+
+public:
+    bool contains(const BundleCacheEntry& e, const bool erase) const
+    {
+        bool fHit = cache::contains(e, erase);
+        (fHit ? nHits : nMisses)++;
+        return fHit;
+    }
+
+    BundleCacheStats GetStats() const
+    {
+        BundleCacheStats stats;
+        stats.nHits = nHits;
+        stats.nMisses = nMisses;
+        return stats;
+    }
+};
 
 std::unique_ptr<BundleValidityCache> NewBundleValidityCache(rust::Str kind, size_t nMaxCacheSize);
+
+/**
+ * Get the lookup counts of the bundle validity cache of the given kind
+ * ("Sapling" or "Orchard"), or zeros if it hasn't been created yet.
+ */
+BundleCacheStats GetBundleCacheStats(const std::string& kind);
 } // namespace libzcash
 
 #endif // ZCASH_ZCASH_CACHE_H
@@ -151,6 +151,23 @@ double benchmark_verify_joinsplit(const JSDescription &joinsplit)
     return timer_stop(tv_start);
 }
 
+// Verify nJoinSplits copies of joinsplit the way CheckBlock verifies the
+// JoinSplits of a block.
+double benchmark_verify_joinsplits(const JSDescription &joinsplit, size_t nJoinSplits)
+{
+    std::vector<CTransaction> vtx;
+    for (size_t i = 0; i < nJoinSplits; i++) {
+        CMutableTransaction mtx;
+        mtx.vJoinSplit.push_back(joinsplit);
+        vtx.push_back(mtx);
+    }
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    VerifySproutProofs(vtx, false);
+    return timer_stop(tv_start);
+}
+
 #ifdef ENABLE_MINING
 double benchmark_solve_equihash()
 {